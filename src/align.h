@@ -4,10 +4,17 @@
 #include <boost/multi_array.hpp>
 
 #include <iostream>
+#include <string>
+#include <algorithm>
+#include <cmath>
 
 namespace torali
 {
 
+  #ifndef DELLY_MAX_TRACE
+  #define DELLY_MAX_TRACE 16777216
+  #endif
+
   template<typename TScoreValue>
   struct DnaScore {
     typedef TScoreValue TValue;
@@ -31,7 +38,43 @@ namespace torali
     }
   };
 
-  
+
+  // View on a 4-bit packed (BAM) read sequence, the reverse complement is read back-to-front without a copy
+  struct ReadSeq {
+    uint8_t const* seq;
+    std::size_t beg;
+    std::size_t len;
+    bool rev;
+
+    ReadSeq(uint8_t const* s, std::size_t const b, std::size_t const l, bool const r) : seq(s), beg(b), len(l), rev(r) {}
+
+    inline std::size_t
+    size() const {
+      return len;
+    }
+
+    inline char
+    operator[](std::size_t const i) const {
+      std::size_t p = rev ? (beg + len - 1 - i) : (beg + i);
+      uint8_t code = (seq[p >> 1] >> ((~p & 1) << 2)) & 0xf;
+      return rev ? "=TGMCRSVAWYHKDBN"[code] : "=ACMGRSVTWYHKDBN"[code];
+    }
+
+    // Sub-view, clipped at the sequence end like std::string::substr
+    inline ReadSeq
+    substr(std::size_t const pos, std::size_t const n) const {
+      std::size_t l = std::min(n, len - pos);
+      if (rev) return ReadSeq(seq, beg + len - pos - l, l, true);
+      return ReadSeq(seq, beg + pos, l, false);
+    }
+
+    inline std::string
+    str() const {
+      std::string s(len, 'N');
+      for(std::size_t i = 0; i < len; ++i) s[i] = (*this)[i];
+      return s;
+    }
+  };
 
   // Configure the DP matrix
   template<bool THorizontal = false, bool TVertical = false>
@@ -79,6 +122,13 @@ namespace torali
     else return cost;
   }
 
+  // Number of DP rows per trace block, larger alignments are traced back from row checkpoints
+  inline std::size_t
+  _traceBlockRows(std::size_t const m, std::size_t const n) {
+    if ((m + 1) * (n + 1) <= (std::size_t) DELLY_MAX_TRACE) return m + 1;
+    return std::max((std::size_t) DELLY_MAX_TRACE / (n + 1), (std::size_t) std::sqrt((double) (m + 1)) + 1);
+  }
+
   template<typename TChar, typename TDimension>
   inline std::size_t
   _size(boost::multi_array<TChar, 2> const& a, TDimension const i) {
@@ -93,6 +143,13 @@ namespace torali
   }
 
 
+  template<typename TDimension>
+  inline std::size_t
+  _size(ReadSeq const& s, TDimension const i) {
+    if (i) return s.size();
+    return 1;
+  }
+
   template<typename TProfile, typename TAIndex, typename TScore>
   inline int
     _score(std::string const& s1, std::string const& s2, TProfile const&, TProfile const&, TAIndex row, TAIndex col, TScore const& sc)
@@ -100,6 +157,13 @@ namespace torali
     return (s1[row] == s2[col] ? sc.match : sc.mismatch );
   }
 
+  template<typename TProfile, typename TAIndex, typename TScore>
+  inline int
+    _score(std::string const& s1, ReadSeq const& s2, TProfile const&, TProfile const&, TAIndex row, TAIndex col, TScore const& sc)
+  {
+    return (s1[row] == s2[col] ? sc.match : sc.mismatch );
+  }
+
   template<typename TChar, typename TProfile, typename TAIndex, typename TScore>
   inline int
   _score(boost::multi_array<TChar, 2> const& a1, boost::multi_array<TChar, 2> const& a2, TProfile const& p1, TProfile const& p2, TAIndex row, TAIndex col, TScore const& sc)
@@ -118,6 +182,119 @@ namespace torali
   }
 
 
+  // Integer alignment profile
+  struct CountProfile {
+    typedef boost::multi_array<uint16_t, 2> TCounts;
+    typedef boost::multi_array<int32_t, 2> TWeights;
+    
+    TCounts counts;    // 'A', 'C', 'G', 'T', 'N', '-' and the number of sequences covering a column
+    TWeights weights;  // Symbol counts times substitution score for 'A', 'C', 'G', 'T', 'N'
+  };
+
+  template<typename TChar, typename TAIndex, typename TScore>
+  inline int
+  _score(boost::multi_array<TChar, 2> const& a1, boost::multi_array<TChar, 2> const& a2, CountProfile const& p1, CountProfile const& p2, TAIndex row, TAIndex col, TScore const& sc)
+  {
+    if ((a1.shape()[0] == 1) && (a2.shape()[0] == 1)) {
+      if (a1[0][row] == a2[0][col]) return sc.match;
+      else return sc.mismatch;
+    } else {
+      // Columns without a scored symbol (e.g. IUPAC codes) score 0 like the float profile
+      int64_t denom = (int64_t) p1.counts[6][row] * (int64_t) p2.counts[6][col];
+      if (denom == 0) return 0;
+      int64_t score = 0;
+      for(uint32_t k = 0; k<5; ++k) score += (int64_t) p1.counts[k][row] * (int64_t) p2.weights[k][col];
+      return (int) (score / denom);
+    }
+  }
+
+  template<typename TScore>
+  inline void
+  _weightProfile(TScore const& sc, CountProfile& p)
+  {
+    // Substitution table
+    int32_t subst[5][5];
+    for(uint32_t k1 = 0; k1 < 5; ++k1)
+      for(uint32_t k2 = 0; k2 < 5; ++k2)
+	subst[k1][k2] = (k1 == k2) ? sc.match : sc.mismatch;
+
+    // Weighted counts
+    std::size_t n = p.counts.shape()[1];
+    p.weights.resize(boost::extents[5][n]);
+    for(uint32_t k1 = 0; k1 < 5; ++k1) {
+      for(std::size_t j = 0; j < n; ++j) {
+	int32_t w = 0;
+	for(uint32_t k2 = 0; k2 < 5; ++k2) w += subst[k1][k2] * (int32_t) p.counts[k2][j];
+	p.weights[k1][j] = w;
+      }
+    }
+  }
+
+  template<typename TScore>
+  inline void
+  _createProfile(std::string const& s, TScore const& sc, CountProfile& p)
+  {
+    p.counts.resize(boost::extents[7][s.size()]);
+    for (std::size_t j = 0; j < s.size(); ++j) {
+      for(uint32_t k = 0; k < 7; ++k) p.counts[k][j] = 0;
+      if ((s[j] == 'A') || (s[j] == 'a')) ++p.counts[0][j];
+      else if ((s[j] == 'C') || (s[j] == 'c')) ++p.counts[1][j];
+      else if ((s[j] == 'G') || (s[j] == 'g')) ++p.counts[2][j];
+      else if ((s[j] == 'T') || (s[j] == 't')) ++p.counts[3][j];
+      else if ((s[j] == 'N') || (s[j] == 'n')) ++p.counts[4][j];
+      else if (s[j] == '-') ++p.counts[5][j];
+      p.counts[6][j] = p.counts[0][j] + p.counts[1][j] + p.counts[2][j] + p.counts[3][j] + p.counts[4][j] + p.counts[5][j];
+    }
+    _weightProfile(sc, p);
+  }
+
+  template<typename TScore>
+  inline void
+  _createProfile(ReadSeq const& s, TScore const& sc, CountProfile& p)
+  {
+    _createProfile(s.str(), sc, p);
+  }
+
+  template<typename TScore>
+  inline void
+  _createProfile(boost::multi_array<char, 2> const& a, TScore const& sc, CountProfile& p)
+  {
+    typedef boost::multi_array<char, 2>::index TAIndex;
+    p.counts.resize(boost::extents[7][a.shape()[1]]);
+
+    // Ignore leading and trailing gaps
+    std::vector<int32_t> firstAlignedNuc(a.shape()[0], -1);
+    std::vector<int32_t> lastAlignedNuc(a.shape()[0], a.shape()[1]);
+    for(TAIndex i = 0; i < (TAIndex) a.shape()[0]; ++i) {
+      for (TAIndex j = 0; j < (TAIndex) a.shape()[1]; ++j) {
+	if (firstAlignedNuc[i] == -1) {
+	  if (a[i][j] != '-') firstAlignedNuc[i] = j;
+	}
+	if (firstAlignedNuc[i] != -1) {
+	  if (a[i][j] != '-') lastAlignedNuc[i] = j;
+	}
+      }
+    }
+
+    // Compute count profile
+    for (TAIndex j = 0; j < (TAIndex) a.shape()[1]; ++j) {
+      for(uint32_t k = 0; k < 7; ++k) p.counts[k][j] = 0;
+      for(TAIndex i = 0; i < (TAIndex) a.shape()[0]; ++i) {
+	if ((firstAlignedNuc[i] <= j) && (j <= lastAlignedNuc[i])) {
+	  if ((a[i][j] == 'A') || (a[i][j] == 'a')) ++p.counts[0][j];
+	  else if ((a[i][j] == 'C') || (a[i][j] == 'c')) ++p.counts[1][j];
+	  else if ((a[i][j] == 'G') || (a[i][j] == 'g')) ++p.counts[2][j];
+	  else if ((a[i][j] == 'T') || (a[i][j] == 't')) ++p.counts[3][j];
+	  else if ((a[i][j] == 'N') || (a[i][j] == 'n')) ++p.counts[4][j];
+	  else if (a[i][j] == '-') ++p.counts[5][j];
+	  else continue;
+	  ++p.counts[6][j];
+	}
+      }
+    }
+    _weightProfile(sc, p);
+  }
+
   template<typename TProfile>
   inline void
   _createProfile(std::string const& s, TProfile& p)
@@ -135,6 +312,13 @@ namespace torali
     }
   }
 
+  template<typename TProfile>
+  inline void
+  _createProfile(ReadSeq const& s, TProfile& p)
+  {
+    _createProfile(s.str(), p);
+  }
+
   template<typename TProfile>
   inline void
   _createProfile(boost::multi_array<char, 2> const& a, TProfile& p)
@@ -177,9 +361,9 @@ namespace torali
     }
   }
 
-  template<typename TTrace, typename TAlign>
+  template<typename TTrace, typename TSequence, typename TAlign>
   inline void
-  _createLocalAlignment(TTrace const& trace, std::string const& s1, std::string const& s2, TAlign& align, int32_t const maxRow, int32_t const maxCol)
+  _createLocalAlignment(TTrace const& trace, std::string const& s1, TSequence const& s2, TAlign& align, int32_t const maxRow, int32_t const maxCol)
   {
     align.resize(boost::extents[2][trace.size()]);
     std::size_t row = maxRow;
@@ -199,9 +383,9 @@ namespace torali
     }
   }
 
-  template<typename TTrace, typename TAlign>
+  template<typename TTrace, typename TSequence, typename TAlign>
   inline void
-  _createAlignment(TTrace const& trace, std::string const& s1, std::string const& s2, TAlign& align)
+  _createAlignment(TTrace const& trace, std::string const& s1, TSequence const& s2, TAlign& align)
   {
     _createLocalAlignment(trace, s1, s2, align, 0, 0);
   }
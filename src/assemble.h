@@ -50,7 +50,16 @@ namespace torali
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Split-read assembly" << std::endl;
     boost::progress_display show_progress( hdr->n_targets );
 
+    // Assembly plan, SVs by chromosome ordered by partner chromosome
+    typedef std::vector<std::pair<int32_t, uint32_t> > TPlanSVs;
+    std::vector<TPlanSVs> chrPlan(hdr->n_targets);
+    for(uint32_t svid = 0; svid < svs.size(); ++svid) {
+      if (svs[svid].chr2 <= svs[svid].chr) chrPlan[svs[svid].chr].push_back(std::make_pair(svs[svid].chr2, svid));
+    }
+    for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) std::sort(chrPlan[refIndex].begin(), chrPlan[refIndex].end());
+
     faidx_t* fai = fai_load(c.genome.string().c_str());
+    ReferenceWindows rw(fai, hdr);
     for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
       ++show_progress;
       if (validRegions[refIndex].empty()) continue;
@@ -133,41 +142,33 @@ namespace torali
 	bam_destroy1(rec);
 	hts_itr_destroy(iter);
       }
-      // Handle left-overs and translocations
-      for(int32_t refIndex2 = 0; refIndex2 <= refIndex; ++refIndex2) {
-	char* sndSeq = NULL;
-	for(uint32_t svid = 0; svid < svcons.size(); ++svid) {
-	  if (!svcons[svid]) {
-	    if ((svs[svid].chr != refIndex) || (svs[svid].chr2 != refIndex2)) continue;
-	    bool msaSuccess = false;
-	    if (seqStore[svid].size() > 1) {
-	      // Lazy loading of references
-	      if (refIndex != refIndex2) {
-		if (sndSeq == NULL) {
-		  int32_t seqlen = -1;
-		  std::string tname(hdr->target_name[refIndex2]);
-		  sndSeq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex2], &seqlen);
-		}
-	      }
-	      //std::cerr << svs[svid].svStart << ',' << svs[svid].svEnd << ',' << svs[svid].svt << ',' << svid << " SV" << std::endl;
-	      //for(typename TSequences::iterator it = seqStore[svid].begin(); it != seqStore[svid].end(); ++it) std::cerr << *it << std::endl;
-	      msa(c, seqStore[svid], svs[svid].consensus);
-	      //outputConsensus(hdr, svs[svid], svs[svid].consensus);
-	      if ((svs[svid].svt == 1) || (svs[svid].svt == 5)) reverseComplement(svs[svid].consensus);
-	      //std::cerr << "Consensus: " << svs[svid].consensus << std::endl;
-	      if (alignConsensus(c, hdr, seq, sndSeq, svs[svid])) msaSuccess = true;
-	      //std::cerr << msaSuccess << std::endl;
-	    }
-	    if (!msaSuccess) {
-	      svs[svid].consensus = "";
-	      svs[svid].srSupport = 0;
-	      svs[svid].srAlignQuality = 0;
-	    }
-	    seqStore[svid].clear();
-	    svcons[svid] = true;
+      // Handle left-overs and translocations, partner regions are fetched on demand
+      for(uint32_t k = 0; k < chrPlan[refIndex].size(); ++k) {
+	int32_t refIndex2 = chrPlan[refIndex][k].first;
+	uint32_t svid = chrPlan[refIndex][k].second;
+	if (svcons[svid]) continue;
+	bool msaSuccess = false;
+	if (seqStore[svid].size() > 1) {
+	  //std::cerr << svs[svid].svStart << ',' << svs[svid].svEnd << ',' << svs[svid].svt << ',' << svid << " SV" << std::endl;
+	  //for(typename TSequences::iterator it = seqStore[svid].begin(); it != seqStore[svid].end(); ++it) std::cerr << *it << std::endl;
+	  msa(c, seqStore[svid], svs[svid].consensus);
+	  //outputConsensus(hdr, svs[svid], svs[svid].consensus);
+	  if ((svs[svid].svt == 1) || (svs[svid].svt == 5)) reverseComplement(svs[svid].consensus);
+	  //std::cerr << "Consensus: " << svs[svid].consensus << std::endl;
+	  if (refIndex != refIndex2) {
+	    if (alignConsensus(c, hdr, rw, svs[svid])) msaSuccess = true;
+	  } else {
+	    if (alignConsensus(c, hdr, seq, NULL, svs[svid])) msaSuccess = true;
 	  }
+	  //std::cerr << msaSuccess << std::endl;
+	}
+	if (!msaSuccess) {
+	  svs[svid].consensus = "";
+	  svs[svid].srSupport = 0;
+	  svs[svid].srAlignQuality = 0;
 	}
-	if (sndSeq != NULL) free(sndSeq);
+	seqStore[svid].clear();
+	svcons[svid] = true;
       }
       
       // Clean-up
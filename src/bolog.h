@@ -4,6 +4,8 @@
 #include <boost/math/special_functions/round.hpp>
 #include <boost/math/distributions/normal.hpp>
 
+#include <htslib/vcf.h>
+
 namespace torali {
 
 #define SMALLEST_GL -1000
@@ -20,27 +22,27 @@ struct BoLog {
 };
 
 
- template<typename TBoLog, typename TMapqVector>
+ template<typename TBoLog, typename TPrecision>
  inline void
- _computeGLs(TBoLog const& bl, TMapqVector const& mapqRef, TMapqVector const& mapqAlt, float* gls, int32_t* gqval, int32_t* gts, int const file_c) {
+ _addGL(TBoLog const& bl, uint8_t const mapq, bool const alt, TPrecision const w, TPrecision* gl) {
    typedef typename TBoLog::value_type FLP;
-   FLP gl[3];
-
-   // Compute genotype likelihoods
-   for(unsigned int geno=0; geno<=2; ++geno) gl[geno]=0;
-   unsigned int peDepth=mapqRef.size() + mapqAlt.size();
-   for(typename TMapqVector::const_iterator mapqRefIt = mapqRef.begin();mapqRefIt!=mapqRef.end();++mapqRefIt) {
-     gl[0] += std::log10(bl.phred2prob[*mapqRefIt]);
-     gl[1] += std::log10(bl.phred2prob[*mapqRefIt] + (FLP(1) - bl.phred2prob[*mapqRefIt]));
-     gl[2] += std::log10(FLP(1) - bl.phred2prob[*mapqRefIt]);
-   }
-   for(typename TMapqVector::const_iterator mapqAltIt = mapqAlt.begin();mapqAltIt!=mapqAlt.end();++mapqAltIt) {
-     gl[0] += std::log10(FLP(1) - bl.phred2prob[*mapqAltIt]);
-     gl[1] += std::log10((FLP(1) - bl.phred2prob[*mapqAltIt]) + bl.phred2prob[*mapqAltIt]);
-     gl[2] += std::log10(bl.phred2prob[*mapqAltIt]);
+   if (alt) {
+     gl[0] += w * std::log10(FLP(1) - bl.phred2prob[mapq]);
+     gl[1] += w * std::log10((FLP(1) - bl.phred2prob[mapq]) + bl.phred2prob[mapq]);
+     gl[2] += w * std::log10(bl.phred2prob[mapq]);
+   } else {
+     gl[0] += w * std::log10(bl.phred2prob[mapq]);
+     gl[1] += w * std::log10(bl.phred2prob[mapq] + (FLP(1) - bl.phred2prob[mapq]));
+     gl[2] += w * std::log10(FLP(1) - bl.phred2prob[mapq]);
    }
+ }
+
+ template<typename TBoLog, typename TPrecision>
+ inline bool
+ _rescaleGLs(TBoLog const& bl, unsigned int const peDepth, TPrecision* gl, unsigned int& glBest, int32_t& gq) {
+   typedef typename TBoLog::value_type FLP;
    gl[1] += -FLP(peDepth) * std::log10(FLP(2));
-   unsigned int glBest=0;
+   glBest=0;
    FLP glBestVal=gl[glBest];
    for(unsigned int geno=1; geno<=2; ++geno) {
      if (gl[geno] > glBestVal) {
@@ -63,7 +65,26 @@ struct BoLog {
    if ((peDepth) && (pl[0] + pl[1] + pl[2] > 0)) {
      FLP likelihood = (FLP) std::log10((1-1/(bl.phred2prob[pl[0]]+bl.phred2prob[pl[1]]+bl.phred2prob[pl[2]])));
      likelihood = (likelihood > SMALLEST_GL) ? likelihood : SMALLEST_GL;
-     gqval[file_c] = (int32_t) boost::math::round(-10 * likelihood);
+     gq = (int32_t) boost::math::round(-10 * likelihood);
+     return true;
+   }
+   gq = 0;
+   return false;
+ }
+
+ template<typename TBoLog, typename TMapqVector>
+ inline void
+ _computeGLs(TBoLog const& bl, TMapqVector const& mapqRef, TMapqVector const& mapqAlt, float* gls, int32_t* gqval, int32_t* gts, int const file_c) {
+   typedef typename TBoLog::value_type FLP;
+   FLP gl[3];
+
+   // Compute genotype likelihoods
+   for(unsigned int geno=0; geno<=2; ++geno) gl[geno]=0;
+   unsigned int peDepth=mapqRef.size() + mapqAlt.size();
+   for(typename TMapqVector::const_iterator mapqRefIt = mapqRef.begin();mapqRefIt!=mapqRef.end();++mapqRefIt) _addGL(bl, *mapqRefIt, false, FLP(1), gl);
+   for(typename TMapqVector::const_iterator mapqAltIt = mapqAlt.begin();mapqAltIt!=mapqAlt.end();++mapqAltIt) _addGL(bl, *mapqAltIt, true, FLP(1), gl);
+   unsigned int glBest = 0;
+   if (_rescaleGLs(bl, peDepth, gl, glBest, gqval[file_c])) {
      if (glBest==0) {
        gts[file_c * 2] = bcf_gt_unphased(1);
        gts[file_c * 2 + 1] = bcf_gt_unphased(1);
@@ -77,7 +98,6 @@ struct BoLog {
    } else {
      gts[file_c * 2] = bcf_gt_missing;
      gts[file_c * 2 + 1] = bcf_gt_missing;
-     gqval[file_c] = 0;
    }
    gls[file_c * 3 + 2] = (float) gl[0];
    gls[file_c * 3 + 1] = (float) gl[1];
@@ -36,6 +36,10 @@
 #include <zlib.h>
 #include <stdio.h>
 
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
 #include "tags.h"
 #include "version.h"
 #include "util.h"
@@ -64,6 +68,231 @@ struct ClassifyConfig {
 };
 
 
+// Sample roles and scratch buffers of a classify run (one plan per thread)
+struct ClassifyPlan {
+  typedef std::pair<float, float> TCnSd;
+  typedef std::vector<TCnSd> TSampleDist;
+
+  bool germline;
+  int32_t idRDSD;
+  std::vector<uint8_t> role;
+  TSampleDist control;
+  TSampleDist tumor;
+  std::vector<std::string> ftarr;
+
+  // Re-genotyped fields, never decoded from the input
+  std::vector<int32_t> gqval;
+  std::vector<int32_t> cnval;
+  std::vector<float> cnl;
+
+  // VCF fields
+  int32_t nsvend;
+  int32_t* svend;
+  int32_t nsvt;
+  char* svt;
+  int nrdcn;
+  float* rdcn;
+
+  ClassifyPlan() : germline(false), idRDSD(-1), nsvend(0), svend(NULL), nsvt(0), svt(NULL), nrdcn(0), rdcn(NULL) {}
+};
+
+template<typename TClassifyConfig>
+inline void
+_compileClassifyPlan(TClassifyConfig const& c, bcf_hdr_t const* hdr, ClassifyPlan& cp) {
+  cp.germline = (c.filter == "germline");
+  cp.idRDSD = bcf_hdr_id2int(hdr, BCF_DT_ID, "RDSD");
+  _sampleRoles(hdr, cp.germline, c.controlSet, c.tumorSet, cp.role);
+  cp.control.reserve(bcf_hdr_nsamples(hdr));
+  cp.tumor.reserve(bcf_hdr_nsamples(hdr));
+  cp.ftarr.resize(bcf_hdr_nsamples(hdr));
+  if (cp.germline) {
+    cp.gqval.resize(bcf_hdr_nsamples(hdr));
+    cp.cnval.resize(bcf_hdr_nsamples(hdr));
+    cp.cnl.resize(bcf_hdr_nsamples(hdr) * MAX_CN);
+  }
+}
+
+inline void
+_freeClassifyPlan(ClassifyPlan& cp) {
+  if (cp.svend != NULL) free(cp.svend);
+  if (cp.svt != NULL) free(cp.svt);
+  if (cp.rdcn != NULL) free(cp.rdcn);
+}
+
+// Classify one CNV record, true if the record is kept
+template<typename TClassifyConfig>
+inline bool
+_classifyRecord(TClassifyConfig const& c, bcf_hdr_t* hdr, bcf_hdr_t* hdr_out, bcf1_t* rec, ClassifyPlan& cp) {
+  typedef ClassifyPlan::TSampleDist TSampleDist;
+  bcf_unpack(rec, BCF_UN_INFO);
+
+  // Check SV type
+  if (bcf_get_info_string(hdr, rec, "SVTYPE", &cp.svt, &cp.nsvt) <= 0) return false;
+  if (std::string(cp.svt) != "CNV") return false;
+
+  // Check PASS
+  bool pass = true;
+  if (c.filterForPass) pass = (bcf_has_filter(hdr, rec, const_cast<char*>("PASS"))==1);
+  if (!pass) return false;
+
+  // Check size
+  int32_t svStart= rec->pos - 1;
+  if (bcf_get_info_int32(hdr, rec, "END", &cp.svend, &cp.nsvend) <= 0) return false;
+  int32_t svEnd = *cp.svend;
+  if (svStart > svEnd) return false;
+  int32_t svlen = svEnd - svStart;
+  if ((svlen < c.minsize) || (svlen > c.maxsize)) return false;
+
+  // Check copy-number, GQ, CN and CNL are re-computed in germline mode and unused in somatic mode
+  bcf_unpack(rec, BCF_UN_FMT);
+  if (bcf_get_format_float(hdr, rec, "RDCN", &cp.rdcn, &cp.nrdcn) < bcf_hdr_nsamples(hdr)) return false;
+  bcf_fmt_t* rdsd = bcf_get_fmt_id(rec, cp.idRDSD);
+  if (rdsd == NULL) return false;
+  float* rdcn = cp.rdcn;
+
+  TSampleDist& control = cp.control;
+  TSampleDist& tumor = cp.tumor;
+  control.clear();
+  tumor.clear();
+  for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
+    if ((!std::isfinite(rdcn[i])) || (rdcn[i] == -1)) return false;
+    if (cp.role[i] == SAMPLE_CONTROL) {
+      // Control or population genomics
+      control.push_back(std::make_pair(rdcn[i], _formatFloat(rdsd, i, 0)));
+    } else if (cp.role[i] == SAMPLE_TUMOR) {
+      // Tumor
+      tumor.push_back(std::make_pair(rdcn[i], _formatFloat(rdsd, i, 0)));
+    }
+  }
+
+  // Classify
+  if (!cp.germline) {
+    // Somatic mode
+    double bestCnOffset = 0;
+    bool somaticcnv = false;
+    double lowestp = 1;
+    for(uint32_t i = 0; i < tumor.size(); ++i) {
+      bool germcnv = false;
+      double highestprob = 0;
+      double tcnoffset = -1;
+      for(uint32_t k = 0; k < control.size(); ++k) {
+	boost::math::normal s1(control[k].first, control[k].second);
+	double prob1 = boost::math::pdf(s1, tumor[i].first);
+	boost::math::normal s2(tumor[i].first, tumor[i].second);
+	double prob2 = boost::math::pdf(s2, control[k].first);
+	double prob = std::max(prob1, prob2);
+	if (prob > c.pgerm) germcnv = true;
+	else {
+	  // Among all controls, take highest p-value (most likely germline CNV)
+	  if (prob > highestprob) highestprob = prob;
+	}
+	double cndiff = std::abs(tumor[i].first - control[k].first);
+	if (cndiff < c.cn_offset) germcnv = true;
+	else {
+	  // Among all controls, take smallest CN difference
+	  if ((tcnoffset == -1) || (cndiff < tcnoffset)) tcnoffset = cndiff;
+	}
+      }
+      // Among all tumors take best CN difference and lowest p-value
+      if (!germcnv) {
+	somaticcnv = true;
+	if ((highestprob < lowestp) && (tcnoffset > bestCnOffset)) {
+	  lowestp = highestprob;
+	  bestCnOffset = tcnoffset;
+	}
+      }
+    }
+    if (!somaticcnv) return false;
+    _remove_info_tag(hdr_out, rec, "SOMATIC");
+    bcf_update_info_flag(hdr_out, rec, "SOMATIC", NULL, 1);
+    float pgerm = (float) lowestp;
+    _remove_info_tag(hdr_out, rec, "PGERM");
+    bcf_update_info_float(hdr_out, rec, "PGERM", &pgerm, 1);
+    float cndiv = (float) bestCnOffset;
+    _remove_info_tag(hdr_out, rec, "CNDIFF");
+    bcf_update_info_float(hdr_out, rec, "CNDIFF", &cndiv, 1);
+  } else {
+    // Correct CN shift
+    int32_t* gqval = &cp.gqval[0];
+    int32_t* cnval = &cp.cnval[0];
+    float* cnl = &cp.cnl[0];
+    int32_t cnmain = 0;
+    {
+      std::vector<int32_t> cncount(MAX_CN, 0);
+      {
+	bool validsite = true;
+	boost::accumulators::accumulator_set<double, boost::accumulators::features<boost::accumulators::tag::mean, boost::accumulators::tag::variance> > acc;
+	for(uint32_t k = 0; k < control.size(); ++k) {
+	  if ((boost::math::isinf(control[k].first)) || (boost::math::isnan(control[k].first))) validsite = false;
+	  else acc(boost::math::round(control[k].first) - control[k].first);
+	}
+	if (!validsite) return false;
+	double cnshift = boost::accumulators::mean(acc);
+	float cnshiftval = cnshift;
+	_remove_info_tag(hdr_out, rec, "CNSHIFT");
+	bcf_update_info_float(hdr_out, rec, "CNSHIFT", &cnshiftval, 1);
+	for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
+	  rdcn[i] += cnshift;
+	  cnval[i] = boost::math::round(rdcn[i]);
+	  if ((cnval[i] >= 0) && (cnval[i] < MAX_CN)) ++cncount[cnval[i]];
+	}
+      }
+
+      // Find max CN
+      for(uint32_t i = 1; i < MAX_CN; ++i) {
+	if (cncount[i] > cncount[cnmain]) cnmain = i;
+      }
+    }
+
+    // Calculate SD
+    boost::accumulators::accumulator_set<double, boost::accumulators::features<boost::accumulators::tag::mean, boost::accumulators::tag::variance> > accLocal;
+    for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
+      if (cnval[i] == cnmain) accLocal(rdcn[i]);
+    }
+    double sd = sqrt(boost::accumulators::variance(accLocal));
+    if (sd < 0.025) sd = 0.025;
+    float cnsdval = sd;
+    _remove_info_tag(hdr_out, rec, "CNSD");
+    bcf_update_info_float(hdr_out, rec, "CNSD", &cnsdval, 1);
+    if (cnsdval > c.maxsd) return false;
+
+    // Re-compute CNLs
+    std::vector<std::string>& ftarr = cp.ftarr;
+    int32_t altqual = 0;
+    int32_t altcount = 0;
+    for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
+      int32_t qval = _computeCNLs(c, rdcn[i], sd, cnl, gqval, i);
+      if (cnval[i] != c.ploidy) {
+	altqual += qval;
+	++altcount;
+      }
+      if (gqval[i] < 15) ftarr[i] = "LowQual";
+      else ftarr[i] = "PASS";
+    }
+    if (altcount == 0) return false;
+    altqual /= altcount;
+    if (altqual < c.qual) return false;
+    if (altqual > 10000) altqual = 10000;
+
+    // Update QUAL and FILTER
+    rec->qual = altqual;
+    int32_t tmpi = bcf_hdr_id2int(hdr_out, BCF_DT_ID, "PASS");
+    if (rec->qual < 15) tmpi = bcf_hdr_id2int(hdr_out, BCF_DT_ID, "LowQual");
+    bcf_update_filter(hdr_out, rec, &tmpi, 1);
+
+    // Update GT fields
+    std::vector<const char*> strp(bcf_hdr_nsamples(hdr));
+    std::transform(ftarr.begin(), ftarr.end(), strp.begin(), cstyle_str());
+    bcf_update_format_int32(hdr_out, rec, "CN", cnval, bcf_hdr_nsamples(hdr));
+    bcf_update_format_float(hdr_out, rec, "CNL",  cnl, bcf_hdr_nsamples(hdr) * MAX_CN);
+    bcf_update_format_int32(hdr_out, rec, "GQ", gqval, bcf_hdr_nsamples(hdr));
+    bcf_update_format_string(hdr_out, rec, "FT", &strp[0], bcf_hdr_nsamples(hdr));
+    bcf_update_format_float(hdr_out, rec, "RDCN",  rdcn, bcf_hdr_nsamples(hdr));
+  }
+  return true;
+}
+
+
 template<typename TClassifyConfig>
 inline int
 classifyRun(TClassifyConfig const& c) {
@@ -90,216 +319,62 @@ classifyRun(TClassifyConfig const& c) {
   }
   if (bcf_hdr_write(ofile, hdr_out) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
 
-  // VCF fields
-  int32_t nsvend = 0;
-  int32_t* svend = NULL;
-  int32_t nsvt = 0;
-  char* svt = NULL;
-  int ngqval = 0;
-  int32_t* gqval = NULL;
-  int ncnval = 0;
-  int32_t* cnval = NULL;
-  int ncnl = 0;
-  float* cnl = NULL;
-  int nrdcn = 0;
-  float* rdcn = NULL;
-  int nrdsd = 0;
-  float* rdsd = NULL;
-  bool germline = false;
-  if (c.filter == "germline") germline = true;
+  // Index on the fly
+  std::string idxfile = c.outfile.string() + ".csi";
+  bool idxOnTheFly = (bcf_idx_init(ofile, hdr_out, 14, idxfile.c_str()) == 0);
+
+  // One classify plan per thread
+  int32_t nthreads = 1;
+#ifdef OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  std::vector<ClassifyPlan> cp(nthreads);
+  for(int32_t t = 0; t < nthreads; ++t) _compileClassifyPlan(c, hdr, cp[t]);
 
   // Parse BCF
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
   std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Filtering VCF/BCF file" << std::endl;
-  bcf1_t* rec = bcf_init1();
-  while (bcf_read(ifile, hdr, rec) == 0) {
-    bcf_unpack(rec, BCF_UN_INFO);
-
-    // Check SV type
-    bcf_get_info_string(hdr, rec, "SVTYPE", &svt, &nsvt);
-    if (std::string(svt) != "CNV") continue;
-
-    // Check PASS
-    bool pass = true;
-    if (c.filterForPass) pass = (bcf_has_filter(hdr, rec, const_cast<char*>("PASS"))==1);
-    if (!pass) continue;
-
-    // Check size
-    int32_t svStart= rec->pos - 1;
-    bcf_get_info_int32(hdr, rec, "END", &svend, &nsvend);
-    int32_t svEnd = *svend;
-    if (svStart > svEnd) continue;
-    int32_t svlen = svEnd - svStart;
-    if ((svlen < c.minsize) || (svlen > c.maxsize)) continue;
-
-    // Check copy-number
-    bcf_unpack(rec, BCF_UN_ALL);
-    bcf_get_format_int32(hdr, rec, "GQ", &gqval, &ngqval);
-    bcf_get_format_int32(hdr, rec, "CN", &cnval, &ncnval);
-    bcf_get_format_float(hdr, rec, "CNL", &cnl, &ncnl);
-    bcf_get_format_float(hdr, rec, "RDCN", &rdcn, &nrdcn);
-    bcf_get_format_float(hdr, rec, "RDSD", &rdsd, &nrdsd);
-
-    typedef std::pair<float, float> TCnSd;
-    typedef std::vector<TCnSd> TSampleDist;
-    TSampleDist control;
-    TSampleDist tumor;
-    bool invalidCNV = false;
-    for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
-      if ((!std::isfinite(rdcn[i])) || (rdcn[i] == -1)) {
-	invalidCNV = true;
+  std::vector<bcf1_t*> batch(DELLY_BCF_BATCH * nthreads);
+  for(uint32_t k = 0; k < batch.size(); ++k) batch[k] = bcf_init1();
+  std::vector<uint8_t> keep(batch.size(), 0);
+  bool eof = false;
+  while (!eof) {
+    // Read batch
+    int32_t nrec = 0;
+    for(; nrec < (int32_t) batch.size(); ++nrec) {
+      if (bcf_read(ifile, hdr, batch[nrec]) != 0) {
+	eof = true;
 	break;
       }
-      if ((germline) || (c.controlSet.find(hdr->samples[i]) != c.controlSet.end())) {
-	// Control or population genomics
-	control.push_back(std::make_pair(rdcn[i], rdsd[i]));
-      } else if ((!germline) && (c.tumorSet.find(hdr->samples[i]) != c.tumorSet.end())) {
-	// Tumor
-	tumor.push_back(std::make_pair(rdcn[i], rdsd[i]));
-      }
     }
-    if (invalidCNV) continue;
-
-    // Classify
-    if (!germline) {
-      // Somatic mode
-      double bestCnOffset = 0;
-      bool somaticcnv = false;
-      double lowestp = 1;
-      for(uint32_t i = 0; i < tumor.size(); ++i) {
-	bool germcnv = false;
-	double highestprob = 0;
-	double tcnoffset = -1;
-	for(uint32_t k = 0; k < control.size(); ++k) {
-	  boost::math::normal s1(control[k].first, control[k].second);
-	  double prob1 = boost::math::pdf(s1, tumor[i].first);
-	  boost::math::normal s2(tumor[i].first, tumor[i].second);
-	  double prob2 = boost::math::pdf(s2, control[k].first);
-	  double prob = std::max(prob1, prob2);
-	  if (prob > c.pgerm) germcnv = true;
-	  else {
-	    // Among all controls, take highest p-value (most likely germline CNV)
-	    if (prob > highestprob) highestprob = prob;
-	  }
-	  double cndiff = std::abs(tumor[i].first - control[k].first);
-	  if (cndiff < c.cn_offset) germcnv = true;
-	  else {
-	    // Among all controls, take smallest CN difference
-	    if ((tcnoffset == -1) || (cndiff < tcnoffset)) tcnoffset = cndiff;
-	  }
-	}
-	// Among all tumors take best CN difference and lowest p-value
-	if (!germcnv) {
-	  somaticcnv = true;
-	  if ((highestprob < lowestp) && (tcnoffset > bestCnOffset)) {
-	    lowestp = highestprob;
-	    bestCnOffset = tcnoffset;
-	  }
-	}
-      }
-      if (!somaticcnv) continue;
-      _remove_info_tag(hdr_out, rec, "SOMATIC");
-      bcf_update_info_flag(hdr_out, rec, "SOMATIC", NULL, 1);
-      float pgerm = (float) lowestp;
-      _remove_info_tag(hdr_out, rec, "PGERM");
-      bcf_update_info_float(hdr_out, rec, "PGERM", &pgerm, 1);
-      float cndiv = (float) bestCnOffset;
-      _remove_info_tag(hdr_out, rec, "CNDIFF");
-      bcf_update_info_float(hdr_out, rec, "CNDIFF", &cndiv, 1);
-    } else {
-      // Correct CN shift
-      int32_t cnmain = 0;
-      {
-	std::vector<int32_t> cncount(MAX_CN, 0);
-	{
-	  bool validsite = true;
-	  boost::accumulators::accumulator_set<double, boost::accumulators::features<boost::accumulators::tag::mean, boost::accumulators::tag::variance> > acc;
-	  for(uint32_t k = 0; k < control.size(); ++k) {
-	    if ((boost::math::isinf(control[k].first)) || (boost::math::isnan(control[k].first))) validsite = false;
-	    else acc(boost::math::round(control[k].first) - control[k].first);
-	  }
-	  if (!validsite) continue;
-	  double cnshift = boost::accumulators::mean(acc);
-	  float cnshiftval = cnshift;
-	  _remove_info_tag(hdr_out, rec, "CNSHIFT");
-	  bcf_update_info_float(hdr_out, rec, "CNSHIFT", &cnshiftval, 1);
-	  for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
-	    rdcn[i] += cnshift;
-	    cnval[i] = boost::math::round(rdcn[i]);
-	    if ((cnval[i] >= 0) && (cnval[i] < MAX_CN)) ++cncount[cnval[i]];
-	  }
-	}
-	
-	// Find max CN
-	for(uint32_t i = 1; i < MAX_CN; ++i) {
-	  if (cncount[i] > cncount[cnmain]) cnmain = i;
-	}
-      }
 
-      // Calculate SD
-      boost::accumulators::accumulator_set<double, boost::accumulators::features<boost::accumulators::tag::mean, boost::accumulators::tag::variance> > accLocal;
-      for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
-	if (cnval[i] == cnmain) accLocal(rdcn[i]);
-      }
-      double sd = sqrt(boost::accumulators::variance(accLocal));
-      if (sd < 0.025) sd = 0.025;
-      float cnsdval = sd;
-      _remove_info_tag(hdr_out, rec, "CNSD");
-      bcf_update_info_float(hdr_out, rec, "CNSD", &cnsdval, 1);
-      if (cnsdval > c.maxsd) continue;
-      
-      // Re-compute CNLs
-      std::vector<std::string> ftarr(bcf_hdr_nsamples(hdr));
-      int32_t altqual = 0;
-      int32_t altcount = 0;
-      for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
-	int32_t qval = _computeCNLs(c, rdcn[i], sd, cnl, gqval, i);
-	if (cnval[i] != c.ploidy) {
-	  altqual += qval;
-	  ++altcount;
-	}
-	if (gqval[i] < 15) ftarr[i] = "LowQual";
-	else ftarr[i] = "PASS";
-      }
-      if (altcount == 0) continue;
-      altqual /= altcount;
-      if (altqual < c.qual) continue;
-      if (altqual > 10000) altqual = 10000;
-      
-      // Update QUAL and FILTER
-      rec->qual = altqual;
-      int32_t tmpi = bcf_hdr_id2int(hdr_out, BCF_DT_ID, "PASS");
-      if (rec->qual < 15) tmpi = bcf_hdr_id2int(hdr_out, BCF_DT_ID, "LowQual");
-      bcf_update_filter(hdr_out, rec, &tmpi, 1);
-
-      // Update GT fields
-      std::vector<const char*> strp(bcf_hdr_nsamples(hdr));
-      std::transform(ftarr.begin(), ftarr.end(), strp.begin(), cstyle_str());
-      bcf_update_format_int32(hdr_out, rec, "CN", cnval, bcf_hdr_nsamples(hdr));
-      bcf_update_format_float(hdr_out, rec, "CNL",  cnl, bcf_hdr_nsamples(hdr) * MAX_CN);
-      bcf_update_format_int32(hdr_out, rec, "GQ", gqval, bcf_hdr_nsamples(hdr));
-      bcf_update_format_string(hdr_out, rec, "FT", &strp[0], bcf_hdr_nsamples(hdr));
-      bcf_update_format_float(hdr_out, rec, "RDCN",  rdcn, bcf_hdr_nsamples(hdr));
+    // Classify records
+#pragma omp parallel for default(shared) schedule(dynamic)
+    for(int32_t k = 0; k < nrec; ++k) {
+      int32_t t = 0;
+#ifdef OPENMP
+      t = omp_get_thread_num();
+#endif
+      keep[k] = _classifyRecord(c, hdr, hdr_out, batch[k], cp[t]);
+    }
+
+    // Write in input order
+    for(int32_t k = 0; k < nrec; ++k) {
+      if (keep[k]) bcf_write1(ofile, hdr_out, batch[k]);
     }
-    bcf_write1(ofile, hdr_out, rec);
   }
-  bcf_destroy(rec);
+  for(uint32_t k = 0; k < batch.size(); ++k) bcf_destroy(batch[k]);
 
   // Clean-up
-  if (svend != NULL) free(svend);
-  if (svt != NULL) free(svt);
-  if (gqval != NULL) free(gqval);
-  if (cnval != NULL) free(cnval);
-  if (cnl != NULL) free(cnl);
-  if (rdcn != NULL) free(rdcn);
-  if (rdsd != NULL) free(rdsd);
+  for(int32_t t = 0; t < nthreads; ++t) _freeClassifyPlan(cp[t]);
 
   // Close output VCF
+  if ((idxOnTheFly) && (bcf_idx_save(ofile) != 0)) idxOnTheFly = false;
   bcf_hdr_destroy(hdr_out);
   hts_close(ofile);
 
   // Build index
-  bcf_index_build(c.outfile.string().c_str(), 14);
+  if (!idxOnTheFly) bcf_index_build(c.outfile.string().c_str(), 14);
 
   // Close VCF
   bcf_hdr_destroy(hdr);
@@ -61,24 +61,31 @@ namespace torali
   inline void
   mergeCNVs(TConfig const& c, std::vector<CNV>& chrcnv, std::vector<CNV>& cnvs) {
     // Merge neighboring segments if too similar
+    // A merged segment takes the mean CN of its end-points and is re-grouped in the next pass.
+    // Each pass shrinks the list, so there are at most n passes (quadratic worst case).
     bool merged = true;
     std::vector<CNV> newcnv;
     while(merged) {
-      int32_t k = -1;
-      for(int32_t i = 0; i < (int32_t) chrcnv.size(); ++i) {
-	if (i <= k) continue;
-	k = i;
-	for(int32_t j = i + 1; j < (int32_t) chrcnv.size(); ++j) {
-	  bool allValid = true;
-	  for(int32_t pre = i; pre < j; ++pre) {
-	    double diff = std::abs(chrcnv[pre].cn - chrcnv[j].cn);
-	    if (diff >= c.cn_offset) {
-	      allValid = false;
-	      break;
+      uint32_t i = 0;
+      while(i < chrcnv.size()) {
+	// Extend the run while all pairwise CN differences stay below the offset, NaN CNs never split a run
+	bool hasCN = !std::isnan(chrcnv[i].cn);
+	double cnmin = chrcnv[i].cn;
+	double cnmax = chrcnv[i].cn;
+	uint32_t k = i;
+	for(uint32_t j = i + 1; j < chrcnv.size(); ++j) {
+	  if (!std::isnan(chrcnv[j].cn)) {
+	    if (!hasCN) {
+	      hasCN = true;
+	      cnmin = chrcnv[j].cn;
+	      cnmax = chrcnv[j].cn;
+	    } else {
+	      if ((std::abs(cnmax - chrcnv[j].cn) >= c.cn_offset) || (std::abs(cnmin - chrcnv[j].cn) >= c.cn_offset)) break;
+	      cnmin = std::min(cnmin, chrcnv[j].cn);
+	      cnmax = std::max(cnmax, chrcnv[j].cn);
 	    }
 	  }
-	  if (allValid) k = j;
-	  else break;
+	  k = j;
 	}
 	if (k > i) {
 	  // Merge
@@ -88,12 +95,11 @@ namespace torali
 	} else {
 	  newcnv.push_back(chrcnv[i]);
 	}
+	i = k + 1;
       }
       if (newcnv.size() == chrcnv.size()) merged = false;
-      else {
-	chrcnv = newcnv;
-	newcnv.clear();
-      }
+      else chrcnv.swap(newcnv);
+      newcnv.clear();
     }
 
     // Insert into global CNV vector
@@ -300,6 +306,121 @@ namespace torali
     }
   }
   
+  template<typename TConfig, typename TGcBias, typename TCoverage>
+  inline void
+  genotypeCNVSites(TConfig const& c, std::pair<uint32_t, uint32_t> const& gcbound, std::vector<uint16_t> const& gcContent, std::vector<uint16_t> const& uniqContent, TGcBias const& gcbias, TCoverage const& cov, bam_hdr_t const* hdr, int32_t const refIndex, std::vector<CNV>& cnvs) {
+    // Site intervals clipped to the chromosome
+    int32_t chrlen = hdr->target_len[refIndex];
+    std::vector<int32_t> sstart(cnvs.size(), 0);
+    std::vector<int32_t> send(cnvs.size(), 0);
+    std::vector<int32_t> bounds;
+    for(uint32_t n = 0; n < cnvs.size(); ++n) {
+      if (cnvs[n].chr != refIndex) continue;
+      sstart[n] = std::min(std::max(cnvs[n].start, 0), chrlen);
+      send[n] = std::min(std::max(cnvs[n].end, sstart[n]), chrlen);
+      bounds.push_back(sstart[n]);
+      bounds.push_back(send[n]);
+    }
+    if (bounds.empty()) return;
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    // Cumulative valid bases, counts and expected coverage at all site boundaries
+    std::vector<uint32_t> cumWin(bounds.size(), 0);
+    std::vector<uint64_t> cumCov(bounds.size(), 0);
+    std::vector<double> cumExp(bounds.size(), 0);
+    {
+      uint32_t winlen = 0;
+      uint64_t covsum = 0;
+      double expcov = 0;
+      int32_t pos = 0;
+      for(uint32_t b = 0; b < bounds.size(); ++b) {
+	for(; pos < bounds[b]; ++pos) {
+	  if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
+	    covsum += cov[pos];
+	    expcov += gcbias[gcContent[pos]].coverage;
+	    ++winlen;
+	  }
+	}
+	cumWin[b] = winlen;
+	cumCov[b] = covsum;
+	cumExp[b] = expcov;
+      }
+    }
+
+    // Copy-number estimate and SD block ends (in valid bases)
+    std::vector<uint32_t> blockEnd;
+    for(uint32_t n = 0; n < cnvs.size(); ++n) {
+      if (cnvs[n].chr != refIndex) continue;
+      uint32_t bs = std::lower_bound(bounds.begin(), bounds.end(), sstart[n]) - bounds.begin();
+      uint32_t be = std::lower_bound(bounds.begin(), bounds.end(), send[n]) - bounds.begin();
+      uint32_t winlen = cumWin[be] - cumWin[bs];
+      double covsum = cumCov[be] - cumCov[bs];
+      double expcov = cumExp[be] - cumExp[bs];
+      double cn = c.ploidy;
+      if (expcov > 0) cn = c.ploidy * covsum / expcov;
+      cnvs[n].cn = cn;
+      cnvs[n].mappable = (double) winlen / (double) (cnvs[n].end - cnvs[n].start);
+      uint32_t wsz = winlen / 10;
+      if (wsz > 1) {
+	for(uint32_t k = cumWin[bs] + wsz; k <= cumWin[be]; k += wsz) blockEnd.push_back(k);
+      }
+    }
+    std::sort(blockEnd.begin(), blockEnd.end());
+    blockEnd.erase(std::unique(blockEnd.begin(), blockEnd.end()), blockEnd.end());
+
+    // Cumulative counts and expected coverage at all block ends
+    std::vector<uint64_t> blockCov(blockEnd.size(), 0);
+    std::vector<double> blockExp(blockEnd.size(), 0);
+    {
+      uint32_t winlen = 0;
+      uint64_t covsum = 0;
+      double expcov = 0;
+      uint32_t k = 0;
+      for(int32_t pos = 0; ((pos < chrlen) && (k < blockEnd.size())); ++pos) {
+	if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
+	  covsum += cov[pos];
+	  expcov += gcbias[gcContent[pos]].coverage;
+	  ++winlen;
+	  if (winlen == blockEnd[k]) {
+	    blockCov[k] = covsum;
+	    blockExp[k] = expcov;
+	    ++k;
+	  }
+	}
+      }
+    }
+
+    // Estimate SD
+    for(uint32_t n = 0; n < cnvs.size(); ++n) {
+      if (cnvs[n].chr != refIndex) continue;
+      uint32_t bs = std::lower_bound(bounds.begin(), bounds.end(), sstart[n]) - bounds.begin();
+      uint32_t be = std::lower_bound(bounds.begin(), bounds.end(), send[n]) - bounds.begin();
+      uint32_t wsz = (cumWin[be] - cumWin[bs]) / 10;
+      if (wsz > 1) {
+	boost::accumulators::accumulator_set<double, boost::accumulators::features<boost::accumulators::tag::mean, boost::accumulators::tag::variance> > acc;
+	uint64_t precov = cumCov[bs];
+	double preexp = cumExp[bs];
+	for(uint32_t k = cumWin[bs] + wsz; k <= cumWin[be]; k += wsz) {
+	  uint32_t idx = std::lower_bound(blockEnd.begin(), blockEnd.end(), k) - blockEnd.begin();
+	  double covsum = blockCov[idx] - precov;
+	  double expcov = blockExp[idx] - preexp;
+	  double cn = c.ploidy;
+	  if (expcov > 0) cn = c.ploidy * covsum / expcov;
+	  acc(cn);
+	  precov = blockCov[idx];
+	  preexp = blockExp[idx];
+	}
+	cnvs[n].sd = sqrt(boost::accumulators::variance(acc));
+	if (cnvs[n].sd < 0.025) cnvs[n].sd = 0.025;
+      } else {
+	// Invalid
+	cnvs[n].cn = -1;
+	cnvs[n].sd = 0.025;
+      }
+    }
+  }
+  
   template<typename TConfig, typename TGcBias, typename TCoverage>
   inline void
   callCNVs(TConfig const& c, std::pair<uint32_t, uint32_t> const& gcbound, std::vector<uint16_t> const& gcContent, std::vector<uint16_t> const& uniqContent, TGcBias const& gcbias, TCoverage const& cov, bam_hdr_t const* hdr, int32_t const refIndex, std::vector<CNV>& cnvs) {
@@ -566,7 +687,10 @@ namespace torali
   
   template<typename TConfig>
   inline void
-  cnvVCF(TConfig const& c, std::vector<CNV> const& cnvs) {
+  cnvVCF(TConfig const& c, std::vector<std::string> const& sampleNames, std::vector< std::vector<CNV> > const& sampleCnvs) {
+    // Sites are shared across samples
+    std::vector<CNV> const& cnvs = sampleCnvs[0];
+
     // Open one bam file header
     samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
     hts_set_fai_filename(samfile, c.genome.string().c_str());
@@ -610,7 +734,7 @@ namespace torali
       bcf_hdr_append(hdr, refname.c_str());
     }
     // Add samples
-    bcf_hdr_add_sample(hdr, c.sampleName.c_str());
+    for(uint32_t file_c = 0; file_c < sampleNames.size(); ++file_c) bcf_hdr_add_sample(hdr, sampleNames[file_c].c_str());
     bcf_hdr_add_sample(hdr, NULL);
     if (bcf_hdr_write(fp, hdr) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
 
@@ -639,8 +763,14 @@ namespace torali
 	if ((!c.hasGenoFile) && (cnvs[i].cn == -1)) continue;
 
 	// Integer copy-number
-	int32_t absCN = (int32_t) boost::math::round(cnvs[i].cn);
-	if ((!c.segmentation) && (absCN == c.ploidy)) continue;
+	bool nonRef = false;
+	double mappable = 0;
+	for(uint32_t file_c = 0; file_c < sampleCnvs.size(); ++file_c) {
+	  cnval[file_c] = (int32_t) boost::math::round(sampleCnvs[file_c][i].cn);
+	  if (cnval[file_c] != c.ploidy) nonRef = true;
+	  mappable += sampleCnvs[file_c][i].mappable;
+	}
+	if ((!c.segmentation) && (!nonRef)) continue;
       
 	// Output main vcf fields
 	rec->rid = bcf_hdr_name2id(hdr, bamhd->target_name[cnvs[i].chr]);
@@ -674,24 +804,25 @@ namespace torali
 	cipos[1] = cnvs[i].ciposhigh - cnvs[i].start;
 	bcf_update_info_int32(hdr, rec, "CIPOS", cipos, 2);
 	bcf_update_info_int32(hdr, rec, "CIEND", ciend, 2);
-	float tmpf = cnvs[i].mappable;
+	float tmpf = mappable / (double) sampleCnvs.size();
 	bcf_update_info_float(hdr, rec, "MP", &tmpf, 1);
 
 	// Genotyping
-	cnval[0] = absCN;
-	cnrdval[0] = cnvs[i].cn;
-	cnsdval[0] = cnvs[i].sd;
-	gts[0] = bcf_gt_missing;
-	gts[1] = bcf_gt_missing;
-	int32_t qval = _computeCNLs(c, cnvs[i].cn, cnvs[i].sd, cnl, gqval);
+	int32_t qval = 0;
+	for(uint32_t file_c = 0; file_c < sampleCnvs.size(); ++file_c) {
+	  cnrdval[file_c] = sampleCnvs[file_c][i].cn;
+	  cnsdval[file_c] = sampleCnvs[file_c][i].sd;
+	  gts[file_c * 2] = bcf_gt_missing;
+	  gts[file_c * 2 + 1] = bcf_gt_missing;
+	  qval = _computeCNLs(c, sampleCnvs[file_c][i].cn, sampleCnvs[file_c][i].sd, cnl, gqval, file_c);
+	  if (gqval[file_c] < 15) ftarr[file_c] = "LowQual";
+	  else ftarr[file_c] = "PASS";
+	}
 	if (c.hasGenoFile) rec->qual = cnvs[i].qval;  // Leave site quality in genotyping mode
 	else rec->qual = qval;
 	tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "PASS");
 	if (rec->qual < 15) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
 	bcf_update_filter(hdr, rec, &tmpi, 1);
-	
-	if (gqval[0] < 15) ftarr[0] = "LowQual";
-	else ftarr[0] = "PASS";
 	std::vector<const char*> strp(bcf_hdr_nsamples(hdr));
 	std::transform(ftarr.begin(), ftarr.end(), strp.begin(), cstyle_str());	
 	bcf_update_genotypes(hdr, rec, gts, bcf_hdr_nsamples(hdr) * 2);
@@ -2,6 +2,7 @@
 #define CORAL_H
 
 #include <limits>
+#include <sstream>
 
 #include <boost/icl/split_interval_map.hpp>
 #include <boost/dynamic_bitset.hpp>
@@ -14,6 +15,10 @@
 #include <htslib/sam.h>
 #include <htslib/faidx.h>
 
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
 #include "bed.h"
 #include "scan.h"
 #include "gcbias.h"
@@ -32,6 +37,7 @@ namespace torali
     bool segmentation;
     bool hasGenoFile;
     bool hasVcfFile;
+    bool mateFree;
     uint32_t nchr;
     uint32_t meanisize;
     uint32_t window_size;
@@ -60,6 +66,7 @@ namespace torali
     boost::filesystem::path bamFile;
     boost::filesystem::path bedFile;
     boost::filesystem::path scanFile;
+    std::vector<boost::filesystem::path> files;
   };
   
   struct CountDNAConfigLib {
@@ -71,7 +78,7 @@ namespace torali
   
   template<typename TConfig>
   inline int32_t
-  bamCount(TConfig const& c, LibraryInfo const& li, std::vector<GcBias> const& gcbias, std::pair<uint32_t, uint32_t> const& gcbound) {
+  bamCount(TConfig const& c, LibraryInfo const& li, std::vector<GcBias> const& gcbias, std::pair<uint32_t, uint32_t> const& gcbound, std::vector<CNV>& cnvs) {
     // Load bam file
     samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
     hts_set_fai_filename(samfile, c.genome.string().c_str());
@@ -89,20 +96,27 @@ namespace torali
       }
     }
 
-    // Parse BAM file
-    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
-    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Count fragments" << std::endl;
-    boost::progress_display show_progress( hdr->n_targets );
-
-    // Open output files
+    // Open output files (coverage tracks only for single-sample runs)
+    bool writeCov = (c.files.size() == 1);
     boost::iostreams::filtering_ostream dataOut;
-    dataOut.push(boost::iostreams::gzip_compressor());
-    dataOut.push(boost::iostreams::file_sink(c.covfile.c_str(), std::ios_base::out | std::ios_base::binary));
-    dataOut << "chr\tstart\tend\t" << c.sampleName << "_mappable\t" << c.sampleName << "_counts\t" << c.sampleName << "_CN" << std::endl;
+    if (writeCov) {
+      dataOut.push(boost::iostreams::gzip_compressor());
+      dataOut.push(boost::iostreams::file_sink(c.covfile.c_str(), std::ios_base::out | std::ios_base::binary));
+      dataOut << "chr\tstart\tend\t" << c.sampleName << "_mappable\t" << c.sampleName << "_counts\t" << c.sampleName << "_CN" << std::endl;
+    }
 
-    // CNVs
-    std::vector<CNV> cnvs;
-    if (c.hasGenoFile) parseVcfCNV(c, hdr, cnvs);
+    // CNVs by chromosome, sites are sorted upfront so that all samples share the site order
+    cnvs.clear();
+    typedef std::vector<CNV> TChrCNVs;
+    std::vector<TChrCNVs> chrCnvs(hdr->n_targets, TChrCNVs());
+    if (c.hasGenoFile) {
+      parseVcfCNV(c, hdr, cnvs);
+      sort(cnvs.begin(), cnvs.end(), SortCNVs<CNV>());
+      for(uint32_t i = 0; i < cnvs.size(); ++i) {
+	if (cnvs[i].chr >= 0) chrCnvs[cnvs[i].chr].push_back(cnvs[i]);
+      }
+      cnvs.clear();
+    }
 
     // SVs for breakpoint refinement
     typedef std::vector<SVBreakpoint> TChrBreakpoints;
@@ -118,25 +132,63 @@ namespace torali
       for (uint32_t i = 0; i < svbp.size(); ++i) sort(svbp[i].begin(), svbp[i].end(), SortSVBreakpoint<SVBreakpoint>());
     }
     
-    // Iterate chromosomes
+    // Chromosomes with data, mappability map and reference
     faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
     faidx_t* faiRef = fai_load(c.genome.string().c_str());
+    std::vector<int32_t> chrIdx;
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
-      ++show_progress;
       if ((!c.hasGenoFile) && (chrNoData(c, refIndex, idx))) continue;
-      
-      // Check presence in mappability map
       std::string tname(hdr->target_name[refIndex]);
-      int32_t seqlen = faidx_seq_len(faiMap, tname.c_str());
-      if (seqlen == - 1) continue;
-      else seqlen = -1;
-      char* seq = faidx_fetch_seq(faiMap, tname.c_str(), 0, faidx_seq_len(faiMap, tname.c_str()), &seqlen);
+      if (faidx_seq_len(faiMap, tname.c_str()) == -1) continue;
+      if (faidx_seq_len(faiRef, tname.c_str()) == -1) continue;
+      chrIdx.push_back(refIndex);
+    }
+
+    // Thread-local alignment and sequence handles, at most one thread per chromosome
+    int32_t nthreads = 1;
+#ifdef OPENMP
+    nthreads = std::max(1, std::min((int32_t) omp_get_max_threads(), (int32_t) chrIdx.size()));
+#endif
+    std::vector<samFile*> samfileTh(nthreads);
+    std::vector<hts_idx_t*> idxTh(nthreads);
+    std::vector<faidx_t*> faiMapTh(nthreads);
+    std::vector<faidx_t*> faiRefTh(nthreads);
+    for(int32_t t = 0; t < nthreads; ++t) {
+      samfileTh[t] = sam_open(c.bamFile.string().c_str(), "r");
+      hts_set_fai_filename(samfileTh[t], c.genome.string().c_str());
+      idxTh[t] = sam_index_load(samfileTh[t], c.bamFile.string().c_str());
+      faiMapTh[t] = fai_load(c.mapFile.string().c_str());
+      faiRefTh[t] = fai_load(c.genome.string().c_str());
+    }
 
-      // Check presence in reference
-      seqlen = faidx_seq_len(faiRef, tname.c_str());
-      if (seqlen == - 1) continue;
-      else seqlen = -1;
-      char* ref = faidx_fetch_seq(faiRef, tname.c_str(), 0, faidx_seq_len(faiRef, tname.c_str()), &seqlen);
+    // Coverage windows are buffered per chromosome and written in chromosome order
+    std::vector<std::string> chrCov(chrIdx.size());
+    std::vector<bool> chrDone(chrIdx.size(), false);
+    uint32_t nextOut = 0;
+    
+    // Parse BAM file
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Count fragments" << std::endl;
+    boost::progress_display show_progress( chrIdx.size() );
+
+    // Iterate chromosomes
+#pragma omp parallel for default(shared) schedule(dynamic) num_threads(nthreads)
+    for(uint32_t k = 0; k < chrIdx.size(); ++k) {
+      int32_t refIndex = chrIdx[k];
+      int32_t tid = 0;
+#ifdef OPENMP
+      tid = omp_get_thread_num();
+#endif
+      std::ostringstream covOut;
+
+      // Mappability map
+      std::string tname(hdr->target_name[refIndex]);
+      int32_t seqlen = -1;
+      char* seq = faidx_fetch_seq(faiMapTh[tid], tname.c_str(), 0, faidx_seq_len(faiMapTh[tid], tname.c_str()), &seqlen);
+
+      // Reference
+      seqlen = -1;
+      char* ref = faidx_fetch_seq(faiRefTh[tid], tname.c_str(), 0, faidx_seq_len(faiRefTh[tid], tname.c_str()), &seqlen);
 
       // Get GC and Mappability
       std::vector<uint16_t> uniqContent(hdr->target_len[refIndex], 0);
@@ -184,44 +236,28 @@ namespace torali
       TCoverage cov(hdr->target_len[refIndex], 0);
 
       {
-	// Mate map
+	// Mate map (discordant pairs only in mate-free mode)
 	typedef boost::unordered_map<std::size_t, bool> TMateMap;
 	TMateMap mateMap;
 	
 	// Count reads
-	hts_itr_t* iter = sam_itr_queryi(idx, refIndex, 0, hdr->target_len[refIndex]);
+	hts_itr_t* iter = sam_itr_queryi(idxTh[tid], refIndex, 0, hdr->target_len[refIndex]);
 	bam1_t* rec = bam_init1();
 	int32_t lastAlignedPos = 0;
 	std::set<std::size_t> lastAlignedPosReads;
-	while (sam_itr_next(samfile, iter, rec) >= 0) {
+	while (sam_itr_next(samfileTh[tid], iter, rec) >= 0) {
 	  if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
 	  if (rec->core.qual < c.minQual) continue;	  
 	  if ((rec->core.flag & BAM_FPAIRED) && ((rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid))) continue;
 
 	  int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
 	  if (rec->core.flag & BAM_FPAIRED) {
-	    // Clean-up the read store for identical alignment positions
-	    if (rec->core.pos > lastAlignedPos) {
-	      lastAlignedPosReads.clear();
-	      lastAlignedPos = rec->core.pos;
-	    }
-	    
-	    if ((rec->core.pos < rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (lastAlignedPosReads.find(hash_string(bam_get_qname(rec))) == lastAlignedPosReads.end()))) {
-	      // First read
-	      lastAlignedPosReads.insert(hash_string(bam_get_qname(rec)));
-	      std::size_t hv = hash_pair(rec);
-	      mateMap[hv] = true;
-	      continue;
-	    } else {
-	      // Second read
-	      std::size_t hv = hash_pair_mate(rec);
-	      if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv])) continue; // Mate discarded
-	      mateMap[hv] = false;
-	    }
-	    
+	    int32_t fragStart = 0;
+	    int32_t isize = 0;
+	    if (!_pairedFragment(rec, c.mateFree, c.minQual, mateMap, lastAlignedPos, lastAlignedPosReads, fragStart, isize)) continue;
+
 	    // update midpoint
-	    int32_t isize = (rec->core.pos + alignmentLength(rec)) - rec->core.mpos;
-	    if ((li.minNormalISize < isize) && (isize < li.maxNormalISize)) midPoint = rec->core.mpos + (int32_t) (isize/2);
+	    if ((li.minNormalISize < isize) && (isize < li.maxNormalISize)) midPoint = fragStart + (int32_t) (isize/2);
 	  }
 	  
 	  // Count fragment
@@ -241,14 +277,15 @@ namespace torali
 	callCNVs(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, chrcnv);
 
 	// Merge adjacent CNVs lacking read-depth shift
-	mergeCNVs(c, chrcnv, cnvs);
+	mergeCNVs(c, chrcnv, chrCnvs[refIndex]);
 
 	// Refine breakpoints
-	if (c.hasVcfFile) breakpointRefinement(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, svbp, cnvs);
+	if (c.hasVcfFile) breakpointRefinement(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, svbp, chrCnvs[refIndex]);
       }
       
       // CNV genotyping
-      genotypeCNVs(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, cnvs);
+      if (c.hasGenoFile) genotypeCNVSites(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, chrCnvs[refIndex]);
+      else genotypeCNVs(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, chrCnvs[refIndex]);
 
       // BED File (target intervals)
       if (c.hasBedFile) {
@@ -291,7 +328,7 @@ namespace torali
 		      double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
 		      double cn = c.ploidy;
 		      if (expcov > 0) cn = c.ploidy * covsum / expcov;
-		      dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (pos + 1) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+		      covOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (pos + 1) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
 		      // reset
 		      covsum = 0;
 		      expcov = 0;
@@ -347,9 +384,9 @@ namespace torali
 		double count = ((double) covsum / obsexp ) * (double) (it->second - it->first) / (double) winlen;
 		double cn = c.ploidy;
 		if (expcov > 0) cn = c.ploidy * covsum / expcov;
-		dataOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+		covOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
 	      } else {
-		dataOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\tNA\tNA\tNA" << std::endl;
+		covOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\tNA\tNA\tNA" << std::endl;
 	      }
 	    }
 	  }
@@ -374,7 +411,7 @@ namespace torali
 		double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
 		double cn = c.ploidy;
 		if (expcov > 0) cn = c.ploidy * covsum / expcov;
-		dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (pos + 1) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+		covOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (pos + 1) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
 		// reset
 		covsum = 0;
 		expcov = 0;
@@ -422,33 +459,199 @@ namespace torali
 		double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
 		double cn = c.ploidy;
 		if (expcov > 0) cn = c.ploidy * covsum / expcov;
-		dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (start + c.window_size) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+		covOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (start + c.window_size) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
 	      }
 	    }
 	  }
 	}
       }
+
+      // Write coverage windows of all finished chromosomes in order
+#pragma omp critical
+      {
+	++show_progress;
+	chrCov[k] = covOut.str();
+	chrDone[k] = true;
+	for(; ((nextOut < chrIdx.size()) && (chrDone[nextOut])); ++nextOut) {
+	  if (writeCov) dataOut << chrCov[nextOut];
+	  std::string().swap(chrCov[nextOut]);
+	}
+      }
     }
 
-    // Sort CNVs
-    sort(cnvs.begin(), cnvs.end(), SortCNVs<CNV>());
+    // Collect CNVs in chromosome order
+    for(uint32_t refIndex = 0; refIndex < chrCnvs.size(); ++refIndex) cnvs.insert(cnvs.end(), chrCnvs[refIndex].begin(), chrCnvs[refIndex].end());
 
-    // Genotype CNVs
-    cnvVCF(c, cnvs);
+    // Sort CNVs
+    if (!c.hasGenoFile) sort(cnvs.begin(), cnvs.end(), SortCNVs<CNV>());
 
     // clean-up
+    for(int32_t t = 0; t < nthreads; ++t) {
+      fai_destroy(faiRefTh[t]);
+      fai_destroy(faiMapTh[t]);
+      hts_idx_destroy(idxTh[t]);
+      sam_close(samfileTh[t]);
+    }
     fai_destroy(faiRef);
     fai_destroy(faiMap);
     bam_hdr_destroy(hdr);
     hts_idx_destroy(idx);
     sam_close(samfile);
-    dataOut.pop();
-    dataOut.pop();
+    if (writeCov) {
+      dataOut.pop();
+      dataOut.pop();
+    }
     
     return 0;
   }
 
   
+  template<typename TConfig>
+  inline int32_t
+  _sampleGcBias(TConfig& c, LibraryInfo& li, std::vector<GcBias>& gcbias, std::pair<uint32_t, uint32_t>& gcbound) {
+    // Check bam file
+    if (!(boost::filesystem::exists(c.bamFile) && boost::filesystem::is_regular_file(c.bamFile) && boost::filesystem::file_size(c.bamFile))) {
+      std::cerr << "Alignment file is missing: " << c.bamFile.string() << std::endl;
+      return 1;
+    } else {
+      // Get scan regions
+      typedef boost::icl::interval_set<uint32_t> TChrIntervals;
+      typedef typename TChrIntervals::interval_type TIVal;
+      typedef std::vector<TChrIntervals> TRegionsGenome;
+      TRegionsGenome scanRegions;
+
+      // Open BAM file
+      samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+      if (samfile == NULL) {
+	std::cerr << "Fail to open file " << c.bamFile.string() << std::endl;
+	return 1;
+      }
+      hts_idx_t* idx = sam_index_load(samfile, c.bamFile.string().c_str());
+      if (idx == NULL) {
+	if (bam_index_build(c.bamFile.string().c_str(), 0) != 0) {
+	  std::cerr << "Fail to open index for " << c.bamFile.string() << std::endl;
+	  return 1;
+	}
+      }
+      bam_hdr_t* hdr = sam_hdr_read(samfile);
+      if (hdr == NULL) {
+	std::cerr << "Fail to open header for " << c.bamFile.string() << std::endl;
+	return 1;
+      }
+      c.nchr = hdr->n_targets;
+      c.minChrLen = setMinChrLen(hdr, 0.95);
+      std::string sampleName = "unknown";
+      getSMTag(std::string(hdr->text), c.bamFile.stem().string(), sampleName);
+      c.sampleName = sampleName;
+
+      // Check matching chromosome names
+      faidx_t* faiRef = fai_load(c.genome.string().c_str());
+      faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
+      uint32_t mapFound = 0;
+      uint32_t refFound = 0;
+      for(int32_t refIndex=0; refIndex < hdr->n_targets; ++refIndex) {
+	std::string tname(hdr->target_name[refIndex]);
+	if (faidx_has_seq(faiMap, tname.c_str())) ++mapFound;
+	if (faidx_has_seq(faiRef, tname.c_str())) ++refFound;
+	else {
+	  std::cerr << "Warning: BAM chromosome " << tname << " not present in reference genome!" << std::endl;
+	}
+      }
+      fai_destroy(faiRef);
+      fai_destroy(faiMap);
+      if (!mapFound) {
+	std::cerr << "Mappability map chromosome naming disagrees with BAM file!" << std::endl;
+	return 1;
+      }
+      if (!refFound) {
+	std::cerr << "Reference genome chromosome naming disagrees with BAM file!" << std::endl;
+	return 1;
+      }
+
+      // Estimate library params
+      if (c.hasScanFile) {
+	if (!_parseBedIntervals(c.scanFile.string(), c.hasScanFile, hdr, scanRegions)) {
+	  std::cerr << "Warning: Couldn't parse BED intervals. Do the chromosome names match?" << std::endl;
+	  return 1;
+	}
+      } else {
+	scanRegions.resize(hdr->n_targets);
+	for (int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
+	  scanRegions[refIndex].insert(TIVal::right_open(0, hdr->target_len[refIndex]));
+	}
+      }
+      typedef std::vector<LibraryInfo> TSampleLibrary;
+      TSampleLibrary sampleLib(1, LibraryInfo());
+      CountDNAConfigLib dellyConf;
+      dellyConf.genome = c.genome;
+      dellyConf.files.push_back(c.bamFile);
+      dellyConf.madCutoff = 9;
+      dellyConf.madNormalCutoff = c.mad;
+      getLibraryParams(dellyConf, scanRegions, sampleLib);
+      li = sampleLib[0];
+      if (!li.median) {
+	li.median = 250;
+	li.mad = 15;
+	li.minNormalISize = 0;
+	li.maxNormalISize = 400;
+      }
+      c.meanisize = ((int32_t) (li.median / 2)) * 2 + 1;
+      
+      // Clean-up
+      bam_hdr_destroy(hdr);
+      hts_idx_destroy(idx);
+      sam_close(samfile);
+    }
+
+    // GC bias estimation
+    gcbias.assign(c.meanisize + 1, GcBias());
+    {
+      // Scan genomic windows
+      typedef std::vector<ScanWindow> TWindowCounts;
+      typedef std::vector<TWindowCounts> TGenomicWindowCounts;
+      TGenomicWindowCounts scanCounts(c.nchr, TWindowCounts());
+      scan(c, li, scanCounts);
+    
+      // Select stable windows
+      selectWindows(c, scanCounts);
+
+      // Estimate GC bias
+      gcBias(c, scanCounts, li, gcbias, gcbound);
+
+      // Statistics output
+      if (c.hasStatsFile) {
+	// Open stats file
+	boost::iostreams::filtering_ostream statsOut;
+	statsOut.push(boost::iostreams::gzip_compressor());
+	statsOut.push(boost::iostreams::file_sink(c.statsFile.string().c_str(), std::ios_base::out | std::ios_base::binary));
+	
+	// Library Info
+	statsOut << "LP\t" << li.rs << ',' << li.median << ',' << li.mad << ',' << li.minNormalISize << ',' << li.maxNormalISize << std::endl;
+	
+	// Scan window summry
+	samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+	bam_hdr_t* hdr = sam_hdr_read(samfile);
+	statsOut << "SW\tchrom\tstart\tend\tselected\tcoverage\tuniqcov" <<  std::endl;
+	for(uint32_t refIndex = 0; refIndex < (uint32_t) hdr->n_targets; ++refIndex) {
+	  for(uint32_t i = 0; i < scanCounts[refIndex].size(); ++i) {
+	    statsOut << "SW\t" <<  hdr->target_name[refIndex] << '\t' << scanCounts[refIndex][i].start << '\t' << scanCounts[refIndex][i].end << '\t' << scanCounts[refIndex][i].select << '\t' << scanCounts[refIndex][i].cov << '\t' << scanCounts[refIndex][i].uniqcov << std::endl;
+	  }
+	}
+	bam_hdr_destroy(hdr);
+	sam_close(samfile);
+	
+	// GC bias summary
+	statsOut << "GC\tgcsum\tsample\treference\tpercentileSample\tpercentileReference\tfractionSample\tfractionReference\tobsexp\tmeancoverage" << std::endl;
+	for(uint32_t i = 0; i < gcbias.size(); ++i) statsOut << "GC\t" << i << "\t" << gcbias[i].sample << "\t" << gcbias[i].reference << "\t" << gcbias[i].percentileSample << "\t" << gcbias[i].percentileReference << "\t" << gcbias[i].fractionSample << "\t" << gcbias[i].fractionReference << "\t" << gcbias[i].obsexp << "\t" << gcbias[i].coverage << std::endl;
+	statsOut << "BoundsGC\t" << gcbound.first << "," << gcbound.second << std::endl;
+	statsOut.pop();
+	statsOut.pop();
+      }
+    }
+
+    return 0;
+  }
+
   int coral(int argc, char **argv) {
     CountDNAConfig c;
 
@@ -462,6 +665,7 @@ namespace torali
       ("ploidy,y", boost::program_options::value<uint16_t>(&c.ploidy)->default_value(2), "baseline ploidy")
       ("outfile,o", boost::program_options::value<boost::filesystem::path>(&c.cnvfile)->default_value("cnv.bcf"), "output CNV file")
       ("covfile,c", boost::program_options::value<boost::filesystem::path>(&c.covfile)->default_value("cov.gz"), "output coverage file")
+      ("mate-free", "count proper pairs from the template length without a mate map")
       ;
 
     boost::program_options::options_description cnv("CNV calling");
@@ -495,7 +699,7 @@ namespace torali
     
     boost::program_options::options_description hidden("Hidden options");
     hidden.add_options()
-      ("input-file", boost::program_options::value<boost::filesystem::path>(&c.bamFile), "input bam file")
+      ("input-file", boost::program_options::value< std::vector<boost::filesystem::path> >(&c.files), "input bam file")
       ("fragment,e", boost::program_options::value<float>(&c.fragmentUnique)->default_value(0.97), "min. fragment uniqueness [0,1]")
       ("statsfile,s", boost::program_options::value<boost::filesystem::path>(&c.statsFile), "gzipped stats output file (optional)")
       ;
@@ -518,6 +722,8 @@ namespace torali
     if ((vm.count("help")) || (!vm.count("input-file")) || (!vm.count("genome")) || (!vm.count("mappability"))) {
       std::cout << std::endl;
       std::cout << "Usage: delly " << argv[0] << " [OPTIONS] -g <genome.fa> -m <genome.map> <aligned.bam>" << std::endl;
+      std::cout << "       delly " << argv[0] << " [OPTIONS] -g <genome.fa> -m <genome.map> -v <sites.bcf> <sample1.bam> <sample2.bam> ..." << std::endl;
+      std::cout << "Chromosomes are processed in parallel with OMP_NUM_THREADS threads, each thread holds the buffers of one chromosome (~2GB for human chr1)." << std::endl;
       std::cout << visible_options << "\n";
       return 1;
     }
@@ -553,6 +759,10 @@ namespace torali
     if (vm.count("segmentation")) c.segmentation = true;
     else c.segmentation = false;
 
+    // Fragment counting
+    if (vm.count("mate-free")) c.mateFree = true;
+    else c.mateFree = false;
+
     // Check window size
     if (c.window_offset > c.window_size) c.window_offset = c.window_size;
     if (c.window_size == 0) c.window_size = 1;
@@ -600,155 +810,75 @@ namespace torali
       c.hasVcfFile = true;
     } else c.hasVcfFile = false;
     
-    // Check bam file
-    LibraryInfo li;
-    if (!(boost::filesystem::exists(c.bamFile) && boost::filesystem::is_regular_file(c.bamFile) && boost::filesystem::file_size(c.bamFile))) {
-      std::cerr << "Alignment file is missing: " << c.bamFile.string() << std::endl;
+    // Multi-sample runs genotype a site list
+    if ((c.files.size() > 1) && (!c.hasGenoFile)) {
+      std::cerr << "Multiple alignment files require a CNV site list for genotyping (-v)!" << std::endl;
       return 1;
-    } else {
-      // Get scan regions
-      typedef boost::icl::interval_set<uint32_t> TChrIntervals;
-      typedef typename TChrIntervals::interval_type TIVal;
-      typedef std::vector<TChrIntervals> TRegionsGenome;
-      TRegionsGenome scanRegions;
-
-      // Open BAM file
-      samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
-      if (samfile == NULL) {
-	std::cerr << "Fail to open file " << c.bamFile.string() << std::endl;
-	return 1;
-      }
-      hts_idx_t* idx = sam_index_load(samfile, c.bamFile.string().c_str());
-      if (idx == NULL) {
-	if (bam_index_build(c.bamFile.string().c_str(), 0) != 0) {
-	  std::cerr << "Fail to open index for " << c.bamFile.string() << std::endl;
+    }
+    if (c.files.size() > 1) {
+      c.hasStatsFile = false;
+      std::set<std::string> sampleSet;
+      std::vector<std::string> contigs;
+      for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+	samFile* samfile = sam_open(c.files[file_c].string().c_str(), "r");
+	if (samfile == NULL) {
+	  std::cerr << "Fail to open file " << c.files[file_c].string() << std::endl;
 	  return 1;
 	}
-      }
-      bam_hdr_t* hdr = sam_hdr_read(samfile);
-      if (hdr == NULL) {
-	std::cerr << "Fail to open header for " << c.bamFile.string() << std::endl;
-	return 1;
-      }
-      c.nchr = hdr->n_targets;
-      c.minChrLen = setMinChrLen(hdr, 0.95);
-      std::string sampleName = "unknown";
-      getSMTag(std::string(hdr->text), c.bamFile.stem().string(), sampleName);
-      c.sampleName = sampleName;
-
-      // Check matching chromosome names
-      faidx_t* faiRef = fai_load(c.genome.string().c_str());
-      faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
-      uint32_t mapFound = 0;
-      uint32_t refFound = 0;
-      for(int32_t refIndex=0; refIndex < hdr->n_targets; ++refIndex) {
-	std::string tname(hdr->target_name[refIndex]);
-	if (faidx_has_seq(faiMap, tname.c_str())) ++mapFound;
-	if (faidx_has_seq(faiRef, tname.c_str())) ++refFound;
-	else {
-	  std::cerr << "Warning: BAM chromosome " << tname << " not present in reference genome!" << std::endl;
-	}
-      }
-      fai_destroy(faiRef);
-      fai_destroy(faiMap);
-      if (!mapFound) {
-	std::cerr << "Mappability map chromosome naming disagrees with BAM file!" << std::endl;
-	return 1;
-      }
-      if (!refFound) {
-	std::cerr << "Reference genome chromosome naming disagrees with BAM file!" << std::endl;
-	return 1;
-      }
-
-      // Estimate library params
-      if (c.hasScanFile) {
-	if (!_parseBedIntervals(c.scanFile.string(), c.hasScanFile, hdr, scanRegions)) {
-	  std::cerr << "Warning: Couldn't parse BED intervals. Do the chromosome names match?" << std::endl;
+	bam_hdr_t* hdr = sam_hdr_read(samfile);
+	if (hdr == NULL) {
+	  std::cerr << "Fail to open header for " << c.files[file_c].string() << std::endl;
 	  return 1;
 	}
-      } else {
-	scanRegions.resize(hdr->n_targets);
-	for (int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
-	  scanRegions[refIndex].insert(TIVal::right_open(0, hdr->target_len[refIndex]));
-	}
-      }
-      typedef std::vector<LibraryInfo> TSampleLibrary;
-      TSampleLibrary sampleLib(1, LibraryInfo());
-      CountDNAConfigLib dellyConf;
-      dellyConf.genome = c.genome;
-      dellyConf.files.push_back(c.bamFile);
-      dellyConf.madCutoff = 9;
-      dellyConf.madNormalCutoff = c.mad;
-      getLibraryParams(dellyConf, scanRegions, sampleLib);
-      li = sampleLib[0];
-      if (!li.median) {
-	li.median = 250;
-	li.mad = 15;
-	li.minNormalISize = 0;
-	li.maxNormalISize = 400;
-      }
-      c.meanisize = ((int32_t) (li.median / 2)) * 2 + 1;
-      
-      // Clean-up
-      bam_hdr_destroy(hdr);
-      hts_idx_destroy(idx);
-      sam_close(samfile);
-    }
-
-    // GC bias estimation
-    typedef std::pair<uint32_t, uint32_t> TGCBound;
-    TGCBound gcbound;
-    std::vector<GcBias> gcbias(c.meanisize + 1, GcBias());
-    {
-      // Scan genomic windows
-      typedef std::vector<ScanWindow> TWindowCounts;
-      typedef std::vector<TWindowCounts> TGenomicWindowCounts;
-      TGenomicWindowCounts scanCounts(c.nchr, TWindowCounts());
-      scan(c, li, scanCounts);
-    
-      // Select stable windows
-      selectWindows(c, scanCounts);
-
-      // Estimate GC bias
-      gcBias(c, scanCounts, li, gcbias, gcbound);
-
-      // Statistics output
-      if (c.hasStatsFile) {
-	// Open stats file
-	boost::iostreams::filtering_ostream statsOut;
-	statsOut.push(boost::iostreams::gzip_compressor());
-	statsOut.push(boost::iostreams::file_sink(c.statsFile.string().c_str(), std::ios_base::out | std::ios_base::binary));
-	
-	// Library Info
-	statsOut << "LP\t" << li.rs << ',' << li.median << ',' << li.mad << ',' << li.minNormalISize << ',' << li.maxNormalISize << std::endl;
-	
-	// Scan window summry
-	samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
-	bam_hdr_t* hdr = sam_hdr_read(samfile);
-	statsOut << "SW\tchrom\tstart\tend\tselected\tcoverage\tuniqcov" <<  std::endl;
-	for(uint32_t refIndex = 0; refIndex < (uint32_t) hdr->n_targets; ++refIndex) {
-	  for(uint32_t i = 0; i < scanCounts[refIndex].size(); ++i) {
-	    statsOut << "SW\t" <<  hdr->target_name[refIndex] << '\t' << scanCounts[refIndex][i].start << '\t' << scanCounts[refIndex][i].end << '\t' << scanCounts[refIndex][i].select << '\t' << scanCounts[refIndex][i].cov << '\t' << scanCounts[refIndex][i].uniqcov << std::endl;
+	std::string sampleName = "unknown";
+	getSMTag(std::string(hdr->text), c.files[file_c].stem().string(), sampleName);
+	bool sameContigs = true;
+	if (!file_c) {
+	  for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) contigs.push_back(hdr->target_name[refIndex]);
+	} else if ((int32_t) contigs.size() != hdr->n_targets) sameContigs = false;
+	else {
+	  for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
+	    if (contigs[refIndex] != hdr->target_name[refIndex]) sameContigs = false;
 	  }
 	}
 	bam_hdr_destroy(hdr);
 	sam_close(samfile);
-	
-	// GC bias summary
-	statsOut << "GC\tgcsum\tsample\treference\tpercentileSample\tpercentileReference\tfractionSample\tfractionReference\tobsexp\tmeancoverage" << std::endl;
-	for(uint32_t i = 0; i < gcbias.size(); ++i) statsOut << "GC\t" << i << "\t" << gcbias[i].sample << "\t" << gcbias[i].reference << "\t" << gcbias[i].percentileSample << "\t" << gcbias[i].percentileReference << "\t" << gcbias[i].fractionSample << "\t" << gcbias[i].fractionReference << "\t" << gcbias[i].obsexp << "\t" << gcbias[i].coverage << std::endl;
-	statsOut << "BoundsGC\t" << gcbound.first << "," << gcbound.second << std::endl;
-	statsOut.pop();
-	statsOut.pop();
+	if (!sameContigs) {
+	  std::cerr << "Alignment file " << c.files[file_c].string() << " has a different chromosome order!" << std::endl;
+	  return 1;
+	}
+	if (sampleSet.find(sampleName) != sampleSet.end()) {
+	  std::cerr << "Sample name " << sampleName << " is not unique!" << std::endl;
+	  return 1;
+	}
+	sampleSet.insert(sampleName);
       }
     }
+
+    // Iterate samples
+    std::vector<std::string> sampleNames(c.files.size());
+    std::vector< std::vector<CNV> > sampleCnvs(c.files.size(), std::vector<CNV>());
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      c.bamFile = c.files[file_c];
       
-    // Count reads
-    if (bamCount(c, li, gcbias, gcbound)) {
-      std::cerr << "Read counting error!" << std::endl;
-      return 1;
+      // Library parameters and GC bias
+      LibraryInfo li;
+      typedef std::pair<uint32_t, uint32_t> TGCBound;
+      TGCBound gcbound;
+      std::vector<GcBias> gcbias;
+      if (_sampleGcBias(c, li, gcbias, gcbound)) return 1;
+      sampleNames[file_c] = c.sampleName;
+
+      // Count reads
+      if (bamCount(c, li, gcbias, gcbound, sampleCnvs[file_c])) {
+	std::cerr << "Read counting error!" << std::endl;
+	return 1;
+      }
     }
 
+    // Genotype CNVs
+    cnvVCF(c, sampleNames, sampleCnvs);
+
     // Done
     now = boost::posix_time::second_clock::local_time();
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Done." << std::endl;
@@ -9,12 +9,16 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/zlib.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/progress.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
 
 #include <htslib/sam.h>
 
 #include "tags.h"
 #include "util.h"
+#include "bolog.h"
 #include "msa.h"
 #include "split.h"
 
@@ -25,10 +29,11 @@ namespace torali {
     int32_t bppos;
     int32_t svt;
     uint32_t id;
+    bool bpPoint;
 
-    SpanPoint() : bppos(0), svt(0), id(0) {}
-    explicit SpanPoint(int32_t bp) : bppos(bp), svt(0), id(0) {}
-    SpanPoint(int32_t bp, int32_t s, uint32_t identifier) : bppos(bp), svt(s), id(identifier) {}
+    SpanPoint() : bppos(0), svt(0), id(0), bpPoint(false) {}
+    explicit SpanPoint(int32_t bp) : bppos(bp), svt(0), id(0), bpPoint(false) {}
+    SpanPoint(int32_t bp, int32_t s, uint32_t identifier, bool bpp) : bppos(bp), svt(s), id(identifier), bpPoint(bpp) {}
   };
   
   struct BpRegion {
@@ -76,6 +81,191 @@ namespace torali {
     JunctionCount() : refh1(0), refh2(0), alth1(0), alth2(0) {}
   };
 
+  struct JunctionRead {
+    uint8_t evidence; // 0: none, 1: ref, 2: alt
+    uint8_t qual;
+    uint8_t hap;
+
+    JunctionRead() : evidence(0), qual(0), hap(0) {}
+    JunctionRead(uint8_t e, uint8_t q, uint8_t h) : evidence(e), qual(q), hap(h) {}
+  };
+
+  struct JunctionReservoir {
+    uint32_t seen;
+    std::vector<JunctionRead> reads;
+
+    JunctionReservoir() : seen(0) {}
+  };
+
+  struct GenotypeTrack {
+    double gl[3];
+    uint32_t depth;
+    uint32_t stable;
+    bool done;
+
+    GenotypeTrack() : depth(0), stable(0), done(false) {
+      gl[0] = 0;
+      gl[1] = 0;
+      gl[2] = 0;
+    }
+  };
+
+  // Reservoir slot of the next read candidate, -1 if the candidate is not sampled
+  // A slot equal to the reservoir size appends, a cap of 0 samples all reads
+  template<typename TRng>
+  inline int32_t
+  _reservoirSlot(JunctionReservoir& jr, uint32_t const cap, TRng& rng) {
+    ++jr.seen;
+    if ((!cap) || (jr.reads.size() < cap)) return jr.reads.size();
+    boost::random::uniform_int_distribution<uint32_t> dist(0, jr.seen - 1);
+    uint32_t r = dist(rng);
+    if (r < cap) return r;
+    return -1;
+  }
+
+  // Only informative reads are stored, the previous read of the slot is dropped
+  inline JunctionRead&
+  _storeRead(JunctionReservoir& jr, int32_t const slot, JunctionRead const& jread) {
+    if (slot == (int32_t) jr.reads.size()) jr.reads.push_back(JunctionRead());
+    JunctionRead& stored = jr.reads[slot];
+    stored = jread;
+    return stored;
+  }
+
+  template<typename TCount>
+  inline bool
+  _reservoirCounts(JunctionReservoir const& jr, TCount& count) {
+    bool haplotagged = false;
+    for(uint32_t j = 0; j < jr.reads.size(); ++j) {
+      JunctionRead const& jread = jr.reads[j];
+      if (jread.evidence == 1) {
+	count.ref.push_back(jread.qual);
+	if (jread.hap == 1) ++count.refh1;
+	else if (jread.hap == 2) ++count.refh2;
+      } else if (jread.evidence == 2) {
+	count.alt.push_back(jread.qual);
+	if (jread.hap == 1) ++count.alth1;
+	else if (jread.hap == 2) ++count.alth2;
+      }
+      if ((jread.evidence) && (jread.hap)) haplotagged = true;
+    }
+    return haplotagged;
+  }
+
+  template<typename TConfig, typename TBoLog>
+  inline void
+  _setJunctionRead(TConfig const& c, TBoLog const& bl, JunctionRead const& jread, JunctionReservoir& jr, int32_t const slot, GenotypeTrack& gt) {
+    if ((slot < (int32_t) jr.reads.size()) && (jr.reads[slot].evidence)) {
+      JunctionRead const& old = jr.reads[slot];
+      _addGL(bl, old.qual, (old.evidence == 2), -1.0, gt.gl);
+      --gt.depth;
+    }
+    JunctionRead const& stored = _storeRead(jr, slot, jread);
+    if (stored.evidence) {
+      _addGL(bl, stored.qual, (stored.evidence == 2), 1.0, gt.gl);
+      ++gt.depth;
+
+      // Stop once the genotype quality is stable
+      if (c.stableGenoQual) {
+	double gl[3] = {gt.gl[0], gt.gl[1], gt.gl[2]};
+	unsigned int glBest = 0;
+	int32_t gq = 0;
+	_rescaleGLs(bl, gt.depth, gl, glBest, gq);
+	if (gq >= (int32_t) c.stableGenoQual) {
+	  if (++gt.stable >= c.stableGenoCount) gt.done = true;
+	} else gt.stable = 0;
+      }
+    }
+  }
+
+  // Seeds of a genotyping probe, reads without a shared seed cannot align above the probe threshold
+  struct ProbeSeeds {
+    uint32_t k;
+    std::vector<uint32_t> kmer;
+
+    ProbeSeeds() : k(0) {}
+  };
+
+  inline int32_t
+  _seedCode(char const ch) {
+    switch (ch) {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return -1;
+    }
+  }
+
+  template<typename TScore>
+  inline void
+  _probeSeeds(std::string const& probe, int32_t const threshold, TScore const& sc, ProbeSeeds& ps) {
+    ps.k = 0;
+    ps.kmer.clear();
+
+    // Probe characters other than ACGT may match read characters, no filtering
+    for(uint32_t i = 0; i < probe.size(); ++i) {
+      if ((_seedCode(probe[i]) == -1) && (std::string("=MRSVWYHKDBN").find(probe[i]) != std::string::npos)) return;
+    }
+
+    // Longest exact match every alignment with score > threshold must contain
+    // Probe is aligned end-to-end: a substitution or probe deletion costs match - mismatch/gap, a read insertion -gap
+    int32_t len = probe.size();
+    int32_t budget = len * sc.match - threshold;
+    int32_t subCost = sc.match - std::max(sc.mismatch, sc.ge);
+    int32_t insCost = -sc.ge;
+    if ((subCost <= 0) || (insCost <= 0)) return;
+    int32_t k = len;
+    for(int32_t sub = 0; sub * subCost < budget; ++sub) {
+      int32_t ins = (budget - 1 - sub * subCost) / insCost;
+      int32_t run = (len + ins) / (sub + ins + 1); // ceil((len - sub) / (sub + ins + 1))
+      k = std::min(k, run);
+    }
+    if (k < 4) return;
+    ps.k = std::min(k, 12);
+
+    // Collect probe k-mers
+    uint32_t mask = (1u << (2 * ps.k)) - 1;
+    uint32_t code = 0;
+    uint32_t valid = 0;
+    for(uint32_t i = 0; i < probe.size(); ++i) {
+      int32_t b = _seedCode(probe[i]);
+      if (b == -1) {
+	valid = 0;
+	continue;
+      }
+      code = ((code << 2) | b) & mask;
+      if (++valid >= ps.k) ps.kmer.push_back(code);
+    }
+    std::sort(ps.kmer.begin(), ps.kmer.end());
+    ps.kmer.erase(std::unique(ps.kmer.begin(), ps.kmer.end()), ps.kmer.end());
+  }
+
+  template<typename TSequence>
+  inline bool
+  _sharesSeed(TSequence const& sequence, ProbeSeeds const& ps) {
+    if (!ps.k) return true;
+    uint32_t mask = (1u << (2 * ps.k)) - 1;
+    uint32_t code = 0;
+    uint32_t valid = 0;
+    for(uint32_t i = 0; i < sequence.size(); ++i) {
+      int32_t b = _seedCode(sequence[i]);
+      if (b == -1) {
+	valid = 0;
+	continue;
+      }
+      code = ((code << 2) | b) & mask;
+      if ((++valid >= ps.k) && (std::binary_search(ps.kmer.begin(), ps.kmer.end(), code))) return true;
+    }
+    return false;
+  }
+
+  template<typename TConfig, typename TScore>
+  inline int32_t
+  _probeThreshold(TConfig const& c, std::string const& probe, TScore const& sc) {
+    return (int32_t) (c.flankQuality * probe.size() * sc.match + (1.0 - c.flankQuality) * probe.size() * sc.mismatch);
+  }
+
   template<typename TAlign, typename TQualities>
   inline uint32_t
   _getAlignmentQual(TAlign const& align, TQualities const& qual) {
@@ -142,6 +332,137 @@ namespace torali {
   }
 
   
+  template<typename TConfig>
+  inline std::string
+  _probeCacheFile(TConfig const& c) {
+    return c.vcffile.string() + ".probes.gz";
+  }
+
+  template<typename TConfig, typename TSV>
+  inline std::string
+  _probeCacheKey(TConfig const& c, TSV const& sv) {
+    std::ostringstream key;
+    key << sv.id << '\t' << sv.chr << '\t' << sv.svStart << '\t' << sv.chr2 << '\t' << sv.svEnd << '\t' << sv.svt << '\t' << sv.precise << '\t' << hash_string(sv.consensus.c_str()) << '\t' << c.minimumFlankSize;
+    return key.str();
+  }
+
+  template<typename TConfig>
+  inline std::string
+  _probeCacheHeader(TConfig const& c) {
+    return std::string("#delly probe cache\t") + c.genome.string() + "\t" + _fileStamp(c.genome);
+  }
+
+  // Probes of one cached SV
+  struct ProbeCacheEntry {
+    int32_t id;
+    std::string alleles;
+    std::vector<BpRegion> regions;
+    std::string consProbe[2];
+    std::string refProbe[2];
+  };
+
+  template<typename TConfig, typename TSVs>
+  inline bool
+  _parseProbeCache(TConfig const& c, TSVs const& svs, std::string const& filename, std::vector<ProbeCacheEntry>& entries) {
+    boost::iostreams::filtering_istream cacheIn;
+    cacheIn.push(boost::iostreams::gzip_decompressor());
+    cacheIn.push(boost::iostreams::file_source(filename.c_str(), std::ios_base::in | std::ios_base::binary));
+    std::string line;
+    if ((!std::getline(cacheIn, line)) || (line != _probeCacheHeader(c))) return false;
+    uint32_t nlines = 0;
+    while (std::getline(cacheIn, line)) {
+      // Complete caches end with the number of SV lines
+      if (line.substr(0, 5) == "#end\t") return (line.substr(5) == boost::lexical_cast<std::string>(nlines));
+      ++nlines;
+
+      // Key: id, chr, svStart, chr2, svEnd, svt, precise, consensus hash, flank size
+      std::size_t keyEnd = 0;
+      for(uint32_t k = 0; ((k < 9) && (keyEnd != std::string::npos)); ++k) keyEnd = line.find('\t', keyEnd + (k > 0));
+      if (keyEnd == std::string::npos) continue;
+      std::istringstream rec(line);
+      int32_t id = -1;
+      rec >> id;
+      if ((id < 0) || (id >= (int32_t) svs.size()) || (line.substr(0, keyEnd) != _probeCacheKey(c, svs[id]))) continue;
+      rec.str(line.substr(keyEnd + 1));
+      rec.clear();
+      ProbeCacheEntry pce;
+      pce.id = id;
+      uint32_t nProbes = 0;
+      rec >> pce.alleles >> nProbes;
+      for(uint32_t k = 0; ((k < nProbes) && (k < 2)); ++k) {
+	BpRegion bpr;
+	rec >> bpr.regionStart >> bpr.regionEnd >> bpr.bppos >> bpr.homLeft >> bpr.homRight >> pce.consProbe[k] >> pce.refProbe[k];
+	bpr.svt = svs[id].svt;
+	bpr.id = svs[id].id;
+	bpr.bpPoint = k;
+	pce.regions.push_back(bpr);
+      }
+      if ((rec.fail()) || (nProbes != pce.regions.size())) continue;
+      entries.push_back(pce);
+    }
+    return false;
+  }
+
+  template<typename TConfig, typename TSVs, typename TBreakProbes, typename TSVBpRegion>
+  inline void
+  _readProbeCache(TConfig const& c, TSVs& svs, TBreakProbes& refProbeArr, TBreakProbes& consProbeArr, TSVBpRegion& svRegion, std::vector<bool>& cached) {
+    std::string filename = _probeCacheFile(c);
+    if (!boost::filesystem::exists(filename)) return;
+
+    // Corrupt, truncated or stale caches are a cache miss
+    std::vector<ProbeCacheEntry> entries;
+    try {
+      if (!_parseProbeCache(c, svs, filename, entries)) return;
+    } catch (std::exception const& e) {
+      std::cerr << "Warning: Probe cache " << filename << " cannot be read: " << e.what() << std::endl;
+      return;
+    }
+    for(uint32_t i = 0; i < entries.size(); ++i) {
+      int32_t id = entries[i].id;
+      svs[id].alleles = entries[i].alleles;
+      for(uint32_t k = 0; k < entries[i].regions.size(); ++k) {
+	consProbeArr[k][svs[id].id] = entries[i].consProbe[k];
+	refProbeArr[k][svs[id].id] = entries[i].refProbe[k];
+      }
+      svRegion[id] = entries[i].regions;
+      cached[id] = true;
+    }
+  }
+
+  template<typename TConfig, typename TSVs, typename TBreakProbes, typename TSVBpRegion>
+  inline void
+  _writeProbeCache(TConfig const& c, TSVs const& svs, TBreakProbes const& refProbeArr, TBreakProbes const& consProbeArr, TSVBpRegion const& svRegion) {
+    std::string filename = _probeCacheFile(c);
+    std::string tmpfile = _sideCarTmpFile(filename);
+    bool success = true;
+    try {
+      boost::iostreams::file_sink sink(tmpfile.c_str(), std::ios_base::out | std::ios_base::binary);
+      if (!sink.is_open()) success = false;
+      else {
+	boost::iostreams::filtering_ostream cacheOut;
+	cacheOut.push(boost::iostreams::gzip_compressor());
+	cacheOut.push(sink);
+	cacheOut << _probeCacheHeader(c) << std::endl;
+	for(uint32_t i = 0; i < svs.size(); ++i) {
+	  cacheOut << _probeCacheKey(c, svs[i]) << '\t' << svs[i].alleles << '\t' << svRegion[i].size();
+	  for(uint32_t k = 0; k < svRegion[i].size(); ++k) {
+	    BpRegion const& bpr = svRegion[i][k];
+	    cacheOut << '\t' << bpr.regionStart << '\t' << bpr.regionEnd << '\t' << bpr.bppos << '\t' << bpr.homLeft << '\t' << bpr.homRight << '\t' << consProbeArr[bpr.bpPoint][bpr.id] << '\t' << refProbeArr[bpr.bpPoint][bpr.id];
+	  }
+	  cacheOut << std::endl;
+	}
+	cacheOut << "#end\t" << svs.size() << std::endl;
+	if (!cacheOut) success = false;
+      }
+    } catch (std::exception const&) {
+      success = false;
+    }
+    if ((!success) || (!_commitSideCar(tmpfile, filename))) {
+      std::remove(tmpfile.c_str());
+      std::cerr << "Warning: Probe cache " << filename << " cannot be written!" << std::endl;
+    }
+  }
+  
   template<typename TConfig, typename TSVs, typename TBreakProbes, typename TGenomicBpRegion>
   inline void
     _generateProbes(TConfig const& c, bam_hdr_t* hdr, TSVs& svs, TBreakProbes& refProbeArr, TBreakProbes& consProbeArr, TGenomicBpRegion& bpRegion, std::vector<bool>& svOnChr) {
@@ -152,23 +473,40 @@ namespace torali {
     std::cout << '[' << boost::posix_time::to_simple_string(noww) << "] " << "Generate REF and ALT probes" << std::endl;
     boost::progress_display show_progresss( hdr->n_targets );
 
+    // Breakpoint regions by SV
+    typedef std::vector<BpRegion> TBpRegion;
+    typedef std::vector<TBpRegion> TSVBpRegion;
+    TSVBpRegion svRegion(svs.size(), TBpRegion());
+
+    // Probes of a re-genotyped site list are optionally cached next to the input VCF/BCF
+    std::vector<bool> cached(svs.size(), false);
+    if ((c.hasVcfFile) && (c.hasProbeCache)) _readProbeCache(c, svs, refProbeArr, consProbeArr, svRegion, cached);
+    bool cacheComplete = true;
+
     TProbes refProbes(svs.size());
     faidx_t* fai = fai_load(c.genome.string().c_str());
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
       ++show_progresss;
-      char* seq = NULL;
 
-      // Iterate all structural variants
-      for(typename TSVs::iterator itSV = svs.begin(); itSV != svs.end(); ++itSV) {
-	if ((itSV->chr != refIndex) && (itSV->chr2 != refIndex)) continue;
+      // SVs on this chromosome without cached probes
+      std::vector<uint32_t> svIdx;
+      for(uint32_t i = 0; i < svs.size(); ++i) {
+	if ((svs[i].chr != refIndex) && (svs[i].chr2 != refIndex)) continue;
 	svOnChr[refIndex] = true;
-	
-	// Lazy loading of reference sequence
-	if (seq == NULL) {
-	  int32_t seqlen = -1;
-	  std::string tname(hdr->target_name[refIndex]);
-	  seq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex], &seqlen);
-	}
+	if (!cached[i]) svIdx.push_back(i);
+      }
+      if (svIdx.empty()) continue;
+      cacheComplete = false;
+
+      // Load reference sequence
+      int32_t seqlen = -1;
+      std::string tname(hdr->target_name[refIndex]);
+      char* seq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex], &seqlen);
+
+      // Iterate all structural variants
+#pragma omp parallel for default(shared) schedule(dynamic)
+      for(uint32_t i = 0; i < svIdx.size(); ++i) {
+	typename TSVs::iterator itSV = svs.begin() + svIdx[i];
 
 	// Set tag alleles
 	if (itSV->chr == refIndex) {
@@ -198,20 +536,11 @@ namespace torali {
 
 	  AlignDescriptor ad;
 	  if (!_findSplit(c, itSV->consensus, svRefStr, align, ad, itSV->svt)) continue;
-	  
-	  // Debug consensus to reference alignment
-	  //std::cerr << itSV->id << std::endl;
-	  //for(uint32_t i = 0; i<align.shape()[0]; ++i) {
-	  //for(uint32_t j = 0; j<align.shape()[1]; ++j) std::cerr << align[i][j];
-	  //std::cerr << std::endl;
-	  //}
-	  //std::cerr << std::endl;
 
 	  // Iterate all samples
 	  for (unsigned int bpPoint = 0; bpPoint<2; ++bpPoint) {
-	    int32_t regionChr, regionStart, regionEnd, cutConsStart, cutConsEnd, cutRefStart, cutRefEnd, bppos;
+	    int32_t regionStart, regionEnd, cutConsStart, cutConsEnd, cutRefStart, cutRefEnd, bppos;
 	    if (bpPoint) {
-	      regionChr = itSV->chr2;
 	      regionStart = std::max(0, itSV->svEnd - c.minimumFlankSize);
 	      regionEnd = std::min((uint32_t) (itSV->svEnd + c.minimumFlankSize), hdr->target_len[itSV->chr2]);
 	      cutConsStart = ad.cEnd - ad.homLeft - c.minimumFlankSize;
@@ -220,7 +549,6 @@ namespace torali {
 	      cutRefEnd = _cutRefEnd(ad.rStart, ad.rEnd, ad.homRight + c.minimumFlankSize, bpPoint, itSV->svt);
 	      bppos = itSV->svEnd;
 	    } else {
-	      regionChr = itSV->chr;
 	      regionStart = std::max(0, itSV->svStart - c.minimumFlankSize);
 	      regionEnd = std::min((uint32_t) (itSV->svStart + c.minimumFlankSize), hdr->target_len[itSV->chr]);
 	      cutConsStart = ad.cStart - ad.homLeft - c.minimumFlankSize;
@@ -231,20 +559,89 @@ namespace torali {
 	    }
 	    consProbeArr[bpPoint][itSV->id] = itSV->consensus.substr(cutConsStart, (cutConsEnd - cutConsStart));
 	    refProbeArr[bpPoint][itSV->id] = svRefStr.substr(cutRefStart, (cutRefEnd - cutRefStart));
-	    bpRegion[regionChr].push_back(BpRegion(regionStart, regionEnd, bppos, ad.homLeft, ad.homRight, itSV->svt, itSV->id, bpPoint));
+	    svRegion[svIdx[i]].push_back(BpRegion(regionStart, regionEnd, bppos, ad.homLeft, ad.homRight, itSV->svt, itSV->id, bpPoint));
 	  }
 	}
       }
-      if (seq != NULL) free(seq);
+      free(seq);
     }
     // Clean-up
     fai_destroy(fai);
+    if ((c.hasVcfFile) && (c.hasProbeCache) && (!cacheComplete)) _writeProbeCache(c, svs, refProbeArr, consProbeArr, svRegion);
+
+    // Left breakpoint on chr, right breakpoint on chr2
+    for(uint32_t i = 0; i < svs.size(); ++i) {
+      for(uint32_t k = 0; k < svRegion[i].size(); ++k) {
+	if (svRegion[i][k].bpPoint) bpRegion[svs[i].chr2].push_back(svRegion[i][k]);
+	else bpRegion[svs[i].chr].push_back(svRegion[i][k]);
+      }
+    }
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
       // Sort breakpoint regions
       std::sort(bpRegion[refIndex].begin(), bpRegion[refIndex].end(), SortBp<BpRegion>());
     }
   }
 
+  template<typename TConfig, typename TSV>
+  inline bool
+  _coverageWindows(TConfig const& c, TSV const& sv, int32_t const tlen, int32_t* win) {
+    // Small or large SV
+    bool smallSV = false;
+    int32_t halfSize = (sv.svEnd - sv.svStart)/2;
+    if ((_translocation(sv.svt)) || (sv.svt == 4)) {
+      halfSize = 500;
+      smallSV = true;
+    } else {
+      if ((sv.svEnd - sv.svStart) <= c.indelsize) smallSV = true;
+    }
+
+    // Left region
+    win[0] = std::max(sv.svStart - halfSize, 0);
+    win[1] = sv.svStart;
+
+    // Actual SV
+    win[2] = sv.svStart;
+    win[3] = sv.svEnd;
+    if ((_translocation(sv.svt)) || (sv.svt == 4)) {
+      win[2] = std::max(sv.svStart - halfSize, 0);
+      win[3] = std::min(sv.svStart + halfSize, tlen);
+    }
+
+    // Right region
+    win[4] = sv.svEnd;
+    win[5] = std::min(sv.svEnd + halfSize, tlen);
+    if ((_translocation(sv.svt)) || (sv.svt == 4)) {
+      win[4] = sv.svStart;
+      win[5] = std::min(sv.svStart + halfSize, tlen);
+    }
+
+    // Clip to chromosome, empty windows collapse to their start
+    for(uint32_t k = 0; k < 6; k += 2) {
+      win[k] = std::min(win[k], tlen);
+      win[k+1] = std::max(win[k], std::min(win[k+1], tlen));
+    }
+    return smallSV;
+  }
+
+  template<typename TCoverage>
+  inline void
+  _cumulativeCoverage(TCoverage const& covBases, TCoverage const& covFragment, std::vector<int32_t> const& bounds, std::vector<uint64_t>& cumBases, std::vector<uint64_t>& cumFragment) {
+    // One sweep, cumulative coverage left of each (sorted) window boundary
+    cumBases.resize(bounds.size());
+    cumFragment.resize(bounds.size());
+    uint64_t sumBases = 0;
+    uint64_t sumFragment = 0;
+    uint32_t k = 0;
+    for(uint32_t i = 0; i < bounds.size(); ++i) {
+      for(; k < (uint32_t) bounds[i]; ++k) {
+	sumBases += covBases[k];
+	sumFragment += covFragment[k];
+      }
+      cumBases[i] = sumBases;
+      cumFragment[i] = sumFragment;
+    }
+  }
+
   template<typename TConfig, typename TSampleLibrary, typename TSVs, typename TCoverageCount, typename TCountMap, typename TSpanMap>
   inline void
   annotateCoverage(TConfig& c, TSampleLibrary& sampleLib, TSVs& svs, TCoverageCount& covCount, TCountMap& countMap, TSpanMap& spanMap)
@@ -296,6 +693,33 @@ namespace torali {
     
     // Generate probes
     _generateProbes(c, hdr[0], svs, refProbeArr, consProbeArr, bpRegion, svOnChr);
+
+    // Probe seeds
+    typedef std::vector<ProbeSeeds> TSeeds;
+    typedef std::vector<TSeeds> TBreakSeeds;
+    TBreakSeeds refSeedArr(2, TSeeds(svs.size()));
+    TBreakSeeds consSeedArr(2, TSeeds(svs.size()));
+    DnaScore<int> simple(5, -4, -4, -4);
+    for(uint32_t k = 0; k < 2; ++k) {
+      for(uint32_t i = 0; i < svs.size(); ++i) {
+	if (!consProbeArr[k][i].empty()) _probeSeeds(consProbeArr[k][i], _probeThreshold(c, consProbeArr[k][i], simple), simple, consSeedArr[k][i]);
+	if (!refProbeArr[k][i].empty()) _probeSeeds(refProbeArr[k][i], _probeThreshold(c, refProbeArr[k][i], simple), simple, refSeedArr[k][i]);
+      }
+    }
+
+    // Spanning breakpoints and SVs by chromosome
+    typedef std::vector<SpanPoint> TSpanPoint;
+    typedef std::vector<TSpanPoint> TGenomicSpanPoint;
+    TGenomicSpanPoint spanPoint(hdr[0]->n_targets, TSpanPoint());
+    typedef std::vector<uint32_t> TSvIndex;
+    std::vector<TSvIndex> svByChr(hdr[0]->n_targets, TSvIndex());
+    for(uint32_t i = 0; i < svs.size(); ++i) {
+      svByChr[svs[i].chr].push_back(i);
+      if (svs[i].peSupport == 0) continue;
+      if (svs[i].svStart < (int32_t) hdr[0]->target_len[svs[i].chr]) spanPoint[svs[i].chr].push_back(SpanPoint(svs[i].svStart, svs[i].svt, svs[i].id, false));
+      if (svs[i].svEnd < (int32_t) hdr[0]->target_len[svs[i].chr2]) spanPoint[svs[i].chr2].push_back(SpanPoint(svs[i].svEnd, svs[i].svt, svs[i].id, true));
+    }
+    for(int32_t refIndex=0; refIndex < (int32_t) hdr[0]->n_targets; ++refIndex) std::sort(spanPoint[refIndex].begin(), spanPoint[refIndex].end(), SortBp<SpanPoint>());
   
     // Debug
     //for(uint32_t k = 0; k < 2; ++k) {
@@ -319,6 +743,9 @@ namespace torali {
       refAlignedSpanCount[file_c].resize(svs.size(), 0);
     }
     
+    // Genotype likelihoods for the junction read stop rule
+    BoLog<double> bl;
+
     // Dump file
     boost::iostreams::filtering_ostream dumpOut;
     if (c.hasDumpFile) {
@@ -336,6 +763,14 @@ namespace torali {
       typedef boost::unordered_map<std::size_t, bool> TClip;
       TClip clip;
       TClip cliptra;
+
+      // Split-reads and spanning pairs are sampled per SV side, genotypes are tracked per SV
+      typedef std::vector<JunctionReservoir> TSVReservoir;
+      std::vector<TSVReservoir> jctReservoir(2, TSVReservoir(svs.size()));
+      std::vector<TSVReservoir> spanReservoir(2, TSVReservoir(svs.size()));
+      std::vector<GenotypeTrack> genoTrack(svs.size());
+      uint32_t reservoirSize = (c.maxGenoReadCount + 1) / 2; // 0: no sampling
+      boost::random::mt19937 rng(file_c);
       
       // Iterate chromosomes
       for(int32_t refIndex=0; refIndex < (int32_t) hdr[file_c]->n_targets; ++refIndex) {
@@ -362,33 +797,6 @@ namespace torali {
 	TCoverage covFragment(hdr[file_c]->target_len[refIndex], 0);
 	TCoverage covBases(hdr[file_c]->target_len[refIndex], 0);
 	
-	// Flag breakpoint regions
-	typedef boost::dynamic_bitset<> TBitSet;
-	TBitSet bpOccupied(hdr[file_c]->target_len[refIndex]);
-	for(uint32_t i = 0; i < bpRegion[refIndex].size(); ++i) {
-	  for(int32_t k = bpRegion[refIndex][i].regionStart; k < bpRegion[refIndex][i].regionEnd; ++k) {
-	    bpOccupied[k] = 1;
-	  }
-	}
-	
-	// Flag spanning breakpoints
-	typedef std::vector<SpanPoint> TSpanPoint;
-	TSpanPoint spanPoint;
-	typedef boost::dynamic_bitset<> TBitSet;
-	TBitSet spanBp(hdr[file_c]->target_len[refIndex]);
-	for(typename TSVs::iterator itSV = svs.begin(); itSV != svs.end(); ++itSV) {
-	  if (itSV->peSupport == 0) continue;
-	  if ((itSV->chr == refIndex) && (itSV->svStart < (int32_t) hdr[file_c]->target_len[refIndex])) {
-	    spanBp[itSV->svStart] = 1;
-	    spanPoint.push_back(SpanPoint(itSV->svStart, itSV->svt, itSV->id));
-	  }
-	  if ((itSV->chr2 == refIndex) && (itSV->svEnd < (int32_t) hdr[file_c]->target_len[refIndex])) {
-	    spanBp[itSV->svEnd] = 1;
-	    spanPoint.push_back(SpanPoint(itSV->svEnd, itSV->svt, itSV->id));
-	  }
-	}
-	std::sort(spanPoint.begin(), spanPoint.end(), SortBp<SpanPoint>());
-      
 	// Count reads
 	hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, 0, hdr[file_c]->target_len[refIndex]);
 	bam1_t* rec = bam_init1();
@@ -431,45 +839,49 @@ namespace torali {
 	  
 	  // Check read length for junction annotation
 	  if (rec->core.l_qseq >= (2 * c.minimumFlankSize)) {
-	    bool bpvalid = false;
+	    // Fetch all relevant SVs, breakpoint regions are sorted by position
 	    int32_t rbegin = std::max(0, (int32_t) rec->core.pos - leadingSC);
-	    for(int32_t k = rbegin; ((k < (rec->core.pos + rec->core.l_qseq)) && (k < (int32_t) hdr[file_c]->target_len[refIndex])); ++k) {
-	      if (bpOccupied[k]) {
-		bpvalid = true;
-		break;
-	      }
-	    }
-	    if (bpvalid) {
-	      // Fetch all relevant SVs
-	      typename TBpRegion::iterator itBp = std::lower_bound(bpRegion[refIndex].begin(), bpRegion[refIndex].end(), BpRegion(rbegin), SortBp<BpRegion>());
+	    typename TBpRegion::iterator itBp = std::lower_bound(bpRegion[refIndex].begin(), bpRegion[refIndex].end(), BpRegion(rbegin), SortBp<BpRegion>());
+	    if ((itBp != bpRegion[refIndex].end()) && (rec->core.pos + rec->core.l_qseq >= itBp->bppos)) {
 	      for(; ((itBp != bpRegion[refIndex].end()) && (rec->core.pos + rec->core.l_qseq >= itBp->bppos)); ++itBp) {
-		if ((countMap[file_c][itBp->id].ref.size() + countMap[file_c][itBp->id].alt.size()) >= c.maxGenoReadCount) continue;
+		if (genoTrack[itBp->id].done) continue;
 		// Read spans breakpoint?
 		if ((hasSoftClip) || ((!hasClip) && (rec->core.pos + c.minimumFlankSize + itBp->homLeft <= itBp->bppos) &&  (rec->core.pos + rec->core.l_qseq >= itBp->bppos + c.minimumFlankSize + itBp->homRight))) {
-		  std::string consProbe = consProbeArr[itBp->bpPoint][itBp->id];
-		  std::string refProbe = refProbeArr[itBp->bpPoint][itBp->id];
+		  // Reservoir sampling, an informative sampled read replaces the previous read of its slot
+		  JunctionReservoir& jr = jctReservoir[itBp->bpPoint][itBp->id];
+		  int32_t slot = _reservoirSlot(jr, reservoirSize, rng);
+		  if (slot == -1) continue;
+
+		  std::string const& consProbe = consProbeArr[itBp->bpPoint][itBp->id];
+		  std::string const& refProbe = refProbeArr[itBp->bpPoint][itBp->id];
 		  
-		  // Get sequence
-		  std::string sequence;
-		  sequence.resize(rec->core.l_qseq);
-		  uint8_t* seqptr = bam_get_seq(rec);
-		  for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
-		  _adjustOrientation(sequence, itBp->bpPoint, itBp->svt);
+		  // Read sequence in probe orientation
+		  ReadSeq sequence(bam_get_seq(rec), 0, rec->core.l_qseq, _reverseOrientation(itBp->bpPoint, itBp->svt));
+
+		  // Seed filter, a probe without a shared seed scores below its threshold
+		  bool altSeed = _sharesSeed(sequence, consSeedArr[itBp->bpPoint][itBp->id]);
+		  bool refSeed = _sharesSeed(sequence, refSeedArr[itBp->bpPoint][itBp->id]);
+		  if ((!altSeed) && (!refSeed)) continue;
 		
 		  // Compute alignment to alternative haplotype
 		  typedef boost::multi_array<char, 2> TAlign;
 		  TAlign alignAlt;
-		  DnaScore<int> simple(5, -4, -4, -4);
 		  AlignConfig<true, false> semiglobal;
-		  int32_t scoreA = needle(consProbe, sequence, alignAlt, semiglobal, simple);
-		  int32_t scoreAltThreshold = (int32_t) (c.flankQuality * consProbe.size() * simple.match + (1.0 - c.flankQuality) * consProbe.size() * simple.mismatch);
-		  double scoreAlt = (double) scoreA / (double) scoreAltThreshold;
+		  double scoreAlt = 0;
+		  if (altSeed) {
+		    int32_t scoreA = needle(consProbe, sequence, alignAlt, semiglobal, simple);
+		    int32_t scoreAltThreshold = _probeThreshold(c, consProbe, simple);
+		    scoreAlt = (double) scoreA / (double) scoreAltThreshold;
+		  }
 		  
 		  // Compute alignment to reference haplotype
 		  TAlign alignRef;
-		  int32_t scoreR = needle(refProbe, sequence, alignRef, semiglobal, simple);
-		  int32_t scoreRefThreshold = (int32_t) (c.flankQuality * refProbe.size() * simple.match + (1.0 - c.flankQuality) * refProbe.size() * simple.mismatch);
-		  double scoreRef = (double) scoreR / (double) scoreRefThreshold;
+		  double scoreRef = 0;
+		  if (refSeed) {
+		    int32_t scoreR = needle(refProbe, sequence, alignRef, semiglobal, simple);
+		    int32_t scoreRefThreshold = _probeThreshold(c, refProbe, simple);
+		    scoreRef = (double) scoreR / (double) scoreRefThreshold;
+		  }
 		  
 		  // Any confident alignment?
 		  if ((scoreRef > 1) || (scoreAlt > 1)) {
@@ -494,16 +906,9 @@ namespace torali {
 			uint32_t rq = _getAlignmentQual(alignRef, quality);
 			if (rq >= c.minGenoQual) {
 			  uint8_t* hpptr = bam_aux_get(rec, "HP");
-#pragma omp critical
-			  {
-			    countMap[file_c][itBp->id].ref.push_back((uint8_t) std::min(rq, (uint32_t) rec->core.qual));
-			    if (hpptr) {
-			      c.isHaplotagged = true;
-			      int hap = bam_aux2i(hpptr);
-			      if (hap == 1) ++countMap[file_c][itBp->id].refh1;
-			      else ++countMap[file_c][itBp->id].refh2;
-			    }
-			  }
+			  uint8_t hap = 0;
+			  if (hpptr) hap = (bam_aux2i(hpptr) == 1) ? 1 : 2;
+			  _setJunctionRead(c, bl, JunctionRead(1, (uint8_t) std::min(rq, (uint32_t) rec->core.qual), hap), jr, slot, genoTrack[itBp->id]);
 			}
 		      }
 		    } else {
@@ -514,22 +919,18 @@ namespace torali {
 		      uint32_t aq = _getAlignmentQual(alignAlt, quality);
 		      if (aq >= c.minGenoQual) {
 			uint8_t* hpptr = bam_aux_get(rec, "HP");
+			uint8_t hap = 0;
+			if (hpptr) hap = (bam_aux2i(hpptr) == 1) ? 1 : 2;
+			_setJunctionRead(c, bl, JunctionRead(2, (uint8_t) std::min(aq, (uint32_t) rec->core.qual), hap), jr, slot, genoTrack[itBp->id]);
+			if (c.hasDumpFile) {
 #pragma omp critical
-			{
-			  if (c.hasDumpFile) {
+			  {
 			    std::string svid(_addID(itBp->svt));
 			    std::string padNumber = boost::lexical_cast<std::string>(itBp->id);
 			    padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
 			    svid += padNumber;
 			    dumpOut << svid << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tSR" << std::endl;
 			  }
-			  countMap[file_c][itBp->id].alt.push_back((uint8_t) std::min(aq, (uint32_t) rec->core.qual));
-			  if (hpptr) {
-			    c.isHaplotagged = true;
-			    int hap = bam_aux2i(hpptr);
-			    if (hap == 1) ++countMap[file_c][itBp->id].alth1;
-			    else ++countMap[file_c][itBp->id].alth2;
-			  }
 			}
 		      }
 		    }
@@ -602,30 +1003,19 @@ namespace torali {
 	      int32_t spanlen = 0.8 * outerISize;
 	      int32_t pbegin = std::min((int32_t) rec->core.pos, (int32_t) rec->core.mpos);
 	      int32_t st = pbegin + (outerISize - spanlen) / 2;
-	      bool spanvalid = false;
-	      for(int32_t i = st; ((i < (st + spanlen)) &&  (i < (int32_t) hdr[file_c]->target_len[refIndex])); ++i) {
-		if (spanBp[i]) {
-		  spanvalid = true;
-		  break;
-		}
-	      }
-	      if (spanvalid) {
-		// Fetch all relevant SVs
-		typename TSpanPoint::iterator itSpan = std::lower_bound(spanPoint.begin(), spanPoint.end(), SpanPoint(st), SortBp<SpanPoint>());
-		for(; ((itSpan != spanPoint.end()) && (st + spanlen >= itSpan->bppos)); ++itSpan) {
+	      // Fetch all relevant SVs if a breakpoint lies within [st, st + spanlen)
+	      typename TSpanPoint::iterator itSpan = std::lower_bound(spanPoint[refIndex].begin(), spanPoint[refIndex].end(), SpanPoint(st), SortBp<SpanPoint>());
+	      if ((itSpan != spanPoint[refIndex].end()) && (itSpan->bppos < st + spanlen)) {
+		for(; ((itSpan != spanPoint[refIndex].end()) && (st + spanlen >= itSpan->bppos)); ++itSpan) {
 		  // Account for reference bias
 		  if (++refAlignedSpanCount[file_c][itSpan->id] % 2) {
+		    JunctionReservoir& sr = spanReservoir[itSpan->bpPoint][itSpan->id];
+		    int32_t slot = _reservoirSlot(sr, reservoirSize, rng);
+		    if (slot == -1) continue;
 		    uint8_t* hpptr = bam_aux_get(rec, "HP");
-#pragma omp critical
-		    {
-		      spanMap[file_c][itSpan->id].ref.push_back(pairQuality);
-		      if (hpptr) {
-			c.isHaplotagged = true;
-			int hap = bam_aux2i(hpptr);
-			if (hap == 1) ++spanMap[file_c][itSpan->id].refh1;
-			else ++spanMap[file_c][itSpan->id].refh2;
-		      }
-		    }
+		    uint8_t hap = 0;
+		    if (hpptr) hap = (bam_aux2i(hpptr) == 1) ? 1 : 2;
+		    _storeRead(sr, slot, JunctionRead(1, pairQuality, hap));
 		  }
 		}
 	      }
@@ -638,42 +1028,34 @@ namespace torali {
 	      if (svt == -1) continue;
 	      
 	      // Spanning a breakpoint?
-	      bool spanvalid = false;
 	      int32_t pbegin = rec->core.pos;
 	      int32_t pend = std::min((int32_t) rec->core.pos + sampleLib[file_c].maxNormalISize, (int32_t) hdr[file_c]->target_len[refIndex]);
 	      if (rec->core.flag & BAM_FREVERSE) {
 		pbegin = std::max(0, (int32_t) rec->core.pos + rec->core.l_qseq - sampleLib[file_c].maxNormalISize);
 		pend = std::min((int32_t) rec->core.pos + rec->core.l_qseq, (int32_t) hdr[file_c]->target_len[refIndex]);
 	      }
-	      for(int32_t i = pbegin; i < pend; ++i) {
-		if (spanBp[i]) {
-		  spanvalid = true;
-		  break;
-		}
-	      }
-	      if (spanvalid) {
+	      typename TSpanPoint::iterator itSpan = std::lower_bound(spanPoint[refIndex].begin(), spanPoint[refIndex].end(), SpanPoint(pbegin), SortBp<SpanPoint>());
+	      if ((itSpan != spanPoint[refIndex].end()) && (itSpan->bppos < pend)) {
 		// Fetch all relevant SVs
-		typename TSpanPoint::iterator itSpan = std::lower_bound(spanPoint.begin(), spanPoint.end(), SpanPoint(pbegin), SortBp<SpanPoint>());
-		for(; ((itSpan != spanPoint.end()) && (pend >= itSpan->bppos)); ++itSpan) {
+		for(; ((itSpan != spanPoint[refIndex].end()) && (pend >= itSpan->bppos)); ++itSpan) {
 		  if (svt == itSpan->svt) {
-		    uint8_t* hpptr = bam_aux_get(rec, "HP");
+		    if (c.hasDumpFile) {
 #pragma omp critical
-		    {
-		      if (c.hasDumpFile) {
+		      {
 			std::string svid(_addID(itSpan->svt));
 			std::string padNumber = boost::lexical_cast<std::string>(itSpan->id);
 			padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
 			svid += padNumber;
 			dumpOut << svid << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tPE" << std::endl;
 		      }
-		      spanMap[file_c][itSpan->id].alt.push_back(pairQuality);
-		      if (hpptr) {
-			c.isHaplotagged = true;
-			int hap = bam_aux2i(hpptr);
-			if (hap == 1) ++spanMap[file_c][itSpan->id].alth1;
-			else ++spanMap[file_c][itSpan->id].alth2;
-		      }
 		    }
+		    JunctionReservoir& sr = spanReservoir[itSpan->bpPoint][itSpan->id];
+		    int32_t slot = _reservoirSlot(sr, reservoirSize, rng);
+		    if (slot == -1) continue;
+		    uint8_t* hpptr = bam_aux_get(rec, "HP");
+		    uint8_t hap = 0;
+		    if (hpptr) hap = (bam_aux2i(hpptr) == 1) ? 1 : 2;
+		    _storeRead(sr, slot, JunctionRead(2, pairQuality, hap));
 		  }
 		}
 	      }
@@ -687,56 +1069,46 @@ namespace torali {
 	clip.clear();
 	
 	// Assign fragment and base counts to SVs
-	for(uint32_t i = 0; i < svs.size(); ++i) {
-	  if (svs[i].chr == refIndex) {
-	    // Small or large SV
-	    bool smallSV = false;
-	    int32_t halfSize = (svs[i].svEnd - svs[i].svStart)/2;
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      halfSize = 500;
-	      smallSV = true;
-	    } else {
-	      if ((svs[i].svEnd - svs[i].svStart) <= c.indelsize) smallSV = true;
-	    }
-
-	    // Left region
-	    int32_t lstart = std::max(svs[i].svStart - halfSize, 0);
-	    int32_t lend = svs[i].svStart;
-	    int32_t covbase = 0;
-	    for(uint32_t k = lstart; ((k < (uint32_t) lend) && (k < hdr[0]->target_len[refIndex])); ++k) {
-	      if (smallSV) covbase += covBases[k];
-	      else covbase += covFragment[k];
-	    }
-	    covCount[file_c][svs[i].id].leftRC = covbase;
-
-	    // Actual SV
-	    covbase = 0;
-	    int32_t mstart = svs[i].svStart;
-	    int32_t mend = svs[i].svEnd;
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      mstart = std::max(svs[i].svStart - halfSize, 0);
-	      mend = std::min(svs[i].svStart + halfSize, (int32_t) hdr[0]->target_len[refIndex]);
-	    }
-	    for(uint32_t k = mstart; ((k < (uint32_t) mend) && (k < hdr[0]->target_len[refIndex])); ++k) {
-	      if (smallSV) covbase += covBases[k];
-	      else covbase += covFragment[k];
-	    }
-	    covCount[file_c][svs[i].id].rc = covbase;
-
-	    // Right region
-	    covbase = 0;
-	    int32_t rstart = svs[i].svEnd;
-	    int32_t rend = std::min(svs[i].svEnd + halfSize, (int32_t) hdr[0]->target_len[refIndex]);
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      rstart = svs[i].svStart;
-	      rend = std::min(svs[i].svStart + halfSize, (int32_t) hdr[0]->target_len[refIndex]);
-	    }
-	    for(uint32_t k = rstart; ((k < (uint32_t) rend) && (k < hdr[0]->target_len[refIndex])); ++k) {
-	      if (smallSV) covbase += covBases[k];
-	      else covbase += covFragment[k];
-	    }
-	    covCount[file_c][svs[i].id].rightRC = covbase;
+	int32_t tlen = hdr[file_c]->target_len[refIndex];
+	std::vector<int32_t> bounds;
+	for(uint32_t i = 0; i < svByChr[refIndex].size(); ++i) {
+	  int32_t win[6];
+	  _coverageWindows(c, svs[svByChr[refIndex][i]], tlen, win);
+	  bounds.insert(bounds.end(), win, win + 6);
+	}
+	std::sort(bounds.begin(), bounds.end());
+	bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+	std::vector<uint64_t> cumBases;
+	std::vector<uint64_t> cumFragment;
+	_cumulativeCoverage(covBases, covFragment, bounds, cumBases, cumFragment);
+	for(uint32_t i = 0; i < svByChr[refIndex].size(); ++i) {
+	  int32_t win[6];
+	  bool smallSV = _coverageWindows(c, svs[svByChr[refIndex][i]], tlen, win);
+	  std::vector<uint64_t> const& cum = smallSV ? cumBases : cumFragment;
+	  int32_t covbase[3];
+	  for(uint32_t k = 0; k < 3; ++k) {
+	    uint32_t idxStart = std::lower_bound(bounds.begin(), bounds.end(), win[2*k]) - bounds.begin();
+	    uint32_t idxEnd = std::lower_bound(bounds.begin(), bounds.end(), win[2*k+1]) - bounds.begin();
+	    covbase[k] = (int32_t) (cum[idxEnd] - cum[idxStart]);
 	  }
+	  covCount[file_c][svs[svByChr[refIndex][i]].id].leftRC = covbase[0];
+	  covCount[file_c][svs[svByChr[refIndex][i]].id].rc = covbase[1];
+	  covCount[file_c][svs[svByChr[refIndex][i]].id].rightRC = covbase[2];
+	}
+      }
+
+      // Sampled split-reads and spanning pairs
+      bool haplotagged = false;
+      for(uint32_t k = 0; k < 2; ++k) {
+	for(uint32_t i = 0; i < svs.size(); ++i) {
+	  if (_reservoirCounts(jctReservoir[k][i], countMap[file_c][i])) haplotagged = true;
+	  if (_reservoirCounts(spanReservoir[k][i], spanMap[file_c][i])) haplotagged = true;
+	}
+      }
+      if (haplotagged) {
+#pragma omp critical
+	{
+	  c.isHaplotagged = true;
 	}
       }
     }
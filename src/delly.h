@@ -64,15 +64,19 @@ namespace torali
     uint32_t maxReadSep;
     uint32_t minClip;
     uint32_t maxGenoReadCount;
+    uint32_t stableGenoQual;
+    uint32_t stableGenoCount;
     uint32_t minCliqueSize;
     float flankQuality;
     bool hasExcludeFile;
     bool hasVcfFile;
     bool isHaplotagged;
     bool hasDumpFile;
+    bool hasProbeCache;
     bool svtcmd;
     std::set<int32_t> svtset;
     DnaScore<int> aliscore;
+    std::string region;
     boost::filesystem::path outfile;
     boost::filesystem::path vcffile;
     boost::filesystem::path genome;
@@ -148,7 +152,7 @@ namespace torali
 
       // Sort and merge PE and SR calls
       mergeSort(svs, srSVs);
-    } else vcfParse(c, hdr, svs);
+    } else vcfParse(c, hdr, svs, c.region);
     // Clean-up
     bam_hdr_destroy(hdr);
     sam_close(samfile);
@@ -228,8 +232,10 @@ namespace torali
     boost::program_options::options_description geno("Genotyping options");
     geno.add_options()
       ("vcffile,v", boost::program_options::value<boost::filesystem::path>(&c.vcffile), "input VCF/BCF file for genotyping")
+      ("region", boost::program_options::value<std::string>(&c.region), "genotype only sites in region chr[:start-end], requires an indexed BCF")
       ("geno-qual,u", boost::program_options::value<uint16_t>(&c.minGenoQual)->default_value(5), "min. mapping quality for genotyping")
       ("dump,d", boost::program_options::value<boost::filesystem::path>(&c.dumpfile), "gzipped output file for SV-reads (optional)")
+      ("probe-cache", "cache REF/ALT probes in <vcffile>.probes.gz for re-genotyping")
       ;
 
     // Define hidden options
@@ -237,7 +243,9 @@ namespace torali
     hidden.add_options()
       ("input-file", boost::program_options::value< std::vector<boost::filesystem::path> >(&c.files), "input file")
       ("pruning,j", boost::program_options::value<uint32_t>(&c.graphPruning)->default_value(1000), "PE graph pruning cutoff")
-      ("max-geno-count,a", boost::program_options::value<uint32_t>(&c.maxGenoReadCount)->default_value(250), "max. number of reads aligned for SR genotyping")
+      ("max-geno-count,a", boost::program_options::value<uint32_t>(&c.maxGenoReadCount)->default_value(250), "max. number of split-reads and of spanning pairs sampled per SV [0: all]")
+      ("stable-geno-qual", boost::program_options::value<uint32_t>(&c.stableGenoQual)->default_value(0), "stop SR genotyping of an SV once GQ >= this value [0: off]")
+      ("stable-geno-count", boost::program_options::value<uint32_t>(&c.stableGenoCount)->default_value(50), "consecutive SR genotyping reads with stable GQ")
       ;
     
     boost::program_options::positional_options_description pos_args;
@@ -268,6 +276,10 @@ namespace torali
     if (vm.count("dump")) c.hasDumpFile = true;
     else c.hasDumpFile = false;
 
+    // Cache probes of the input site list?
+    if (vm.count("probe-cache")) c.hasProbeCache = true;
+    else c.hasProbeCache = false;
+
     // Clique size
     if (c.minCliqueSize < 2) c.minCliqueSize = 2;
     
@@ -361,10 +373,35 @@ namespace torali
 	std::cerr << "Fail to open index file " << c.vcffile.string() << std::endl;
 	return 1;
       }
+      if (vm.count("region")) {
+	hts_idx_t* idx = bcf_index_load(c.vcffile.string().c_str());
+	if (idx == NULL) {
+	  std::cerr << "Fail to open index for " << c.vcffile.string() << std::endl;
+	  bcf_hdr_destroy(hdr);
+	  bcf_close(ifile);
+	  return 1;
+	}
+	hts_itr_t* itr = bcf_itr_querys(idx, hdr, c.region.c_str());
+	if (itr == NULL) {
+	  std::cerr << "Region " << c.region << " is NOT present in " << c.vcffile.string() << std::endl;
+	  hts_idx_destroy(idx);
+	  bcf_hdr_destroy(hdr);
+	  bcf_close(ifile);
+	  return 1;
+	}
+	hts_itr_destroy(itr);
+	hts_idx_destroy(idx);
+      }
       bcf_hdr_destroy(hdr);
       bcf_close(ifile);
       c.hasVcfFile = true;
-    } else c.hasVcfFile = false;
+    } else {
+      c.hasVcfFile = false;
+      if (vm.count("region")) {
+	std::cerr << "Option --region requires an input VCF/BCF file for genotyping (-v)!" << std::endl;
+	return 1;
+      }
+    }
     
     // Check output directory
     if (!_outfileValid(c.outfile)) return 1;
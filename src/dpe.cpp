@@ -34,19 +34,21 @@
 #include "version.h"
 #include "util.h"
 #include "modvcf.h"
+#include "gtmatrix.h"
 
 using namespace torali;
 
 struct DoublePEConfig {
   int32_t wiggle;
   int32_t svsize;
+  bool hasGenotypeMatrix;
   float carconc;
   boost::filesystem::path outfile;
   boost::filesystem::path infile;
 };
 
 struct SVCarrier {
-  typedef boost::dynamic_bitset<> TBitSet;
+  typedef std::vector<uint64_t> TBitSet;
 
   int32_t start;
   int32_t end;
@@ -56,6 +58,20 @@ struct SVCarrier {
   SVCarrier(int32_t s, int32_t e, std::string i, TBitSet c) : start(s), end(e), id(i), carrier(c) {}
 };
 
+// Carrier concordance on 64-bit words
+inline float
+_carrierConcordance(SVCarrier::TBitSet const& c1, SVCarrier::TBitSet const& c2) {
+  int32_t common = 0;
+  int32_t all = 0;
+  for(uint32_t k = 0; k < c1.size(); ++k) {
+    common += __builtin_popcountll(c1[k] & c2[k]);
+    all += __builtin_popcountll(c1[k] | c2[k]);
+  }
+  float cc = 0;
+  if (all > 0) cc = (float) common / (float) all;
+  return cc;
+}
+
 struct DPERecord {
   int32_t start1;
   int32_t end1;
@@ -114,6 +130,16 @@ dpeRun(DoublePEConfig const& c)
   bcf_hdr_remove(hdr_out, BCF_HL_INFO, "CARCONC");
   bcf_hdr_append(hdr_out, "##INFO=<ID=CARCONC,Number=1,Type=Float,Description=\"Carrier concordance of the linked paired-end calls.\">");
   if (bcf_hdr_write(ofile, hdr_out) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
+
+  // Carrier genotypes from the genotype matrix side-car, otherwise built during this pass
+  GenotypeMatrixIndex gmi;
+  GenotypeMatrixWriter gmw;
+  bool gmRead = false;
+  bool gmWrite = false;
+  if (c.hasGenotypeMatrix) {
+    gmRead = _openGenotypeMatrix(c.infile, bcf_hdr_nsamples(hdr), nseq, gmi);
+    if (!gmRead) gmWrite = _openGenotypeMatrixWriter(c.infile, bcf_hdr_nsamples(hdr), gmw);
+  }
   
   // Parse BCF
   for(int32_t refIndex = 0; refIndex < nseq; ++refIndex) {
@@ -126,10 +152,18 @@ dpeRun(DoublePEConfig const& c)
     TCTs cts(maxCTs);
     hts_itr_t* itervcf = bcf_itr_querys(bcfidx, hdr, bcf_hdr_id2name(hdr, refIndex));
     bcf1_t* rec = bcf_init();
+    GenotypeMatrix gm(bcf_hdr_nsamples(hdr));
+    bool gmChr = ((gmRead) && (_readGenotypeMatrix(gmi, refIndex, gm)));
+    uint32_t site = 0;
     while (bcf_itr_next(ifile, itervcf, rec) >= 0) {
       // Fetch info
-      bcf_unpack(rec, BCF_UN_ALL);
-      bcf_get_format_int32(hdr, rec, "GT", &gt, &ngt);
+      bool gmSite = ((gmChr) && (site < gm.size()) && (gm.pos[site] == rec->pos));
+      if (gmSite) bcf_unpack(rec, BCF_UN_INFO);
+      else {
+	bcf_unpack(rec, BCF_UN_ALL);
+	int32_t ngtval = bcf_get_format_int32(hdr, rec, "GT", &gt, &ngt);
+	if (gmWrite) _addGenotypes(gm, rec->pos, gt, ngtval);
+      }
       bcf_get_info_int32(hdr, rec, "END", &svend, &nsvend);
       bcf_get_info_string(hdr, rec, "SVTYPE", &svt, &nsvt);
       std::string chr2Name("NA");
@@ -139,18 +173,23 @@ dpeRun(DoublePEConfig const& c)
 
       // Fetch carriers
       if ((*svend - rec->pos) < c.svsize) {
-	SVCarrier::TBitSet car(bcf_hdr_nsamples(hdr));
-	for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
-	  if ((bcf_gt_allele(gt[i*2]) != -1) && (bcf_gt_allele(gt[i*2 + 1]) != -1)) {
-	    int gt_type = bcf_gt_allele(gt[i*2]) + bcf_gt_allele(gt[i*2 + 1]);
-	    if (gt_type > 0) car[i] = true;
+	SVCarrier::TBitSet car((bcf_hdr_nsamples(hdr) + 63) / 64, 0);
+	if (gmSite) _carriers(gm, site, car);
+	else {
+	  for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
+	    if ((bcf_gt_allele(gt[i*2]) != -1) && (bcf_gt_allele(gt[i*2 + 1]) != -1)) {
+	      int gt_type = bcf_gt_allele(gt[i*2]) + bcf_gt_allele(gt[i*2 + 1]);
+	      if (gt_type > 0) car[i / 64] |= ((uint64_t) 1 << (i % 64));
+	    }
 	  }
 	}
 	cts[(int32_t) ict].push_back(SVCarrier(rec->pos, *svend, rec->d.id, car));
       }
+      ++site;
     }
     bcf_destroy(rec);
     hts_itr_destroy(itervcf);
+    if (gmWrite) _appendGenotypeMatrix(gmw, refIndex, gm);
 
     // Process SVs
     typedef std::vector<DPERecord> Tdper;
@@ -161,21 +200,38 @@ dpeRun(DoublePEConfig const& c)
       if (!cts[i].empty()) {
 	for(int32_t j = i+1; j<maxCTs; ++j) {
 	  if (!cts[j].empty()) {
-	    // Compare these 2 CTs
-	    typedef std::vector<int32_t> TJPCount;
-	    TJPCount jpc(cts[j].size(), 0);
-	    typedef std::map<std::pair<int32_t, int32_t>, float> TScoreMap;
-	    TScoreMap scm;
+	    // Compare these 2 CTs, candidates start in (start - wiggle, end] or end in [start, end + wiggle)
+	    std::vector<std::pair<int32_t, int32_t> > byStart(cts[j].size());
+	    std::vector<std::pair<int32_t, int32_t> > byEnd(cts[j].size());
+	    for(int32_t jp = 0; jp < (int32_t) cts[j].size(); ++jp) {
+	      byStart[jp] = std::make_pair(cts[j][jp].start, jp);
+	      byEnd[jp] = std::make_pair(cts[j][jp].end, jp);
+	    }
+	    sort(byStart.begin(), byStart.end());
+	    sort(byEnd.begin(), byEnd.end());
+	    std::vector<int32_t> bestIP(cts[j].size(), -1);
+	    std::vector<float> bestIPCC(cts[j].size(), -1);
+	    std::vector<int32_t> ipJP(cts[i].size(), -1);
+	    std::vector<float> ipCC(cts[i].size(), -1);
+	    std::vector<int32_t> cand;
 	    for(int32_t ip = 0; ip < (int32_t) cts[i].size(); ++ip) {
+	      cand.clear();
+	      typedef std::vector<std::pair<int32_t, int32_t> >::const_iterator TPosIter;
+	      TPosIter itPos = std::upper_bound(byStart.begin(), byStart.end(), std::make_pair(cts[i][ip].start - c.wiggle, std::numeric_limits<int32_t>::max()));
+	      for(; ((itPos != byStart.end()) && (itPos->first <= cts[i][ip].end)); ++itPos) cand.push_back(itPos->second);
+	      itPos = std::lower_bound(byEnd.begin(), byEnd.end(), std::make_pair(cts[i][ip].start, std::numeric_limits<int32_t>::min()));
+	      for(; ((itPos != byEnd.end()) && (itPos->first < cts[i][ip].end + c.wiggle)); ++itPos) cand.push_back(itPos->second);
+	      sort(cand.begin(), cand.end());
+	      cand.erase(std::unique(cand.begin(), cand.end()), cand.end());
+
+	      // Best concordant partner, ties go to the first record
 	      int32_t bestJP = -1;
 	      float bestCC = -1;
-	      for(int32_t jp = 0; jp < (int32_t) cts[j].size(); ++jp) {
+	      for(uint32_t idx = 0; idx < cand.size(); ++idx) {
+		int32_t jp = cand[idx];
 		if ((cts[i][ip].end < cts[j][jp].start) || (cts[j][jp].end < cts[i][ip].start)) continue;
 		if (((cts[i][ip].start - c.wiggle < cts[j][jp].start) && (cts[j][jp].start < cts[i][ip].end) && (cts[i][ip].end - c.wiggle < cts[j][jp].end)) || ((cts[j][jp].start - c.wiggle < cts[i][ip].start) && (cts[i][ip].start < cts[j][jp].end) && (cts[j][jp].end - c.wiggle < cts[i][ip].end))) {
-		  int32_t common = (cts[i][ip].carrier & cts[j][jp].carrier).count();
-		  int32_t all = (cts[i][ip].carrier | cts[j][jp].carrier).count();
-		  float cc = 0;
-		  if (all > 0) cc = (float) common / (float) all;
+		  float cc = _carrierConcordance(cts[i][ip].carrier, cts[j][jp].carrier);
 		  if ((cc >= c.carconc) && (cc > bestCC)) {
 		    bestJP = jp;
 		    bestCC = cc;
@@ -183,26 +239,20 @@ dpeRun(DoublePEConfig const& c)
 		}
 	      }
 	      if (bestJP >= 0) {
-		scm.insert(std::make_pair(std::make_pair(ip, bestJP), bestCC));
-		++jpc[bestJP];
-	      }
-	    }
-	    for(TScoreMap::iterator scmIt = scm.begin(); scmIt != scm.end(); ++scmIt) {
-	      int32_t ip = scmIt->first.first;
-	      int32_t jp = scmIt->first.second;
-	      float cc = scmIt->second;
-	      bool savePair = true;
-	      if (jpc[jp] > 1) {
-		for(TScoreMap::iterator scmSec = scm.begin(); scmSec != scm.end(); ++scmSec) {
-		  if ((ip != scmSec->first.first) && (jp == scmSec->first.second)) {
-		    if ((cc < scmSec->second) || ((cc == scmSec->second) && (ip > scmSec->first.first))) {
-		      savePair = false;
-		      break;
-		    }
-		  }
+		ipJP[ip] = bestJP;
+		ipCC[ip] = bestCC;
+		if ((bestIP[bestJP] == -1) || (bestCC > bestIPCC[bestJP])) {
+		  bestIP[bestJP] = ip;
+		  bestIPCC[bestJP] = bestCC;
 		}
 	      }
-	      if (savePair) {
+	    }
+
+	    // Keep the most concordant pair per partner
+	    for(int32_t ip = 0; ip < (int32_t) cts[i].size(); ++ip) {
+	      int32_t jp = ipJP[ip];
+	      if ((jp >= 0) && (bestIP[jp] == ip)) {
+		float cc = ipCC[ip];
 		dper.push_back(DPERecord(cts[i][ip].start, cts[i][ip].end, cts[j][jp].start, cts[j][jp].end, cc, cts[i][ip].id, cts[j][jp].id));
 		if (!svIds.insert(cts[i][ip].id).second) std::cerr << "SV already exists!" << std::endl;
 		if (!svIds.insert(cts[j][jp].id).second) std::cerr << "SV already exists!" << std::endl;
@@ -213,16 +263,25 @@ dpeRun(DoublePEConfig const& c)
       }
     }
 
-    
+    // Linked records by SV id
+    typedef boost::unordered_map<std::string, std::vector<int32_t> > TIdDper;
+    TIdDper idDper;
+    for(int32_t i = 0; i < (int32_t) dper.size(); ++i) {
+      idDper[dper[i].id1].push_back(i);
+      if (dper[i].id2 != dper[i].id1) idDper[dper[i].id2].push_back(i);
+    }
+
     hts_itr_t* ivcf = bcf_itr_querys(bcfidx, hdr, bcf_hdr_id2name(hdr, refIndex));
     bcf1_t* r = bcf_init();
     while (bcf_itr_next(ifile, ivcf, r) >= 0) {
-      bcf_unpack(r, BCF_UN_ALL);
+      bcf_unpack(r, BCF_UN_INFO);
       bcf_get_info_int32(hdr, r, "END", &svend, &nsvend);
       std::string id = std::string(r->d.id);
-      if (svIds.find(id) != svIds.end()) {
+      TIdDper::const_iterator itId = idDper.find(id);
+      if (itId != idDper.end()) {
 	// Find matching DPERecord
-	for(int32_t i = 0; i < (int32_t) dper.size(); ++i) {
+	for(uint32_t k = 0; k < itId->second.size(); ++k) {
+	  int32_t i = itId->second[k];
 	  if (((dper[i].id1 == id) && (dper[i].start1 == r->pos) && (dper[i].end1 == *svend)) || ((dper[i].id2 == id) && (dper[i].start2 == r->pos) && (dper[i].end2 == *svend))) {
 
 	    std::string linkid = dper[i].id1 + "," + dper[i].id2;
@@ -259,6 +318,7 @@ dpeRun(DoublePEConfig const& c)
     hts_itr_destroy(ivcf);    
   }
   if (nseq) free(seqnames);
+  if (gmWrite) _closeGenotypeMatrixWriter(gmw);
 
   // Close output BCF
   bcf_hdr_destroy(hdr_out);
@@ -297,6 +357,7 @@ int main(int argc, char **argv) {
     ("svsize,s", boost::program_options::value<int32_t>(&c.svsize)->default_value(50000), "max. SV size")
     ("carconc,c", boost::program_options::value<float>(&c.carconc)->default_value(0.75), "min. carrier concordance")
     ("outfile,f", boost::program_options::value<boost::filesystem::path>(&c.outfile)->default_value("complexSV.bcf"), "complex SV output file")
+    ("gt-matrix", "cache carrier genotypes in <deldup.bcf>.gtm for re-runs")
     ;
 
   // Define hidden options
@@ -318,6 +379,9 @@ int main(int argc, char **argv) {
   boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(cmdline_options).positional(pos_args).run(), vm);
   boost::program_options::notify(vm);
 
+  // Genotype matrix side-car
+  if (vm.count("gt-matrix")) c.hasGenotypeMatrix = true;
+  else c.hasGenotypeMatrix = false;
 
   // Check command line arguments
   if ((vm.count("help")) || (!vm.count("input-file"))) { 
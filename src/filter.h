@@ -34,6 +34,10 @@
 #include <zlib.h>
 #include <stdio.h>
 
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
 #include "tags.h"
 #include "version.h"
 #include "util.h"
@@ -63,6 +67,232 @@ struct FilterConfig {
   boost::filesystem::path vcffile;
 };
 
+// Header lookups and scratch buffers resolved once per filter run (one plan per thread)
+struct FilterPlan {
+  bool germline;
+  int32_t idGT;
+  int32_t idGQ;
+  int32_t idRC;
+  int32_t idRCL;
+  int32_t idRCR;
+  int32_t idDV;
+  int32_t idDR;
+  int32_t idRV;
+  int32_t idRR;
+  std::vector<uint8_t> role;
+  std::vector<int32_t> samples;
+  std::vector<float> rcControl;
+  std::vector<float> rcTumor;
+  std::vector<float> rcAlt;
+  std::vector<float> rRefVar;
+  std::vector<float> rAltVar;
+  std::vector<float> gqRef;
+  std::vector<float> gqAlt;
+
+  // VCF fields
+  int32_t nsvend;
+  int32_t* svend;
+  int32_t nsvt;
+  char* svt;
+  int32_t ninslen;
+  int32_t* inslen;
+
+  FilterPlan() : germline(false), idGT(-1), idGQ(-1), idRC(-1), idRCL(-1), idRCR(-1), idDV(-1), idDR(-1), idRV(-1), idRR(-1), nsvend(0), svend(NULL), nsvt(0), svt(NULL), ninslen(0), inslen(NULL) {}
+
+  inline void clear() {
+    rcControl.clear();
+    rcTumor.clear();
+    rcAlt.clear();
+    rRefVar.clear();
+    rAltVar.clear();
+    gqRef.clear();
+    gqAlt.clear();
+  }
+};
+
+template<typename TFilterConfig>
+inline void
+_compileFilterPlan(TFilterConfig const& c, bcf_hdr_t const* hdr, FilterPlan& fp) {
+  fp.germline = (c.filter == "germline");
+  fp.idGT = bcf_hdr_id2int(hdr, BCF_DT_ID, "GT");
+  fp.idGQ = bcf_hdr_id2int(hdr, BCF_DT_ID, "GQ");
+  fp.idRC = bcf_hdr_id2int(hdr, BCF_DT_ID, "RC");
+  fp.idRCL = bcf_hdr_id2int(hdr, BCF_DT_ID, "RCL");
+  fp.idRCR = bcf_hdr_id2int(hdr, BCF_DT_ID, "RCR");
+  fp.idDV = bcf_hdr_id2int(hdr, BCF_DT_ID, "DV");
+  fp.idDR = bcf_hdr_id2int(hdr, BCF_DT_ID, "DR");
+  fp.idRV = bcf_hdr_id2int(hdr, BCF_DT_ID, "RV");
+  fp.idRR = bcf_hdr_id2int(hdr, BCF_DT_ID, "RR");
+  _sampleRoles(hdr, fp.germline, c.controlSet, c.tumorSet, fp.role);
+
+  // Only control and tumor columns are decoded
+  fp.samples.clear();
+  for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
+    if (fp.role[i] != SAMPLE_OTHER) fp.samples.push_back(i);
+  }
+  uint32_t nsamples = bcf_hdr_nsamples(hdr);
+  fp.rcControl.reserve(nsamples);
+  fp.rcTumor.reserve(nsamples);
+  fp.rcAlt.reserve(nsamples);
+  fp.rRefVar.reserve(nsamples);
+  fp.rAltVar.reserve(nsamples);
+  fp.gqRef.reserve(nsamples);
+  fp.gqAlt.reserve(nsamples);
+}
+
+inline void
+_freeFilterPlan(FilterPlan& fp) {
+  if (fp.svend != NULL) free(fp.svend);
+  if (fp.svt != NULL) free(fp.svt);
+  if (fp.inslen != NULL) free(fp.inslen);
+}
+
+// Apply the somatic or germline rules to one record, true if the record is kept
+template<typename TFilterConfig>
+inline bool
+_filterRecord(TFilterConfig const& c, bcf_hdr_t* hdr, bcf_hdr_t* hdr_out, bcf1_t* rec, FilterPlan& fp) {
+  bcf_unpack(rec, BCF_UN_INFO);
+
+  // Check SV type
+  if (bcf_get_info_string(hdr, rec, "SVTYPE", &fp.svt, &fp.nsvt) <= 0) return false;
+  std::string svt(fp.svt);
+
+  // Check size and PASS
+  if ((c.filterForPass) && (bcf_has_filter(hdr, rec, const_cast<char*>("PASS"))!=1)) return false;
+  int32_t svlen = 1;
+  if (bcf_get_info_int32(hdr, rec, "END", &fp.svend, &fp.nsvend) > 0) svlen = *fp.svend - rec->pos;
+  else if ((svt != "INS") && (svt != "BND")) return false;
+  int32_t inslenVal = 0;
+  if (bcf_get_info_int32(hdr, rec, "INSLEN", &fp.inslen, &fp.ninslen) > 0) inslenVal = *fp.inslen;
+  if (svt == "INS") {
+    if ((inslenVal < c.minsize) || (inslenVal > c.maxsize)) return false;
+  } else if (svt != "BND") {
+    if ((svlen < c.minsize) || (svlen > c.maxsize)) return false;
+  }
+
+  // Check genotypes, decoding only the FORMAT fields and samples the active rules use
+  bcf_unpack(rec, BCF_UN_FMT);
+  bool precise = false;
+  if (bcf_get_info_flag(hdr, rec, "PRECISE", 0, 0) > 0) precise = true;
+  bcf_fmt_t* gt = bcf_get_fmt_id(rec, fp.idGT);
+  bcf_fmt_t* gq = NULL;
+  if (fp.germline) gq = bcf_get_fmt_id(rec, fp.idGQ);
+  bcf_fmt_t* rc = bcf_get_fmt_id(rec, fp.idRC);
+  bcf_fmt_t* rcl = bcf_get_fmt_id(rec, fp.idRCL);
+  bcf_fmt_t* rcr = bcf_get_fmt_id(rec, fp.idRCR);
+  if ((rcl == NULL) || (rcr == NULL)) rcl = rcr = NULL;
+  bcf_fmt_t* dr = NULL;
+  bcf_fmt_t* dv = NULL;
+  if (!precise) {
+    dr = bcf_get_fmt_id(rec, fp.idDR);
+    dv = bcf_get_fmt_id(rec, fp.idDV);
+  } else {
+    dr = bcf_get_fmt_id(rec, fp.idRR);
+    dv = bcf_get_fmt_id(rec, fp.idRV);
+  }
+  if ((gt == NULL) || (gt->n < 2) || (rc == NULL) || (dr == NULL) || (dv == NULL)) return false;
+  fp.clear();
+  std::vector<float>& rcControl = fp.rcControl;
+  std::vector<float>& rcTumor = fp.rcTumor;
+  std::vector<float>& rcAlt = fp.rcAlt;
+  std::vector<float>& rRefVar = fp.rRefVar;
+  std::vector<float>& rAltVar = fp.rAltVar;
+  std::vector<float>& gqRef = fp.gqRef;
+  std::vector<float>& gqAlt = fp.gqAlt;
+  uint32_t nCount = 0;
+  uint32_t tCount = 0;
+  uint32_t controlpass = 0;
+  uint32_t tumorpass = 0;
+  int32_t ac[2];
+  ac[0] = 0;
+  ac[1] = 0;
+  for (uint32_t j = 0; j < fp.samples.size(); ++j) {
+    int32_t i = fp.samples[j];
+    int32_t gt0 = bcf_gt_allele(_formatInt(gt, i, 0));
+    int32_t gt1 = bcf_gt_allele(_formatInt(gt, i, 1));
+    if ((gt0 != -1) && (gt1 != -1)) {
+      int gt_type = gt0 + gt1;
+      ++ac[gt0];
+      ++ac[gt1];
+      if ((fp.role[i] == SAMPLE_TUMOR) || (gt_type == 0) || (fp.germline)) {
+	// Read-depth and read support
+	float rcVal = _formatInt(rc, i, 0);
+	if (rcl != NULL) {
+	  int32_t rclr = _formatInt(rcl, i, 0) + _formatInt(rcr, i, 0);
+	  if (rclr != 0) rcVal /= (float) rclr;
+	}
+	int32_t refSupport = _formatInt(dr, i, 0);
+	int32_t altSupport = _formatInt(dv, i, 0);
+	float rVar = (float) altSupport / (float) (refSupport + altSupport);
+	if (fp.role[i] == SAMPLE_CONTROL) {
+	  // Control or population genomics
+	  ++nCount;
+	  if (gt_type == 0) {
+	    if (gq != NULL) gqRef.push_back(_formatFloat(gq, i, 0));
+	    rcControl.push_back(rcVal);
+	    rRefVar.push_back(rVar);
+	    if (rVar <= c.controlcont) ++controlpass;
+	  } else if ((fp.germline) && (gt_type >= 1)) {
+	    if (gq != NULL) gqAlt.push_back(_formatFloat(gq, i, 0));
+	    rcAlt.push_back(rcVal);
+	    rAltVar.push_back(rVar);
+	  }
+	} else {
+	  // Tumor
+	  ++tCount;
+	  rcTumor.push_back(rcVal);
+	  if ((rVar >= c.altaf) && (refSupport + altSupport >= c.coverage)) ++tumorpass;
+	}
+      } else ++nCount;
+    }
+  }
+  if (c.filter == "somatic") {
+    float genotypeRatio = (float) (nCount + tCount) / (float) (c.controlSet.size() + c.tumorSet.size());
+    if ((controlpass) && (tumorpass) && (controlpass == nCount) && (genotypeRatio >= c.ratiogeno)) {
+      float rccontrolmed = 0;
+      getMedian(rcControl.begin(), rcControl.end(), rccontrolmed);
+      float rctumormed = 0;
+      getMedian(rcTumor.begin(), rcTumor.end(), rctumormed);
+      float rdRatio = 1;
+      if (rccontrolmed != 0) rdRatio = rctumormed/rccontrolmed;
+      _remove_info_tag(hdr_out, rec, "RDRATIO");
+      bcf_update_info_float(hdr_out, rec, "RDRATIO", &rdRatio, 1);
+      _remove_info_tag(hdr_out, rec, "SOMATIC");
+      bcf_update_info_flag(hdr_out, rec, "SOMATIC", NULL, 1);
+      return true;
+    }
+  } else if (fp.germline) {
+    float genotypeRatio = (float) (nCount + tCount) / (float) (bcf_hdr_nsamples(hdr));
+    float rrefvarpercentile = 0;
+    if (!rRefVar.empty()) getPercentile(rRefVar, 0.9, rrefvarpercentile);
+    float raltvarmed = 0;
+    if (!rAltVar.empty()) getMedian(rAltVar.begin(), rAltVar.end(), raltvarmed);
+    float rccontrolmed = 0;
+    if (!rcControl.empty()) getMedian(rcControl.begin(), rcControl.end(), rccontrolmed);
+    float rcaltmed = 0;
+    if (!rcAlt.empty()) getMedian(rcAlt.begin(), rcAlt.end(), rcaltmed);
+    float rdRatio = 1;
+    if (rccontrolmed != 0) rdRatio = rcaltmed/rccontrolmed;
+    float gqaltmed = 0;
+    if (!gqAlt.empty()) getMedian(gqAlt.begin(), gqAlt.end(), gqaltmed);
+    float gqrefmed = 0;
+    if (!gqRef.empty()) getMedian(gqRef.begin(), gqRef.end(), gqrefmed);
+    float af = (float) ac[1] / (float) (ac[0] + ac[1]);
+
+    //std::cerr << bcf_hdr_id2name(hdr, rec->rid) << '\t' << (rec->pos + 1) << '\t' << *fp.svend << '\t' << rec->d.id << '\t' << svlen << '\t' << ac[1] << '\t' << af << '\t' << genotypeRatio << '\t' << svt << '\t' << precise << '\t' << rrefvarpercentile << '\t' << raltvarmed << '\t' << gqrefmed << '\t' << gqaltmed << '\t' << rdRatio << std::endl;
+
+    if ((af>0) && (gqaltmed >= c.gq) && (gqrefmed >= c.gq) && (raltvarmed >= c.altaf) && (genotypeRatio >= c.ratiogeno)) {
+      if ((svt=="DEL") && (rdRatio > c.rddel)) return false;
+      if ((svt=="DUP") && (rdRatio < c.rddup)) return false;
+      if ((svt!="DEL") && (svt!="DUP") && (rrefvarpercentile > 0)) return false;
+      _remove_info_tag(hdr_out, rec, "RDRATIO");
+      bcf_update_info_float(hdr_out, rec, "RDRATIO", &rdRatio, 1);
+      return true;
+    }
+  }
+  return false;
+}
+
 
 template<typename TFilterConfig>
 inline int
@@ -86,196 +316,62 @@ filterRun(TFilterConfig const& c) {
   }
   if (bcf_hdr_write(ofile, hdr_out) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
 
-  // VCF fields
-  int32_t nsvend = 0;
-  int32_t* svend = NULL;
-  int32_t nsvt = 0;
-  char* svt = NULL;
-  int32_t ninslen = 0;
-  int32_t* inslen = NULL;
-  int ngt = 0;
-  int32_t* gt = NULL;
-  int ngq = 0;
-  int32_t* gq = NULL;
-  float* gqf = NULL;
-  int nrc = 0;
-  int32_t* rc = NULL;
-  int nrcl = 0;
-  int32_t* rcl = NULL;
-  int nrcr = 0;
-  int32_t* rcr = NULL;
-  int ndv = 0;
-  int32_t* dv = NULL;
-  int ndr = 0;
-  int32_t* dr = NULL;
-  int nrv = 0;
-  int32_t* rv = NULL;
-  int nrr = 0;
-  int32_t* rr = NULL;
-  bool germline = false;
-  if (c.filter == "germline") germline = true;
+  // Index on the fly
+  std::string idxfile = c.outfile.string() + ".csi";
+  bool idxOnTheFly = (bcf_idx_init(ofile, hdr_out, 14, idxfile.c_str()) == 0);
+
+  // One filter plan per thread
+  int32_t nthreads = 1;
+#ifdef OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  std::vector<FilterPlan> fp(nthreads);
+  for(int32_t t = 0; t < nthreads; ++t) _compileFilterPlan(c, hdr, fp[t]);
 
   // Parse BCF
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
   std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Filtering VCF/BCF file" << std::endl;
-  bcf1_t* rec = bcf_init1();
-  while (bcf_read(ifile, hdr, rec) == 0) {
-    bcf_unpack(rec, BCF_UN_INFO);
-
-    // Check SV type
-    bcf_get_info_string(hdr, rec, "SVTYPE", &svt, &nsvt);
-
-    // Check size and PASS
-    bcf_get_info_int32(hdr, rec, "END", &svend, &nsvend);
-    bool pass = true;
-    if (c.filterForPass) pass = (bcf_has_filter(hdr, rec, const_cast<char*>("PASS"))==1);
-    int32_t svlen = 1;
-    if (svend != NULL) svlen = *svend - rec->pos;
-    int32_t inslenVal = 0;
-    if (bcf_get_info_int32(hdr, rec, "INSLEN", &inslen, &ninslen) > 0) inslenVal = *inslen;
-    if ((pass) && ((std::string(svt) == "BND") || ((std::string(svt) == "INS") && (inslenVal >= c.minsize) && (inslenVal <= c.maxsize)) || ((std::string(svt) != "BND") && (std::string(svt) != "INS") && (svlen >= c.minsize) && (svlen <= c.maxsize)))) {
-      // Check genotypes
-      bcf_unpack(rec, BCF_UN_ALL);
-      bool precise = false;
-      if (bcf_get_info_flag(hdr, rec, "PRECISE", 0, 0) > 0) precise = true;
-      bcf_get_format_int32(hdr, rec, "GT", &gt, &ngt);
-      if (_getFormatType(hdr, "GQ") == BCF_HT_INT) bcf_get_format_int32(hdr, rec, "GQ", &gq, &ngq);
-      else if (_getFormatType(hdr, "GQ") == BCF_HT_REAL) bcf_get_format_float(hdr, rec, "GQ", &gqf, &ngq);
-      bcf_get_format_int32(hdr, rec, "RC", &rc, &nrc);
-      if (_isKeyPresent(hdr, "RCL")) bcf_get_format_int32(hdr, rec, "RCL", &rcl, &nrcl);
-      if (_isKeyPresent(hdr, "RCR")) bcf_get_format_int32(hdr, rec, "RCR", &rcr, &nrcr);
-      bcf_get_format_int32(hdr, rec, "DV", &dv, &ndv);
-      bcf_get_format_int32(hdr, rec, "DR", &dr, &ndr);
-      bcf_get_format_int32(hdr, rec, "RV", &rv, &nrv);
-      bcf_get_format_int32(hdr, rec, "RR", &rr, &nrr);
-      std::vector<float> rcraw;
-      std::vector<float> rcControl;
-      std::vector<float> rcTumor;
-      std::vector<float> rcAlt;
-      std::vector<float> rRefVar;
-      std::vector<float> rAltVar;
-      std::vector<float> gqRef;
-      std::vector<float> gqAlt;
-      uint32_t nCount = 0;
-      uint32_t tCount = 0;
-      uint32_t controlpass = 0;
-      uint32_t tumorpass = 0;
-      int32_t ac[2];
-      ac[0] = 0;
-      ac[1] = 0;
-      for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
-	if ((bcf_gt_allele(gt[i*2]) != -1) && (bcf_gt_allele(gt[i*2 + 1]) != -1)) {
-	  int gt_type = bcf_gt_allele(gt[i*2]) + bcf_gt_allele(gt[i*2 + 1]);
-	  ++ac[bcf_gt_allele(gt[i*2])];
-	  ++ac[bcf_gt_allele(gt[i*2 + 1])];
-	  if ((germline) || (c.controlSet.find(hdr->samples[i]) != c.controlSet.end())) {
-	    // Control or population genomics
-	    ++nCount;
-	    if (gt_type == 0) {
-	      rcraw.push_back(rc[i]);
-	      if (_getFormatType(hdr, "GQ") == BCF_HT_INT) gqRef.push_back(gq[i]);
-	      else if (_getFormatType(hdr, "GQ") == BCF_HT_REAL) gqRef.push_back(gqf[i]);
-	      if ((rcl != NULL) && (rcr != NULL) && (rcl[i] + rcr[i] != 0)) rcControl.push_back((float) rc[i] / ((float) (rcl[i] + rcr[i])));
-	      else rcControl.push_back(rc[i]);
-	      float rVar = 0;
-	      if (!precise) rVar = (float) dv[i] / (float) (dr[i] + dv[i]);
-	      else rVar = (float) rv[i] / (float) (rr[i] + rv[i]);
-	      rRefVar.push_back(rVar);
-	      if (rVar <= c.controlcont) ++controlpass;
-	    } else if ((germline) && (gt_type >= 1)) {
-	      if (_getFormatType(hdr, "GQ") == BCF_HT_INT) gqAlt.push_back(gq[i]);
-	      else if (_getFormatType(hdr, "GQ") == BCF_HT_REAL) gqAlt.push_back(gqf[i]);
-	      if ((rcl != NULL) && (rcr != NULL) && (rcl[i] + rcr[i] != 0)) rcAlt.push_back((float) rc[i] / ((float) (rcl[i] + rcr[i])));
-	      else rcAlt.push_back(rc[i]);
-	      float rVar = 0;
-	      if (!precise) rVar = (float) dv[i] / (float) (dr[i] + dv[i]);
-	      else rVar = (float) rv[i] / (float) (rr[i] + rv[i]);
-	      rAltVar.push_back(rVar);
-	    }
-	  } else if ((!germline) && (c.tumorSet.find(hdr->samples[i]) != c.tumorSet.end())) {
-	    // Tumor
-	    ++tCount;
-	    if ((rcl != NULL) && (rcr != NULL) && (rcl[i] + rcr[i] != 0)) rcTumor.push_back((float) rc[i] / ((float) (rcl[i] + rcr[i])));
-	    else rcTumor.push_back(rc[i]);
-	    if (!precise) {
-	      if ((((float) dv[i] / (float) (dr[i] + dv[i])) >= c.altaf) && (dr[i] + dv[i] >= c.coverage)) ++tumorpass;
-	    } else {
-	      if ((((float) rv[i] / (float) (rr[i] + rv[i])) >= c.altaf) && (rr[i] + rv[i] >= c.coverage)) ++tumorpass;
-	    }
-	  }
-	}
-      }
-      if (c.filter == "somatic") {
-	float genotypeRatio = (float) (nCount + tCount) / (float) (c.controlSet.size() + c.tumorSet.size());
-	if ((controlpass) && (tumorpass) && (controlpass == nCount) && (genotypeRatio >= c.ratiogeno)) {
-	  float rccontrolmed = 0;
-	  getMedian(rcControl.begin(), rcControl.end(), rccontrolmed);
-	  float rctumormed = 0;
-	  getMedian(rcTumor.begin(), rcTumor.end(), rctumormed);
-	  float rdRatio = 1;
-	  if (rccontrolmed != 0) rdRatio = rctumormed/rccontrolmed;
-	  _remove_info_tag(hdr_out, rec, "RDRATIO");
-	  bcf_update_info_float(hdr_out, rec, "RDRATIO", &rdRatio, 1);
-	  _remove_info_tag(hdr_out, rec, "SOMATIC");
-	  bcf_update_info_flag(hdr_out, rec, "SOMATIC", NULL, 1);
-	  bcf_write1(ofile, hdr_out, rec);
-	}
-      } else if (c.filter == "germline") {
-	float genotypeRatio = (float) (nCount + tCount) / (float) (bcf_hdr_nsamples(hdr));
-	float rrefvarpercentile = 0;
-	if (!rRefVar.empty()) getPercentile(rRefVar, 0.9, rrefvarpercentile);
-	float raltvarmed = 0;
-	if (!rAltVar.empty()) getMedian(rAltVar.begin(), rAltVar.end(), raltvarmed);
-	float rccontrolmed = 0;
-	if (!rcControl.empty()) getMedian(rcControl.begin(), rcControl.end(), rccontrolmed);
-	float rcaltmed = 0;
-	if (!rcAlt.empty()) getMedian(rcAlt.begin(), rcAlt.end(), rcaltmed);
-	float rdRatio = 1;
-	if (rccontrolmed != 0) rdRatio = rcaltmed/rccontrolmed;
-	float gqaltmed = 0;
-	if (!gqAlt.empty()) getMedian(gqAlt.begin(), gqAlt.end(), gqaltmed);
-	float gqrefmed = 0;
-	if (!gqRef.empty()) getMedian(gqRef.begin(), gqRef.end(), gqrefmed);
-	float af = (float) ac[1] / (float) (ac[0] + ac[1]);
-	
-	//std::cerr << bcf_hdr_id2name(hdr, rec->rid) << '\t' << (rec->pos + 1) << '\t' << *svend << '\t' << rec->d.id << '\t' << svlen << '\t' << ac[1] << '\t' << af << '\t' << genotypeRatio << '\t' << std::string(svt) << '\t' << precise << '\t' << rrefvarpercentile << '\t' << raltvarmed << '\t' << gqrefmed << '\t' << gqaltmed << '\t' << rdRatio << std::endl;
-
-	if ((af>0) && (gqaltmed >= c.gq) && (gqrefmed >= c.gq) && (raltvarmed >= c.altaf) && (genotypeRatio >= c.ratiogeno)) {
-	  if ((std::string(svt)=="DEL") && (rdRatio > c.rddel)) continue;
-	  if ((std::string(svt)=="DUP") && (rdRatio < c.rddup)) continue;
-	  if ((std::string(svt)!="DEL") && (std::string(svt)!="DUP") && (rrefvarpercentile > 0)) continue;
-	  _remove_info_tag(hdr_out, rec, "RDRATIO");
-	  bcf_update_info_float(hdr_out, rec, "RDRATIO", &rdRatio, 1);
-	  bcf_write1(ofile, hdr_out, rec);
-	  
-	  
-	}
+  std::vector<bcf1_t*> batch(DELLY_BCF_BATCH * nthreads);
+  for(uint32_t k = 0; k < batch.size(); ++k) batch[k] = bcf_init1();
+  std::vector<uint8_t> keep(batch.size(), 0);
+  bool eof = false;
+  while (!eof) {
+    // Read batch
+    int32_t nrec = 0;
+    for(; nrec < (int32_t) batch.size(); ++nrec) {
+      if (bcf_read(ifile, hdr, batch[nrec]) != 0) {
+	eof = true;
+	break;
       }
     }
+
+    // Filter records
+#pragma omp parallel for default(shared) schedule(dynamic)
+    for(int32_t k = 0; k < nrec; ++k) {
+      int32_t t = 0;
+#ifdef OPENMP
+      t = omp_get_thread_num();
+#endif
+      keep[k] = _filterRecord(c, hdr, hdr_out, batch[k], fp[t]);
+    }
+
+    // Write in input order
+    for(int32_t k = 0; k < nrec; ++k) {
+      if (keep[k]) bcf_write1(ofile, hdr_out, batch[k]);
+    }
   }
-  bcf_destroy(rec);
+  for(uint32_t k = 0; k < batch.size(); ++k) bcf_destroy(batch[k]);
 
   // Clean-up
-  if (svend != NULL) free(svend);
-  if (svt != NULL) free(svt);
-  if (inslen != NULL) free(inslen);
-  if (gt != NULL) free(gt);
-  if (gq != NULL) free(gq);
-  if (gqf != NULL) free(gqf);
-  if (rc != NULL) free(rc);
-  if (rcl != NULL) free(rcl);
-  if (rcr != NULL) free(rcr);
-  if (dv != NULL) free(dv);
-  if (dr != NULL) free(dr);
-  if (rv != NULL) free(rv);
-  if (rr != NULL) free(rr);
+  for(int32_t t = 0; t < nthreads; ++t) _freeFilterPlan(fp[t]);
 
   // Close output VCF
+  if ((idxOnTheFly) && (bcf_idx_save(ofile) != 0)) idxOnTheFly = false;
   bcf_hdr_destroy(hdr_out);
   hts_close(ofile);
 
   // Build index
-  bcf_index_build(c.outfile.string().c_str(), 14);
+  if (!idxOnTheFly) bcf_index_build(c.outfile.string().c_str(), 14);
 
   // Close VCF
   bcf_hdr_destroy(hdr);
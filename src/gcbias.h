@@ -71,13 +71,10 @@ namespace torali
   inline double
   getPercentIdentity(bam1_t const* rec, char const* seq) {
     // Sequence
-    std::string sequence;
-    sequence.resize(rec->core.l_qseq);
-    uint8_t* seqptr = bam_get_seq(rec);
-    for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
+    ReadSeq sequence(bam_get_seq(rec), 0, rec->core.l_qseq, false);
 
     // Reference slice
-    std::string refslice = boost::to_upper_copy(std::string(seq + rec->core.pos, seq + lastAlignedPosition(rec)));
+    char const* refslice = seq + rec->core.pos;
 	      
     // Percent identity
     uint32_t rp = 0; // reference pointer
@@ -89,7 +86,7 @@ namespace torali
       if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL) || (bam_cigar_op(cigar[i]) == BAM_CDIFF)) {
 	// match or mismatch
 	for(std::size_t k = 0; k<bam_cigar_oplen(cigar[i]);++k) {
-	  if (sequence[sp] == refslice[rp]) ++matchCount;
+	  if (sequence[sp] == std::toupper(refslice[rp])) ++matchCount;
 	  else ++mismatchCount;
 	  ++sp;
 	  ++rp;
@@ -222,30 +219,13 @@ namespace torali
 
 	int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
 	if (rec->core.flag & BAM_FPAIRED) {
-	  // Clean-up the read store for identical alignment positions
-	  if (rec->core.pos > lastAlignedPos) {
-	    lastAlignedPosReads.clear();
-	    lastAlignedPos = rec->core.pos;
-	  }
-
-	  // Process pair
-	  if ((rec->core.pos < rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (lastAlignedPosReads.find(hash_string(bam_get_qname(rec))) == lastAlignedPosReads.end()))) {
-	    // First read
-	    lastAlignedPosReads.insert(hash_string(bam_get_qname(rec)));
-	    std::size_t hv = hash_pair(rec);
-	    mateMap[hv]= true;
-	    continue;
-	  } else {
-	    // Second read
-	    std::size_t hv = hash_pair_mate(rec);
-	    if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv])) continue; // Mate discarded
-	    mateMap[hv] = false;
-	  }
+	  int32_t fragStart = 0;
+	  int32_t isize = 0;
+	  if (!_pairedFragment(rec, c.mateFree, c.minQual, mateMap, lastAlignedPos, lastAlignedPosReads, fragStart, isize)) continue;
 	
 	  // Insert size filter
-	  int32_t isize = (rec->core.pos + alignmentLength(rec)) - rec->core.mpos;
 	  if ((li.minNormalISize < isize) && (isize < li.maxNormalISize)) {
-	    midPoint = rec->core.mpos + (int32_t) (isize/2);
+	    midPoint = fragStart + (int32_t) (isize/2);
 	  } else {
 	    if (rec->core.flag & BAM_FREVERSE) midPoint = rec->core.pos + alignmentLength(rec) - (c.meanisize / 2);
 	    else midPoint = rec->core.pos + (c.meanisize / 2);
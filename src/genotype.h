@@ -376,10 +376,7 @@ namespace torali
 	  // Read for genotyping?
 	  if (!genoMap.empty()) {
 	    // Get sequence
-	    std::string sequence;
-	    sequence.resize(rec->core.l_qseq);
-	    uint8_t* seqptr = bam_get_seq(rec);
-	    for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
+	    ReadSeq sequence(bam_get_seq(rec), 0, rec->core.l_qseq, false);
 
 	    // Genotype all SVs covered by this read
 	    for(typename TSVSeqHit::iterator git = genoMap.begin(); git != genoMap.end(); ++git) {
@@ -391,7 +388,7 @@ namespace torali
 	      int32_t spHit = git->second.second;
 
 	      // Require spanning reads
-	      std::string subseq;
+	      ReadSeq subseq(sequence);
 	      if (rpHit == gbp[svid].svStart) {
 		if (rec->core.flag & BAM_FREVERSE) {
 		  if (spHit < gbp[svid].svStartSuffix) continue;
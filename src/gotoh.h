@@ -15,41 +15,96 @@ namespace torali
   {
     typedef typename TScoreObject::TValue TScoreValue;
 
-    // DP variables
+    // DP variables, previous and current row
     std::size_t m = _size(a1, 1);
     std::size_t n = _size(a2, 1);
     std::vector<TScoreValue> s(n+1, 0);
     std::vector<TScoreValue> v(n+1, 0);
-    TScoreValue newhoz = 0;
-    TScoreValue prevsub = 0;
+    std::vector<TScoreValue> sNew(n+1, 0);
+    std::vector<TScoreValue> vNew(n+1, 0);
+    std::vector<TScoreValue> sub(n+1, 0);
     
-    // Create profile
-    typedef boost::multi_array<float, 2> TProfile;
-    TProfile p1;
-    TProfile p2;
+    // Create integer profile
+    CountProfile p1;
+    CountProfile p2;
     if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
-      _createProfile(a1, p1);
-      _createProfile(a2, p2);
+      _createProfile(a1, sc, p1);
+      _createProfile(a2, sc, p2);
+    }
+
+    // Initialization
+    s[0] = 0;
+    v[0] = -sc.inf;
+    for(std::size_t col = 1; col <= n; ++col) {
+      s[col] = _horizontalGap(ac, 0, m, sc.go + col * sc.ge);
+      v[col] = -sc.inf;
     }
 
     // DP
-    for(std::size_t row = 0; row <= m; ++row) {
+    for(std::size_t row = 1; row <= m; ++row) {
+      // Substitution scores of this row
+      for(std::size_t col = 1; col <= n; ++col) sub[col] = _score(a1, a2, p1, p2, row-1, col-1, sc);
+
+      // Diagonal and vertical moves only depend on the previous row
+      sNew[0] = _verticalGap(ac, 0, n, sc.go + row * sc.ge);
+      vNew[0] = sNew[0];
+      for(std::size_t col = 1; col <= n; ++col) {
+	vNew[col] = std::max(s[col] + _verticalGap(ac, col, n, sc.go + sc.ge), v[col] + _verticalGap(ac, col, n, sc.ge));
+	sNew[col] = std::max(s[col-1] + sub[col], vNew[col]);
+      }
+
+      // Horizontal moves
+      TScoreValue hozOpen = _horizontalGap(ac, row, m, sc.go + sc.ge);
+      TScoreValue hozExt = _horizontalGap(ac, row, m, sc.ge);
+      TScoreValue newhoz = -sc.inf;
+      for(std::size_t col = 1; col <= n; ++col) {
+	newhoz = std::max(sNew[col-1] + hozOpen, newhoz + hozExt);
+	sNew[col] = std::max(sNew[col], newhoz);
+      }
+      s.swap(sNew);
+      v.swap(vNew);
+    }
+
+    // Score
+    return s[n];
+  }
+
+  template<typename TAlign1, typename TAlign2, typename TAlignConfig, typename TScoreObject, typename TProfile, typename TScoreValue, typename TBitSet>
+  inline void
+  _gotohRows(TAlign1 const& a1, TAlign2 const& a2, TAlignConfig const& ac, TScoreObject const& sc, TProfile const& p1, TProfile const& p2, std::size_t const rowStart, std::size_t const rowEnd, std::vector<TScoreValue>& s, std::vector<TScoreValue>& v, bool const trace, TBitSet& bit1, TBitSet& bit2, TBitSet& bit3, TBitSet& bit4)
+  {
+    // DP variables
+    std::size_t m = _size(a1, 1);
+    std::size_t n = _size(a2, 1);
+    std::size_t mf = n+1;
+    TScoreValue newhoz = 0;
+    TScoreValue prevsub = 0;
+
+    // DP of rows [rowStart, rowEnd), trace bits are relative to rowStart
+    for(std::size_t row = rowStart; row < rowEnd; ++row) {
+      std::size_t off = (row - rowStart) * mf;
       for(std::size_t col = 0; col <= n; ++col) {
 	// Initialization
 	if ((row == 0) && (col == 0)) {
 	  s[0] = 0;
 	  v[0] = -sc.inf;
 	  newhoz = -sc.inf;
+	  if (trace) {
+	    bit1[off] = true;
+	    bit2[off] = true;
+	  }
 	} else if (row == 0) {
 	  v[col] = -sc.inf;
 	  s[col] = _horizontalGap(ac, 0, m, sc.go + col * sc.ge);
 	  newhoz = _horizontalGap(ac, 0, m, sc.go + col * sc.ge);
+	  if (trace) bit3[off + col] = true;
 	} else if (col == 0) {
 	  newhoz = -sc.inf;
 	  s[0] = _verticalGap(ac, 0, n, sc.go + row * sc.ge);
 	  if (row - 1 == 0) prevsub = 0;
 	  else prevsub = _verticalGap(ac, 0, n, sc.go + (row - 1) * sc.ge);
 	  v[0] = _verticalGap(ac, 0, n, sc.go + row * sc.ge);
+	  if (trace) bit4[off] = true;
 	} else {
 	  // Recursion
 	  TScoreValue prevhoz = newhoz;
@@ -59,14 +114,18 @@ namespace torali
 	  newhoz = std::max(s[col-1] + _horizontalGap(ac, row, m, sc.go + sc.ge), prevhoz + _horizontalGap(ac, row, m, sc.ge));
 	  v[col] = std::max(prevsub + _verticalGap(ac, col, n, sc.go + sc.ge), prevver + _verticalGap(ac, col, n, sc.ge));
 	  s[col] = std::max(std::max(prevprevsub + _score(a1, a2, p1, p2, row-1, col-1, sc), newhoz), v[col]);
+
+	  // Trace
+	  if (trace) {
+	    if (s[col] == newhoz) bit3[off + col] = true;
+	    else if (s[col] == v[col]) bit4[off + col] = true;
+	    if (newhoz != prevhoz + _horizontalGap(ac, row, m, sc.ge)) bit1[off + col] = true;
+	    if (v[col] != prevver + _verticalGap(ac, col, n, sc.ge)) bit2[off + col] = true;
+	  }
 	}
       }
     }
-
-    // Score
-    return s[n];
   }
-
   
   template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig, typename TScoreObject>
   inline int
@@ -77,92 +136,81 @@ namespace torali
     // DP variables
     std::size_t m = _size(a1, 1);
     std::size_t n = _size(a2, 1);
-    std::vector<TScoreValue> s(n+1, 0);
-    std::vector<TScoreValue> v(n+1, 0);
-    TScoreValue newhoz = 0;
-    TScoreValue prevsub = 0;
+    typedef std::vector<TScoreValue> TScoreRow;
+    TScoreRow s(n+1, 0);
+    TScoreRow v(n+1, 0);
     
-    // Trace Matrix
-    std::size_t mf = n+1;
-    typedef boost::dynamic_bitset<> TBitSet;
-    TBitSet bit1( (m+1) * (n+1), false);
-    TBitSet bit2( (m+1) * (n+1), false);
-    TBitSet bit3( (m+1) * (n+1), false);
-    TBitSet bit4( (m+1) * (n+1), false);
-
-    // Create profile
-    typedef boost::multi_array<float, 2> TProfile;
-    TProfile p1;
-    TProfile p2;
+    // Create integer profile
+    CountProfile p1;
+    CountProfile p2;
     if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
-      _createProfile(a1, p1);
-      _createProfile(a2, p2);
+      _createProfile(a1, sc, p1);
+      _createProfile(a2, sc, p2);
     }
 
-    // DP
-    for(std::size_t row = 0; row <= m; ++row) {
-      for(std::size_t col = 0; col <= n; ++col) {
-	// Initialization
-	if ((row == 0) && (col == 0)) {
-	  s[0] = 0;
-	  v[0] = -sc.inf;
-	  newhoz = -sc.inf;
-	  bit1[0] = true;
-	  bit2[0] = true;
-	} else if (row == 0) {
-	  v[col] = -sc.inf;
-	  s[col] = _horizontalGap(ac, 0, m, sc.go + col * sc.ge);
-	  newhoz = _horizontalGap(ac, 0, m, sc.go + col * sc.ge);
-	  bit3[col] = true;
-	} else if (col == 0) {
-	  newhoz = -sc.inf;
-	  s[0] = _verticalGap(ac, 0, n, sc.go + row * sc.ge);
-	  if (row - 1 == 0) prevsub = 0;
-	  else prevsub = _verticalGap(ac, 0, n, sc.go + (row - 1) * sc.ge);
-	  v[0] = _verticalGap(ac, 0, n, sc.go + row * sc.ge);
-	  bit4[row * mf] = true;
-	} else {
-	  // Recursion
-	  TScoreValue prevhoz = newhoz;
-	  TScoreValue prevver = v[col];
-	  TScoreValue prevprevsub = prevsub;
-	  prevsub = s[col];
-	  newhoz = std::max(s[col-1] + _horizontalGap(ac, row, m, sc.go + sc.ge), prevhoz + _horizontalGap(ac, row, m, sc.ge));
-	  v[col] = std::max(prevsub + _verticalGap(ac, col, n, sc.go + sc.ge), prevver + _verticalGap(ac, col, n, sc.ge));
-	  s[col] = std::max(std::max(prevprevsub + _score(a1, a2, p1, p2, row-1, col-1, sc), newhoz), v[col]);
-
-	  // Trace
-	  if (s[col] == newhoz) bit3[row * mf + col] = true;
-	  else if (s[col] == v[col]) bit4[row * mf + col] = true;
-	  if (newhoz != prevhoz + _horizontalGap(ac, row, m, sc.ge)) bit1[row * mf + col] = true;
-	  if (v[col] != prevver + _verticalGap(ac, col, n, sc.ge)) bit2[row * mf + col] = true;
+    // Trace blocks, large alignments keep only row checkpoints and recompute the trace per block
+    std::size_t mf = n+1;
+    std::size_t blockRows = _traceBlockRows(m, n);
+    std::size_t numBlocks = (m + blockRows) / blockRows;
+    typedef boost::dynamic_bitset<> TBitSet;
+    TBitSet bit1;
+    TBitSet bit2;
+    TBitSet bit3;
+    TBitSet bit4;
+    std::vector<TScoreRow> checkS(numBlocks);
+    std::vector<TScoreRow> checkV(numBlocks);
+    if (numBlocks > 1) {
+      for(std::size_t b = 0; b < numBlocks; ++b) {
+	if (b) {
+	  checkS[b] = s;
+	  checkV[b] = v;
 	}
+	_gotohRows(a1, a2, ac, sc, p1, p2, b * blockRows, std::min((b + 1) * blockRows, m + 1), s, v, false, bit1, bit2, bit3, bit4);
       }
     }
 
     // Trace-back using pointers
+    TScoreValue score = 0;
     std::size_t row = m;
     std::size_t col = n;
     char lastMatrix = 's';
     typedef std::vector<char> TTrace;
     TTrace btr;
-    while ((row>0) || (col>0)) {
-      if (lastMatrix == 's') {
-	if (bit3[row * mf + col]) lastMatrix = 'h';
-	else if (bit4[row * mf + col]) lastMatrix = 'v';
-	else {
-	  --row;
+    for(std::size_t b = numBlocks; b > 0; --b) {
+      std::size_t rowStart = (b - 1) * blockRows;
+      bit1.clear();
+      bit1.resize(blockRows * mf, false);
+      bit2.clear();
+      bit2.resize(blockRows * mf, false);
+      bit3.clear();
+      bit3.resize(blockRows * mf, false);
+      bit4.clear();
+      bit4.resize(blockRows * mf, false);
+      if (b > 1) {
+	s = checkS[b - 1];
+	v = checkV[b - 1];
+      }
+      _gotohRows(a1, a2, ac, sc, p1, p2, rowStart, std::min(rowStart + blockRows, m + 1), s, v, true, bit1, bit2, bit3, bit4);
+      if (b == numBlocks) score = s[n];
+      while (((row>0) || (col>0)) && (row >= rowStart)) {
+	std::size_t idx = (row - rowStart) * mf + col;
+	if (lastMatrix == 's') {
+	  if (bit3[idx]) lastMatrix = 'h';
+	  else if (bit4[idx]) lastMatrix = 'v';
+	  else {
+	    --row;
+	    --col;
+	    btr.push_back('s');
+	  }
+	} else if (lastMatrix == 'h') {
+	  if (bit1[idx]) lastMatrix = 's';
 	  --col;
-	  btr.push_back('s');
+	  btr.push_back('h');
+	} else if (lastMatrix == 'v') {
+	  if (bit2[idx]) lastMatrix = 's';
+	  --row;
+	  btr.push_back('v');
 	}
-      } else if (lastMatrix == 'h') {
-	if (bit1[row * mf + col]) lastMatrix = 's';
-	--col;
-	btr.push_back('h');
-      } else if (lastMatrix == 'v') {
-	if (bit2[row * mf + col]) lastMatrix = 's';
-	--row;
-	btr.push_back('v');
       }
     }
 
@@ -170,7 +218,7 @@ namespace torali
     _createAlignment(btr, a1, a2, align);
 
     // Score
-    return s[n];
+    return score;
   }
 
   template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig>
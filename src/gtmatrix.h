@@ -0,0 +1,265 @@
+#ifndef GTMATRIX_H
+#define GTMATRIX_H
+
+#include <iostream>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <htslib/vcf.h>
+#include "util.h"
+
+namespace torali
+{
+
+  // Bit-sliced genotypes of one chromosome, two bitplanes per sample: 00 hom. ref, 01 het., 10 hom. alt, 11 missing
+  struct GenotypeMatrix {
+    typedef std::vector<uint64_t> TWords;
+
+    uint32_t nsamples;
+    uint32_t nwords;
+    std::vector<int32_t> pos;
+    TWords lo;
+    TWords hi;
+
+    GenotypeMatrix() : nsamples(0), nwords(0) {}
+    explicit GenotypeMatrix(uint32_t const n) : nsamples(n), nwords((n + 63) / 64) {}
+
+    inline uint32_t size() const {
+      return pos.size();
+    }
+  };
+
+  // Side-car layout: key line, per-chromosome blocks (pos, lo, hi), index of (rid, nsites, offset), index offset and number of entries
+  struct GenotypeMatrixIndex {
+    uint32_t nsamples;
+    uint64_t indexOffset;
+    std::ifstream in;
+    std::vector<bool> present;
+    std::vector<uint32_t> nsites;
+    std::vector<uint64_t> offset;
+
+    GenotypeMatrixIndex() : nsamples(0), indexOffset(0) {}
+  };
+
+  struct GenotypeMatrixWriter {
+    bool success;
+    uint32_t nsamples;
+    std::string filename;
+    std::string tmpfile;
+    std::ofstream out;
+    std::vector<int32_t> rid;
+    std::vector<uint32_t> nsites;
+    std::vector<uint64_t> offset;
+
+    GenotypeMatrixWriter() : success(false), nsamples(0) {}
+  };
+
+  inline std::string
+  _genotypeMatrixFile(boost::filesystem::path const& bcffile) {
+    return bcffile.string() + ".gtm";
+  }
+
+  inline std::string
+  _genotypeMatrixKey(boost::filesystem::path const& bcffile, uint32_t const nsamples) {
+    return std::string("#delly genotype matrix\t") + boost::lexical_cast<std::string>(nsamples) + "\t" + _fileStamp(bcffile);
+  }
+
+  inline uint64_t
+  _genotypeMatrixBlockSize(uint32_t const nsites, uint32_t const nwords) {
+    return (uint64_t) nsites * (sizeof(int32_t) + 2 * nwords * sizeof(uint64_t));
+  }
+
+  // Append the genotypes of a record, gt as returned by bcf_get_format_int32
+  inline void
+  _addGenotypes(GenotypeMatrix& gm, int32_t const pos, int32_t const* gt, int32_t const ngtval) {
+    uint32_t site = gm.size();
+    gm.pos.push_back(pos);
+    gm.lo.resize((site + 1) * gm.nwords, 0);
+    gm.hi.resize((site + 1) * gm.nwords, 0);
+    uint64_t* lo = &gm.lo[site * gm.nwords];
+    uint64_t* hi = &gm.hi[site * gm.nwords];
+    for (uint32_t i = 0; i < gm.nsamples; ++i) {
+      uint64_t bit = ((uint64_t) 1 << (i % 64));
+      // Missing alleles and haploid calls (vector end) are not genotyped, as in the diploid gt_type > 0 carrier rule
+      if ((ngtval < (int32_t) (2 * gm.nsamples)) || (bcf_gt_allele(gt[i*2]) < 0) || (bcf_gt_allele(gt[i*2 + 1]) < 0)) {
+	lo[i / 64] |= bit;
+	hi[i / 64] |= bit;
+      } else {
+	int32_t nalt = (int32_t) (bcf_gt_allele(gt[i*2]) > 0) + (int32_t) (bcf_gt_allele(gt[i*2 + 1]) > 0);
+	if (nalt == 1) lo[i / 64] |= bit;
+	else if (nalt == 2) hi[i / 64] |= bit;
+      }
+    }
+  }
+
+  // Non-missing samples carrying at least one alternative allele
+  inline void
+  _carriers(GenotypeMatrix const& gm, uint32_t const site, GenotypeMatrix::TWords& car) {
+    car.resize(gm.nwords);
+    for(uint32_t k = 0; k < gm.nwords; ++k) car[k] = gm.lo[site * gm.nwords + k] ^ gm.hi[site * gm.nwords + k];
+  }
+
+  inline uint32_t
+  _carrierCount(GenotypeMatrix const& gm, uint32_t const site) {
+    uint32_t count = 0;
+    for(uint32_t k = 0; k < gm.nwords; ++k) count += __builtin_popcountll(gm.lo[site * gm.nwords + k] ^ gm.hi[site * gm.nwords + k]);
+    return count;
+  }
+
+  inline uint32_t
+  _alleleCount(GenotypeMatrix const& gm, uint32_t const site) {
+    uint32_t ac = 0;
+    for(uint32_t k = 0; k < gm.nwords; ++k) {
+      uint64_t lo = gm.lo[site * gm.nwords + k];
+      uint64_t hi = gm.hi[site * gm.nwords + k];
+      ac += __builtin_popcountll(lo & ~hi) + 2 * __builtin_popcountll(hi & ~lo);
+    }
+    return ac;
+  }
+
+  inline uint32_t
+  _missingCount(GenotypeMatrix const& gm, uint32_t const site) {
+    uint32_t count = 0;
+    for(uint32_t k = 0; k < gm.nwords; ++k) count += __builtin_popcountll(gm.lo[site * gm.nwords + k] & gm.hi[site * gm.nwords + k]);
+    return count;
+  }
+
+  // Restrict the matrix to a subset of samples
+  inline void
+  _subsetSamples(GenotypeMatrix const& gm, std::vector<uint32_t> const& samples, GenotypeMatrix& sub) {
+    sub = GenotypeMatrix(samples.size());
+    sub.pos = gm.pos;
+    sub.lo.assign(gm.size() * sub.nwords, 0);
+    sub.hi.assign(gm.size() * sub.nwords, 0);
+    for(uint32_t site = 0; site < gm.size(); ++site) {
+      for(uint32_t i = 0; i < samples.size(); ++i) {
+	uint32_t k = site * gm.nwords + samples[i] / 64;
+	uint64_t bit = ((uint64_t) 1 << (samples[i] % 64));
+	uint64_t subbit = ((uint64_t) 1 << (i % 64));
+	if (gm.lo[k] & bit) sub.lo[site * sub.nwords + i / 64] |= subbit;
+	if (gm.hi[k] & bit) sub.hi[site * sub.nwords + i / 64] |= subbit;
+      }
+    }
+  }
+
+  // Only the index is read, a stale, truncated or corrupt side-car is a cache miss
+  inline bool
+  _openGenotypeMatrix(boost::filesystem::path const& bcffile, uint32_t const nsamples, int32_t const nseq, GenotypeMatrixIndex& gmi) {
+    std::string filename = _genotypeMatrixFile(bcffile);
+    if (!boost::filesystem::exists(filename)) return false;
+    gmi.in.open(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    std::string line;
+    if ((!gmi.in.is_open()) || (!std::getline(gmi.in, line)) || (line != _genotypeMatrixKey(bcffile, nsamples))) return false;
+    uint64_t headerEnd = gmi.in.tellg();
+    gmi.in.seekg(0, std::ios_base::end);
+    uint64_t fileSize = gmi.in.tellg();
+    uint64_t trailer = sizeof(uint64_t) + sizeof(uint32_t);
+    if ((!gmi.in) || (fileSize < headerEnd + trailer)) return false;
+    uint32_t nentries = 0;
+    gmi.in.seekg(fileSize - trailer);
+    gmi.in.read((char*) &gmi.indexOffset, sizeof(uint64_t));
+    gmi.in.read((char*) &nentries, sizeof(uint32_t));
+    uint64_t entrySize = sizeof(int32_t) + sizeof(uint32_t) + sizeof(uint64_t);
+    if ((!gmi.in) || (gmi.indexOffset < headerEnd) || (gmi.indexOffset + (uint64_t) nentries * entrySize + trailer != fileSize)) return false;
+    gmi.nsamples = nsamples;
+    gmi.present.assign(nseq, false);
+    gmi.nsites.assign(nseq, 0);
+    gmi.offset.assign(nseq, 0);
+    gmi.in.seekg(gmi.indexOffset);
+    for(uint32_t k = 0; k < nentries; ++k) {
+      int32_t rid = -1;
+      uint32_t nsites = 0;
+      uint64_t offset = 0;
+      gmi.in.read((char*) &rid, sizeof(int32_t));
+      gmi.in.read((char*) &nsites, sizeof(uint32_t));
+      gmi.in.read((char*) &offset, sizeof(uint64_t));
+      if ((!gmi.in) || (rid < 0) || (rid >= nseq) || (offset < headerEnd) || (offset + _genotypeMatrixBlockSize(nsites, (nsamples + 63) / 64) > gmi.indexOffset)) return false;
+      gmi.present[rid] = true;
+      gmi.nsites[rid] = nsites;
+      gmi.offset[rid] = offset;
+    }
+    return true;
+  }
+
+  // Load the rows of one chromosome
+  inline bool
+  _readGenotypeMatrix(GenotypeMatrixIndex& gmi, int32_t const rid, GenotypeMatrix& gm) {
+    gm = GenotypeMatrix(gmi.nsamples);
+    if ((rid < 0) || (rid >= (int32_t) gmi.present.size()) || (!gmi.present[rid])) return false;
+    uint32_t nsites = gmi.nsites[rid];
+    gm.pos.resize(nsites);
+    gm.lo.resize((uint64_t) nsites * gm.nwords);
+    gm.hi.resize((uint64_t) nsites * gm.nwords);
+    gmi.in.clear();
+    gmi.in.seekg(gmi.offset[rid]);
+    if (nsites) {
+      gmi.in.read((char*) &gm.pos[0], nsites * sizeof(int32_t));
+      if (gm.nwords) {
+	gmi.in.read((char*) &gm.lo[0], gm.lo.size() * sizeof(uint64_t));
+	gmi.in.read((char*) &gm.hi[0], gm.hi.size() * sizeof(uint64_t));
+      }
+    }
+    if (!gmi.in) {
+      gm = GenotypeMatrix(gmi.nsamples);
+      return false;
+    }
+    return true;
+  }
+
+  // Written to a temporary file and renamed on close, concurrent readers never see a partial side-car
+  inline bool
+  _openGenotypeMatrixWriter(boost::filesystem::path const& bcffile, uint32_t const nsamples, GenotypeMatrixWriter& gmw) {
+    gmw.nsamples = nsamples;
+    gmw.filename = _genotypeMatrixFile(bcffile);
+    gmw.tmpfile = _sideCarTmpFile(gmw.filename);
+    gmw.out.open(gmw.tmpfile.c_str(), std::ios_base::out | std::ios_base::binary);
+    if (!gmw.out.is_open()) {
+      std::cerr << "Warning: Genotype matrix " << gmw.filename << " cannot be written!" << std::endl;
+      return false;
+    }
+    gmw.out << _genotypeMatrixKey(bcffile, nsamples) << '\n';
+    gmw.success = (bool) gmw.out;
+    return true;
+  }
+
+  inline void
+  _appendGenotypeMatrix(GenotypeMatrixWriter& gmw, int32_t const rid, GenotypeMatrix const& gm) {
+    if (!gmw.success) return;
+    gmw.rid.push_back(rid);
+    gmw.nsites.push_back(gm.size());
+    gmw.offset.push_back(gmw.out.tellp());
+    if (gm.size()) {
+      gmw.out.write((char const*) &gm.pos[0], gm.size() * sizeof(int32_t));
+      if (gm.nwords) {
+	gmw.out.write((char const*) &gm.lo[0], gm.lo.size() * sizeof(uint64_t));
+	gmw.out.write((char const*) &gm.hi[0], gm.hi.size() * sizeof(uint64_t));
+      }
+    }
+    if (!gmw.out) gmw.success = false;
+  }
+
+  inline void
+  _closeGenotypeMatrixWriter(GenotypeMatrixWriter& gmw) {
+    if (gmw.success) {
+      uint64_t indexOffset = gmw.out.tellp();
+      for(uint32_t k = 0; k < gmw.rid.size(); ++k) {
+	gmw.out.write((char const*) &gmw.rid[k], sizeof(int32_t));
+	gmw.out.write((char const*) &gmw.nsites[k], sizeof(uint32_t));
+	gmw.out.write((char const*) &gmw.offset[k], sizeof(uint64_t));
+      }
+      uint32_t nentries = gmw.rid.size();
+      gmw.out.write((char const*) &indexOffset, sizeof(uint64_t));
+      gmw.out.write((char const*) &nentries, sizeof(uint32_t));
+      gmw.out.close();
+      if (gmw.out.fail()) gmw.success = false;
+    } else gmw.out.close();
+    if ((!gmw.success) || (!_commitSideCar(gmw.tmpfile, gmw.filename))) {
+      std::remove(gmw.tmpfile.c_str());
+      std::cerr << "Warning: Genotype matrix " << gmw.filename << " cannot be written!" << std::endl;
+    }
+  }
+
+}
+
+#endif
@@ -27,6 +27,11 @@
 #include <boost/progress.hpp>
 #include <htslib/sam.h>
 #include <htslib/vcf.h>
+#include <htslib/bgzf.h>
+
+#ifdef OPENMP
+#include <omp.h>
+#endif
 
 #include "tags.h"
 #include "version.h"
@@ -54,23 +59,41 @@ struct MergeConfig {
   std::vector<boost::filesystem::path> files;
 };
 
+// Interval and the identity of its input record (file index, record ordinal, BGZF virtual offset or -1)
 struct IntervalScore {
   uint32_t start;
   uint32_t end;
   int32_t score;
+  uint32_t file_c;
+  uint32_t ordinal;
+  int64_t voffset;
   
-  IntervalScore(uint32_t s, uint32_t e, int32_t c) : start(s), end(e), score(c) {}
+  IntervalScore(uint32_t s, uint32_t e, int32_t c) : start(s), end(e), score(c), file_c(0), ordinal(0), voffset(-1) {}
+  IntervalScore(uint32_t s, uint32_t e, int32_t c, uint32_t f, uint32_t o, int64_t v) : start(s), end(e), score(c), file_c(f), ordinal(o), voffset(v) {}
 };
 
 template<typename TRecord>
 struct SortIScores : public std::binary_function<TRecord, TRecord, bool>
 {
   inline bool operator()(TRecord const& s1, TRecord const& s2) const {
-    return ((s1.start < s2.start) || ((s1.start == s2.start) && (s1.end < s2.end)));
+    if (s1.start != s2.start) return (s1.start < s2.start);
+    if (s1.end != s2.end) return (s1.end < s2.end);
+    if (s1.score != s2.score) return (s1.score < s2.score);
+    if (s1.file_c != s2.file_c) return (s1.file_c < s2.file_c);
+    return (s1.ordinal < s2.ordinal);
   }
 
 };
 
+// Order of the k-way merge of all input files
+template<typename TRecord>
+struct SortMergeOrder : public std::binary_function<TRecord, TRecord, bool>
+{
+  inline bool operator()(TRecord const& s1, TRecord const& s2) const {
+    return ((s1.start < s2.start) || ((s1.start == s2.start) && (s1.file_c < s2.file_c)) || ((s1.start == s2.start) && (s1.file_c == s2.file_c) && (s1.ordinal < s2.ordinal)));
+  }
+};
+
 template<typename TPos>
 double recOverlap(TPos const s1, TPos const e1, TPos const s2, TPos const e2) {
   if ((e1 < s2) || (s1 > e2)) return 0;
@@ -85,7 +108,7 @@ double recOverlap(TPos const s1, TPos const e1, TPos const s2, TPos const e2) {
 
 
 template<typename TGenomeIntervals, typename TContigMap>
-void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap& cMap, int32_t const svtin) {
+bool _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap& cMap, int32_t const svtin) {
   typedef typename TGenomeIntervals::value_type TIntervalScores;
   typedef typename TIntervalScores::value_type IntervalScore;
 
@@ -94,9 +117,24 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
   boost::progress_display show_progress( c.files.size() );
 
 
+  // One interval map per thread, input files are parsed in parallel
+  int32_t nthreads = 1;
+#ifdef OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  std::vector<TGenomeIntervals> iScoreTh(nthreads, TGenomeIntervals(iScore.size()));
   boost::unordered_map<int32_t, std::string> refmap;
-  for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-    ++show_progress;
+  bool success = true;
+#pragma omp parallel for default(shared) schedule(dynamic)
+  for(int32_t file_c = 0; file_c < (int32_t) c.files.size(); ++file_c) {
+    int32_t t = 0;
+#ifdef OPENMP
+    t = omp_get_thread_num();
+#endif
+#pragma omp critical
+    {
+      ++show_progress;
+    }
     htsFile* ifile = bcf_open(c.files[file_c].string().c_str(), "r");
     bcf_hdr_t* hdr = bcf_hdr_read(ifile);
     bcf1_t* rec = bcf_init();
@@ -109,7 +147,15 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
     char* ct = NULL;
     int32_t nsvt = 0;
     char* svt = NULL;
+    // Only BGZF offsets are seekable, plain gzip is also read through BGZF
+    bool seekable = (hts_get_format(ifile)->compression == bgzf);
+    uint32_t ordinal = 0;
+    int64_t voffset = (seekable) ? bgzf_tell(ifile->fp.bgzf) : -1;
     while (bcf_read(ifile, hdr, rec) == 0) {
+      // Record identity for the output pass
+      uint32_t recOrdinal = ordinal++;
+      int64_t recOffset = voffset;
+      if (seekable) voffset = bgzf_tell(ifile->fp.bgzf);
       bcf_unpack(rec, BCF_UN_INFO);
       // Check PASS
       bool pass = true;
@@ -126,7 +172,16 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
 
       // Correct size?
       std::string chrName(bcf_hdr_id2name(hdr, rec->rid));
-      uint32_t tid = cMap[chrName];
+      typename TContigMap::const_iterator itContig = cMap.find(chrName);
+      if (itContig == cMap.end()) {
+#pragma omp critical
+	{
+	  std::cerr << "Error: Chromosome " << chrName << " of " << c.files[file_c].string() << " is missing in the contig map!" << std::endl;
+	  success = false;
+	}
+	break;
+      }
+      uint32_t tid = itContig->second;
       uint32_t svStart = rec->pos;
       uint32_t svEnd = rec->pos + 2;
       if (bcf_get_info_int32(hdr, rec, "END", &svend, &nsvend) > 0) svEnd = *svend;
@@ -193,7 +248,7 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
       }
       // Store the interval
       //std::cerr << tid << ',' << svStart << ',' << svEnd << ',' << rec->qual << std::endl;
-      iScore[tid].push_back(IntervalScore(svStart, svEnd, rec->qual));
+      iScoreTh[t][tid].push_back(IntervalScore(svStart, svEnd, rec->qual, file_c, recOrdinal, recOffset));
     }
     if (svend != NULL) free(svend);
     if (inslen != NULL) free(inslen);
@@ -203,12 +258,26 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
     bcf_close(ifile);
     bcf_destroy(rec);
   }
+
+  // Collect intervals, sorted afterwards
+  for(int32_t t = 0; t < nthreads; ++t) {
+    for(uint32_t tid = 0; tid < iScore.size(); ++tid) iScore[tid].insert(iScore[tid].end(), iScoreTh[t][tid].begin(), iScoreTh[t][tid].end());
+  }
+  return success;
+}
+
+template<typename TIntervalScores>
+inline bool
+_intervalBeats(TIntervalScores const& iv, uint32_t const j, uint32_t const i) {
+  // Does interval j win the pairwise comparison against interval i (both in start/end sort order)?
+  if (iv[j].score != iv[i].score) return (iv[i].score < iv[j].score);
+  if (j < i) return ((iv[j].start < iv[i].start) || (iv[j].end < iv[i].end));
+  else return ((iv[i].start == iv[j].start) && (iv[i].end == iv[j].end));
 }
 
 template<typename TGenomeIntervals>
 void _processIntervalMap(MergeConfig const& c, TGenomeIntervals const& iScore, TGenomeIntervals& iSelected, int32_t const svtin) {
   typedef typename TGenomeIntervals::value_type TIntervalScores;
-  typedef typename TIntervalScores::value_type IntervalScore;
 
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
   std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Merging SVs" << std::endl;
@@ -217,40 +286,425 @@ void _processIntervalMap(MergeConfig const& c, TGenomeIntervals const& iScore, T
   unsigned int seqId = 0;
   for(typename TGenomeIntervals::const_iterator iG = iScore.begin(); iG != iScore.end(); ++iG, ++seqId) {
     ++show_progress;
-    typedef std::vector<bool> TIntervalSelector;
-    TIntervalSelector keepInterval;
-    keepInterval.resize(iG->size(), true);
-    typename TIntervalSelector::iterator iK = keepInterval.begin();
-    for(typename TIntervalScores::const_iterator iS = iG->begin(); iS != iG->end(); ++iS, ++iK) {
-      typename TIntervalScores::const_iterator iSNext = iS;
-      typename TIntervalSelector::iterator iKNext = iK;
-      ++iSNext; ++iKNext;
-      for(; iSNext != iG->end(); ++iSNext, ++iKNext) {
-	if (iSNext->start - iS->start > c.bpoffset) break;
-	else {
-	  if (((iSNext->end > iS->end) && (iSNext->end - iS->end < c.bpoffset)) || ((iSNext->end <= iS->end) &&(iS->end - iSNext->end < c.bpoffset))) {
-	    if ((_translocation(svtin)) || (recOverlap(iS->start, iS->end, iSNext->start, iSNext->end) >= c.recoverlap)) {
-	      if (iS->score < iSNext->score) *iK = false;
-	      else if (iSNext ->score < iS->score) *iKNext = false;
-	      else {
-		if (iS->start < iSNext->start) *iKNext = false;
-		else if (iS->end < iSNext->end) *iKNext = false;
-		else *iK = false;
-	      }
-	    }
+    TIntervalScores const& iv = *iG;
+
+    // Sweep over intervals sorted by start, active intervals (start within bpoffset) are ordered by end
+    typedef std::multimap<uint32_t, uint32_t> TActiveSet;
+    TActiveSet active;
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+    uint32_t first = 0;
+    for(uint32_t i = 0; i < iv.size(); ++i) {
+      // First record of a run of identical intervals, the earliest one in merge order
+      if ((iv[i].start != iv[first].start) || (iv[i].end != iv[first].end) || (iv[i].score != iv[first].score)) first = i;
+      for(; (hi < iv.size()) && (iv[hi].start - iv[i].start <= c.bpoffset); ++hi) active.insert(std::make_pair(iv[hi].end, hi));
+      for(; iv[i].start - iv[lo].start > c.bpoffset; ++lo) {
+	std::pair<typename TActiveSet::iterator, typename TActiveSet::iterator> range = active.equal_range(iv[lo].end);
+	for(typename TActiveSet::iterator itA = range.first; itA != range.second; ++itA) {
+	  if (itA->second == lo) {
+	    active.erase(itA);
+	    break;
 	  }
 	}
       }
-      if (*iK) iSelected[seqId].push_back(IntervalScore(iS->start, iS->end, iS->score));
+
+      // Candidates with an end within bpoffset
+      bool keep = true;
+      uint32_t endLow = (iv[i].end >= c.bpoffset) ? (iv[i].end - c.bpoffset + 1) : 0;
+      uint64_t endHigh = (uint64_t) iv[i].end + (uint64_t) c.bpoffset;
+      for(typename TActiveSet::const_iterator itA = active.lower_bound(endLow); (itA != active.end()) && ((uint64_t) itA->first < endHigh); ++itA) {
+	uint32_t j = itA->second;
+	if (j == i) continue;
+	if (!_intervalBeats(iv, j, i)) continue;
+	if ((_translocation(svtin)) || (recOverlap(iv[i].start, iv[i].end, iv[j].start, iv[j].end) >= c.recoverlap)) {
+	  keep = false;
+	  break;
+	}
+      }
+      if (keep) iSelected[seqId].push_back(iv[first]);
     }
   }
 }
 
-template<typename TGenomeIntervals, typename TContigMap>
-void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected, TContigMap& cMap, int32_t const svtin) {
-  typedef typename TGenomeIntervals::value_type TIntervalScores;
+// INFO buffers of one merge worker
+struct MergeBuffers {
+  int32_t nsvend;
+  int32_t* svend;
+  int32_t npe;
+  int32_t* pe;
+  int32_t nsr;
+  int32_t* sr;
+  int32_t ninslen;
+  int32_t* inslen;
+  int32_t npos2;
+  int32_t* pos2;
+  int32_t nhomlen;
+  int32_t* homlen;
+  int32_t nmapq;
+  int32_t* mapq;
+  int32_t nsrmapq;
+  int32_t* srmapq;
+  int32_t nsrq;
+  float* srq;
+  int32_t nct;
+  char* ct;
+  int32_t nsvt;
+  char* svt;
+  int32_t nchr2;
+  char* chr2;
+  int32_t ncipos;
+  int32_t* cipos;
+  int32_t nciend;
+  int32_t* ciend;
+  int32_t nce;
+  float* ce;
+  int32_t ncons;
+  char* cons;
+  int32_t nmp;
+  float* mp;
+
+  MergeBuffers() : nsvend(0), svend(NULL), npe(0), pe(NULL), nsr(0), sr(NULL), ninslen(0), inslen(NULL), npos2(0), pos2(NULL), nhomlen(0), homlen(NULL), nmapq(0), mapq(NULL), nsrmapq(0), srmapq(NULL), nsrq(0), srq(NULL), nct(0), ct(NULL), nsvt(0), svt(NULL), nchr2(0), chr2(NULL), ncipos(0), cipos(NULL), nciend(0), ciend(NULL), nce(0), ce(NULL), ncons(0), cons(NULL), nmp(0), mp(NULL) {}
+};
+
+inline void
+_freeMergeBuffers(MergeBuffers& mb) {
+  if (mb.svend != NULL) free(mb.svend);
+  if (mb.pe != NULL) free(mb.pe);
+  if (mb.sr != NULL) free(mb.sr);
+  if (mb.inslen != NULL) free(mb.inslen);
+  if (mb.pos2 != NULL) free(mb.pos2);
+  if (mb.homlen != NULL) free(mb.homlen);
+  if (mb.mapq != NULL) free(mb.mapq);
+  if (mb.srmapq != NULL) free(mb.srmapq);
+  if (mb.srq != NULL) free(mb.srq);
+  if (mb.ct != NULL) free(mb.ct);
+  if (mb.svt != NULL) free(mb.svt);
+  if (mb.chr2 != NULL) free(mb.chr2);
+  if (mb.cipos != NULL) free(mb.cipos);
+  if (mb.ciend != NULL) free(mb.ciend);
+  if (mb.ce != NULL) free(mb.ce);
+  if (mb.cons != NULL) free(mb.cons);
+  if (mb.mp != NULL) free(mb.mp);
+}
+
+// SV type, PASS, PRECISE and size filter of an input record
+inline bool
+_mergeCandidate(MergeConfig const& c, bcf_hdr_t* hdr, bcf1_t* rec, int32_t const svtin, MergeBuffers& mb, uint32_t& svStart, uint32_t& svEnd) {
+  // Correct SV type
+  int32_t recsvt = -1;
+  if (svtin == 9) {
+    if (bcf_get_info_string(hdr, rec, "SVTYPE", &mb.svt, &mb.nsvt) > 0) recsvt = _decodeOrientation(std::string("NA"), std::string(mb.svt));
+  } else {
+    if ((bcf_get_info_string(hdr, rec, "SVTYPE", &mb.svt, &mb.nsvt) > 0) && (bcf_get_info_string(hdr, rec, "CT", &mb.ct, &mb.nct) > 0)) recsvt = _decodeOrientation(std::string(mb.ct), std::string(mb.svt));
+  }
+  if (recsvt != svtin) return false;
+
+  // Check PASS and PRECISE
+  if ((c.filterForPass) && (bcf_has_filter(hdr, rec, const_cast<char*>("PASS"))!=1)) return false;
+  if ((c.filterForPrecise) && (bcf_get_info_flag(hdr, rec, "PRECISE", 0, 0) <= 0)) return false;
+
+  // Correct size
+  svStart = rec->pos;
+  svEnd = svStart + 1;
+  if (bcf_get_info_int32(hdr, rec, "END", &mb.svend, &mb.nsvend) > 0) svEnd = *mb.svend;
+  if (svtin == 9) return ((svEnd - svStart >= c.minsize) && (svEnd - svStart <= c.maxsize));
+  unsigned int inslenVal = 0;
+  if (bcf_get_info_int32(hdr, rec, "INSLEN", &mb.inslen, &mb.ninslen) > 0) inslenVal = *mb.inslen;
+  if (svtin == 4) svEnd = svStart + inslenVal; // To enable reciprocal overlap
+  std::string svt(mb.svt);
+  return ((svt == "BND") || ((svt == "INS") && (inslenVal >= c.minsize) && (inslenVal <= c.maxsize)) || ((svt != "BND") && (svt != "INS") && (svEnd - svStart >= c.minsize) && (svEnd - svStart <= c.maxsize)));
+}
+
+inline void
+_assignMergeID(MergeConfig& c, bcf_hdr_t* hdr_out, bcf1_t* rout, int32_t const svtin) {
+  std::string id(_addID(svtin));
+  std::string padNumber = boost::lexical_cast<std::string>(c.svcounter++);
+  padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
+  id += padNumber;
+  bcf_update_id(hdr_out, rout, id.c_str());
+}
+
+// Create the output record, IDs of multi-file merges are assigned in output order by _assignMergeID
+inline void
+_mergeRecord(MergeConfig const& c, bcf_hdr_t* hdr, bcf1_t* rec, bcf_hdr_t* hdr_out, bcf1_t* rout, int32_t const svtin, uint32_t svEnd, MergeBuffers& mb) {
+  std::string chrName(bcf_hdr_id2name(hdr, rec->rid));
+  bool precise = false;
+  if (bcf_get_info_flag(hdr, rec, "PRECISE", 0, 0) > 0) precise=true;
+  rout->rid = bcf_hdr_name2id(hdr_out, chrName.c_str());
+  rout->pos = rec->pos;
+  rout->qual = rec->qual;
+  if (c.files.size() == 1) bcf_update_id(hdr_out, rout, rec->d.id); // Within one VCF file IDs are unique
+  std::string refAllele = rec->d.allele[0];
+  std::string altAllele = rec->d.allele[1];
+  std::string alleles = refAllele + "," + altAllele;
+  bcf_update_alleles_str(hdr_out, rout, alleles.c_str());
+  int32_t tmppass = bcf_hdr_id2int(hdr_out, BCF_DT_ID, "PASS");
+  bcf_update_filter(hdr_out, rout, &tmppass, 1);
+  std::string dellyVersion("EMBL.DELLYv");
+  dellyVersion += dellyVersionNumber;
+
+  if (svtin == 9) {
+    // Fetch missing INFO fields
+    bcf_get_info_int32(hdr, rec, "CIPOS", &mb.cipos, &mb.ncipos);
+    bcf_get_info_int32(hdr, rec, "CIEND", &mb.ciend, &mb.nciend);
+    float mpval = 0;
+    if (bcf_get_info_float(hdr, rec, "MP", &mb.mp, &mb.nmp) > 0) mpval = *mb.mp;
+
+    // Add INFO fields
+    if (precise) bcf_update_info_flag(hdr_out, rout, "PRECISE", NULL, 1);
+    else bcf_update_info_flag(hdr_out, rout, "IMPRECISE", NULL, 1);
+    bcf_update_info_string(hdr_out, rout, "SVTYPE", _addID(svtin).c_str());
+    bcf_update_info_string(hdr_out,rout, "SVMETHOD", dellyVersion.c_str());
+    bcf_update_info_int32(hdr_out, rout, "END", &svEnd, 1);
+    bcf_update_info_int32(hdr_out, rout, "CIPOS", mb.cipos, 2);
+    bcf_update_info_int32(hdr_out, rout, "CIEND", mb.ciend, 2);
+    bcf_update_info_float(hdr_out, rout, "MP", &mpval, 1);
+    return;
+  }
+
+  // Parse INFO fields
+  unsigned int inslenVal = 0;
+  if (bcf_get_info_int32(hdr, rec, "INSLEN", &mb.inslen, &mb.ninslen) > 0) inslenVal = *mb.inslen;
+  unsigned int peSupport = 0;
+  if (bcf_get_info_int32(hdr, rec, "PE", &mb.pe, &mb.npe) > 0) peSupport = *mb.pe;
+  unsigned int srSupport = 0;
+  if (bcf_get_info_int32(hdr, rec, "SR", &mb.sr, &mb.nsr) > 0) srSupport = *mb.sr;
+  int32_t peMapQuality = 0;
+  if (bcf_get_info_int32(hdr, rec, "MAPQ", &mb.mapq, &mb.nmapq) > 0) peMapQuality = *mb.mapq;
+  int32_t srMapQuality = 0;
+  if (bcf_get_info_int32(hdr, rec, "SRMAPQ", &mb.srmapq, &mb.nsrmapq) > 0) srMapQuality = *mb.srmapq;
+  std::string chr2Name = chrName;
+  int32_t pos2val = 0;
+  if (bcf_get_info_string(hdr, rec, "CHR2", &mb.chr2, &mb.nchr2) > 0) {
+    chr2Name = std::string(mb.chr2);
+    if (bcf_get_info_int32(hdr, rec, "POS2", &mb.pos2, &mb.npos2) > 0) pos2val = *mb.pos2;
+  }
+
+  // Fetch missing INFO fields
+  unsigned int homlenVal = 0;
+  if (bcf_get_info_int32(hdr, rec, "HOMLEN", &mb.homlen, &mb.nhomlen) > 0) homlenVal = *mb.homlen;
+  bcf_get_info_int32(hdr, rec, "CIPOS", &mb.cipos, &mb.ncipos);
+  bcf_get_info_int32(hdr, rec, "CIEND", &mb.ciend, &mb.nciend);
+  float srAlignQuality = 0;
+  if (bcf_get_info_float(hdr, rec, "SRQ", &mb.srq, &mb.nsrq) > 0) srAlignQuality = *mb.srq;
+  std::string consensus;
+  float ceVal = 0;
+  if (precise) {
+    if (bcf_get_info_float(hdr, rec, "CE", &mb.ce, &mb.nce) > 0) ceVal = *mb.ce;
+    if (bcf_get_info_string(hdr, rec, "CONSENSUS", &mb.cons, &mb.ncons) > 0) consensus = boost::to_upper_copy(std::string(mb.cons));
+  }
+
+  // Add INFO fields
+  if (precise) bcf_update_info_flag(hdr_out, rout, "PRECISE", NULL, 1);
+  else bcf_update_info_flag(hdr_out, rout, "IMPRECISE", NULL, 1);
+  bcf_update_info_string(hdr_out, rout, "SVTYPE", _addID(svtin).c_str());
+  bcf_update_info_string(hdr_out,rout, "SVMETHOD", dellyVersion.c_str());
+  bcf_update_info_int32(hdr_out, rout, "END", &svEnd, 1);
+  if (svtin >= DELLY_SVT_TRANS) {
+    bcf_update_info_string(hdr_out,rout, "CHR2", chr2Name.c_str());
+    bcf_update_info_int32(hdr_out, rout, "POS2", &pos2val, 1);
+  }
+  if (svtin == 4) {
+    bcf_update_info_int32(hdr_out, rout, "SVLEN", &inslenVal, 1);
+  }
+  bcf_update_info_int32(hdr_out, rout, "PE", &peSupport, 1);
+  int32_t tmpi = peMapQuality;
+  bcf_update_info_int32(hdr_out, rout, "MAPQ", &tmpi, 1);
+  bcf_update_info_string(hdr_out, rout, "CT", _addOrientation(svtin).c_str());
+  bcf_update_info_int32(hdr_out, rout, "CIPOS", mb.cipos, 2);
+  bcf_update_info_int32(hdr_out, rout, "CIEND", mb.ciend, 2);
+  if (precise) {
+    int32_t tmpi = srMapQuality;
+    bcf_update_info_int32(hdr_out, rout, "SRMAPQ", &tmpi, 1);
+    bcf_update_info_int32(hdr_out, rout, "INSLEN", &inslenVal, 1);
+    bcf_update_info_int32(hdr_out, rout, "HOMLEN", &homlenVal, 1);
+    bcf_update_info_int32(hdr_out, rout, "SR", &srSupport, 1);
+    bcf_update_info_float(hdr_out, rout, "SRQ", &srAlignQuality, 1);
+    if (consensus.size()) {
+      bcf_update_info_string(hdr_out, rout, "CONSENSUS", consensus.c_str());
+      bcf_update_info_float(hdr_out, rout, "CE", &ceVal, 1);
+    }
+  }
+}
+
+// Selected records of non-seekable inputs by file index and record ordinal
+typedef std::vector<std::map<uint32_t, bcf1_t*> > TRecordBuffer;
+
+// Inputs without BGZF offsets are read once and their selected records are buffered
+template<typename TGenomeIntervals>
+inline bool
+_bufferSelectedRecords(MergeConfig const& c, TGenomeIntervals const& iSelected, TRecordBuffer& recBuf) {
+  recBuf.resize(c.files.size());
+  for(uint32_t tid = 0; tid < iSelected.size(); ++tid) {
+    for(uint32_t i = 0; i < iSelected[tid].size(); ++i) {
+      if (iSelected[tid][i].voffset < 0) recBuf[iSelected[tid][i].file_c][iSelected[tid][i].ordinal] = NULL;
+    }
+  }
+  bool success = true;
+  for(uint32_t file_c = 0; ((success) && (file_c < c.files.size())); ++file_c) {
+    if (recBuf[file_c].empty()) continue;
+    htsFile* ifile = bcf_open(c.files[file_c].string().c_str(), "r");
+    bcf_hdr_t* hdr = bcf_hdr_read(ifile);
+    if (bcf_hdr_set_samples(hdr, NULL, false) != 0) std::cerr << "Error: Failed to set sample information!" << std::endl;
+    bcf1_t* rec = bcf_init();
+    uint32_t ordinal = 0;
+    uint32_t lastOrdinal = recBuf[file_c].rbegin()->first;
+    std::map<uint32_t, bcf1_t*>::iterator itB = recBuf[file_c].begin();
+    while ((ordinal <= lastOrdinal) && (bcf_read(ifile, hdr, rec) == 0)) {
+      if (ordinal == itB->first) {
+	itB->second = bcf_dup(rec);
+	bcf_unpack(itB->second, BCF_UN_INFO);
+	++itB;
+      }
+      ++ordinal;
+    }
+    if (itB != recBuf[file_c].end()) {
+      std::cerr << "Error: Failed to fetch record " << itB->first << " of " << c.files[file_c].string() << "!" << std::endl;
+      success = false;
+    }
+    bcf_destroy(rec);
+    bcf_hdr_destroy(hdr);
+    bcf_close(ifile);
+  }
+  return success;
+}
+
+inline void
+_freeRecordBuffer(TRecordBuffer& recBuf) {
+  for(uint32_t file_c = 0; file_c < recBuf.size(); ++file_c) {
+    for(std::map<uint32_t, bcf1_t*>::iterator itB = recBuf[file_c].begin(); itB != recBuf[file_c].end(); ++itB) {
+      if (itB->second != NULL) bcf_destroy(itB->second);
+    }
+  }
+  recBuf.clear();
+}
+
+// Fetch the selected records of one chromosome by their record identity, false if a record cannot be fetched
+template<typename TIntervalScores>
+inline bool
+_mergeChromosome(MergeConfig const& c, TIntervalScores const& iSelected, TRecordBuffer const& recBuf, bcf_hdr_t* hdr_out, int32_t const svtin, MergeBuffers& mb, std::vector<bcf1_t*>& chrRecs) {
   typedef typename TIntervalScores::value_type IntervalScore;
 
+  // Duplicate filter (identical start, end), the earliest record in merge order is kept
+  std::vector<bool> dup(iSelected.size(), false);
+  for(uint32_t i = 0; i < iSelected.size();) {
+    uint32_t k = i;
+    uint32_t best = i;
+    for(; (k < iSelected.size()) && (iSelected[k].start == iSelected[i].start) && (iSelected[k].end == iSelected[i].end); ++k) {
+      if (SortMergeOrder<IntervalScore>()(iSelected[k], iSelected[best])) best = k;
+      dup[k] = true;
+    }
+    dup[best] = false;
+    i = k;
+  }
+  TIntervalScores sel;
+  for(uint32_t i = 0; i < iSelected.size(); ++i) {
+    if (!dup[i]) sel.push_back(iSelected[i]);
+  }
+  std::sort(sel.begin(), sel.end(), SortMergeOrder<IntervalScore>());
+
+  // Input files are opened on demand
+  std::vector<htsFile*> ifile(c.files.size(), NULL);
+  std::vector<bcf_hdr_t*> hdr(c.files.size(), NULL);
+  bcf1_t* seekRec = bcf_init();
+  bool success = true;
+  for(typename TIntervalScores::const_iterator itS = sel.begin(); itS != sel.end(); ++itS) {
+    uint32_t file_c = itS->file_c;
+    if (ifile[file_c] == NULL) {
+      ifile[file_c] = bcf_open(c.files[file_c].string().c_str(), "r");
+      hdr[file_c] = bcf_hdr_read(ifile[file_c]);
+      if (bcf_hdr_set_samples(hdr[file_c], NULL, false) != 0) std::cerr << "Error: Failed to set sample information!" << std::endl;
+    }
+
+    // Seek to the record or take it from the buffer
+    bcf1_t* rec = NULL;
+    if (itS->voffset >= 0) {
+      if ((bgzf_seek(ifile[file_c]->fp.bgzf, itS->voffset, SEEK_SET) == 0) && (bcf_read(ifile[file_c], hdr[file_c], seekRec) == 0)) {
+	rec = seekRec;
+	bcf_unpack(rec, BCF_UN_INFO);
+      }
+    } else {
+      std::map<uint32_t, bcf1_t*>::const_iterator itB = recBuf[file_c].find(itS->ordinal);
+      if (itB != recBuf[file_c].end()) rec = itB->second;
+    }
+    if (rec == NULL) {
+      std::cerr << "Error: Failed to fetch record " << itS->ordinal << " of " << c.files[file_c].string() << "!" << std::endl;
+      success = false;
+      break;
+    }
+
+    // Create the output record
+    uint32_t svStart = 0;
+    uint32_t svEnd = 0;
+    if ((_mergeCandidate(c, hdr[file_c], rec, svtin, mb, svStart, svEnd)) && (svStart == itS->start) && (svEnd == itS->end)) {
+      bcf1_t* rout = bcf_init();
+      _mergeRecord(c, hdr[file_c], rec, hdr_out, rout, svtin, svEnd, mb);
+      chrRecs.push_back(rout);
+    }
+  }
+  bcf_destroy(seekRec);
+  for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+    if (ifile[file_c] != NULL) {
+      bcf_hdr_destroy(hdr[file_c]);
+      bcf_close(ifile[file_c]);
+    }
+  }
+  return success;
+}
+
+template<typename TGenomeIntervals, typename TContigMap>
+inline bool
+_writeSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected, TContigMap& cMap, int32_t const svtin, htsFile* fp, bcf_hdr_t* hdr_out) {
+  int32_t nthreads = 1;
+#ifdef OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  std::vector<MergeBuffers> mb(nthreads);
+
+  // Non-seekable inputs
+  TRecordBuffer recBuf;
+  if (!_bufferSelectedRecords(c, iSelected, recBuf)) {
+    _freeRecordBuffer(recBuf);
+    return false;
+  }
+
+  // One chromosome per worker and output in chromosome order
+  int32_t numseq = cMap.size();
+  std::vector<std::vector<bcf1_t*> > chrRecs(numseq);
+  std::vector<bool> chrDone(numseq, false);
+  int32_t nextOut = 0;
+  bool success = true;
+#pragma omp parallel for default(shared) schedule(dynamic)
+  for(int32_t tid = 0; tid < numseq; ++tid) {
+    int32_t t = 0;
+#ifdef OPENMP
+    t = omp_get_thread_num();
+#endif
+    bool chrSuccess = true;
+    if (!iSelected[tid].empty()) chrSuccess = _mergeChromosome(c, iSelected[tid], recBuf, hdr_out, svtin, mb[t], chrRecs[tid]);
+#pragma omp critical
+    {
+      if (!chrSuccess) success = false;
+      chrDone[tid] = true;
+      for(; (nextOut < numseq) && (chrDone[nextOut]); ++nextOut) {
+	for(uint32_t k = 0; k < chrRecs[nextOut].size(); ++k) {
+	  if (success) {
+	    if (c.files.size() > 1) _assignMergeID(c, hdr_out, chrRecs[nextOut][k], svtin);
+	    bcf_write1(fp, hdr_out, chrRecs[nextOut][k]);
+	  }
+	  bcf_destroy(chrRecs[nextOut][k]);
+	}
+	chrRecs[nextOut].clear();
+      }
+    }
+  }
+  for(int32_t t = 0; t < nthreads; ++t) _freeMergeBuffers(mb[t]);
+  _freeRecordBuffer(recBuf);
+  return success;
+}
+
+template<typename TGenomeIntervals, typename TContigMap>
+bool _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected, TContigMap& cMap, int32_t const svtin) {
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
   std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Filtering SVs" << std::endl;
 
@@ -303,265 +757,27 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
   bcf_hdr_add_sample(hdr_out, NULL);
   if (bcf_hdr_write(fp, hdr_out) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
 
-  // Duplicate filter (identical start, end, score values)
-  typedef std::pair<uint32_t, uint32_t> TStartEnd;
-  typedef std::set<TStartEnd> TIntervalSet;
-  typedef std::vector<TIntervalSet> TGenomicIntervalSet;
-  TGenomicIntervalSet gis(numseq);
-
-  // Parse input VCF files
-  bcf1_t *rout = bcf_init();
-  typedef std::vector<htsFile*> THtsFile;
-  typedef std::vector<bcf_hdr_t*> TBcfHeader;
-  typedef std::vector<bcf1_t*> TBcfRecord;
-  typedef std::vector<bool> TEof;
-  THtsFile ifile(c.files.size());
-  TBcfHeader hdr(c.files.size());
-  TBcfRecord rec(c.files.size());
-  TEof eof(c.files.size());
-  uint32_t allEOF = 0;
-  for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-    ifile[file_c] = bcf_open(c.files[file_c].string().c_str(), "r");
-    hdr[file_c] = bcf_hdr_read(ifile[file_c]);
-    if (bcf_hdr_set_samples(hdr[file_c], NULL, false) != 0) std::cerr << "Error: Failed to set sample information!" << std::endl;
-    rec[file_c] = bcf_init();
-    if (bcf_read(ifile[file_c], hdr[file_c], rec[file_c]) == 0) {
-      bcf_unpack(rec[file_c], BCF_UN_INFO);
-      eof[file_c] = false;
-    } else {
-      ++allEOF;
-      eof[file_c] = true;
-    }
-  }
-
-  int32_t nsvend = 0;
-  int32_t* svend = NULL;
-  int32_t npe = 0;
-  int32_t* pe = NULL;
-  int32_t nsr = 0;
-  int32_t* sr = NULL;
-  int32_t ninslen = 0;
-  int32_t* inslen = NULL;
-  int32_t npos2 = 0;
-  int32_t* pos2 = NULL;
-  int32_t nhomlen = 0;
-  int32_t* homlen = NULL;
-  int32_t nmapq = 0;
-  int32_t* mapq = NULL;
-  int32_t nsrmapq = 0;
-  int32_t* srmapq = NULL;
-  int32_t nsrq = 0;
-  float* srq = NULL;
-  int32_t nct = 0;
-  char* ct = NULL;
-  int32_t nsvt = 0;
-  char* svt = NULL;
-  int32_t nchr2 = 0;
-  char* chr2 = NULL;
-  int32_t ncipos = 0;
-  int32_t* cipos = NULL;
-  int32_t nciend = 0;
-  int32_t* ciend = NULL;
-  int32_t nce = 0;
-  float* ce = NULL;
-  int32_t ncons = 0;
-  char* cons = NULL;
-  while (allEOF < c.files.size()) {
-    // Find next sorted record
-    int32_t idx = -1;
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      if (!eof[file_c]) {
-	if ((idx < 0) || (rec[idx]->rid > rec[file_c]->rid) || ((rec[idx]->rid == rec[file_c]->rid) && (rec[idx]->pos > rec[file_c]->pos))) idx = file_c;
-      }
-    }
-
-    // Correct SV type
-    int32_t recsvt = -1;
-    if ((bcf_get_info_string(hdr[idx], rec[idx], "SVTYPE", &svt, &nsvt) > 0) && (bcf_get_info_string(hdr[idx], rec[idx], "CT", &ct, &nct) > 0)) recsvt = _decodeOrientation(std::string(ct), std::string(svt));
-    if (recsvt == svtin) {
-      // Check PASS
-      bool pass = true;
-      if (c.filterForPass) pass = (bcf_has_filter(hdr[idx], rec[idx], const_cast<char*>("PASS"))==1);
-
-      // Check PRECISE
-      bool precise = false;
-      bool passPrecise = true;
-      if (bcf_get_info_flag(hdr[idx], rec[idx], "PRECISE", 0, 0) > 0) precise=true;
-      if ((c.filterForPrecise) && (!precise)) passPrecise = false;
-
-      // Check PASS and precise
-      if ((passPrecise) && (pass)) {
-	// Correct size
-	std::string chrName(bcf_hdr_id2name(hdr[idx], rec[idx]->rid));
-	uint32_t tid = cMap[chrName];
-	uint32_t svStart = rec[idx]->pos;
-	uint32_t svEnd = svStart + 1;
-	if (bcf_get_info_int32(hdr[idx], rec[idx], "END", &svend, &nsvend) > 0) svEnd = *svend;
-	unsigned int inslenVal = 0;
-	if (bcf_get_info_int32(hdr[idx], rec[idx], "INSLEN", &inslen, &ninslen) > 0) inslenVal = *inslen;
-	if (recsvt == 4) svEnd = svStart + inslenVal; // To enable reciprocal overlap
-
-	// Parse INFO fields
-	if ((std::string(svt) == "BND") || ((std::string(svt) == "INS") && (inslenVal >= c.minsize) && (inslenVal <= c.maxsize)) || ((std::string(svt) != "BND") && (std::string(svt) != "INS") && (svEnd - svStart >= c.minsize) && (svEnd - svStart <= c.maxsize))) {
-	  unsigned int peSupport = 0;
-	  if (bcf_get_info_int32(hdr[idx], rec[idx], "PE", &pe, &npe) > 0) peSupport = *pe;
-	  unsigned int srSupport = 0;
-	  if (bcf_get_info_int32(hdr[idx], rec[idx], "SR", &sr, &nsr) > 0) srSupport = *sr;
-	  // Remove this line
-	  //if (srSupport > 0) precise = true;
-	  
-	  int32_t peMapQuality = 0;
-	  if (bcf_get_info_int32(hdr[idx], rec[idx], "MAPQ", &mapq, &nmapq) > 0) peMapQuality = *mapq;
-	  int32_t srMapQuality = 0;
-	  if (bcf_get_info_int32(hdr[idx], rec[idx], "SRMAPQ", &srmapq, &nsrmapq) > 0) srMapQuality = *srmapq;
-	  std::string chr2Name = chrName;
-	  int32_t pos2val = 0;
-	  if (bcf_get_info_string(hdr[idx], rec[idx], "CHR2", &chr2, &nchr2) > 0) {
-	    chr2Name = std::string(chr2);
-	    if (bcf_get_info_int32(hdr[idx], rec[idx], "POS2", &pos2, &npos2) > 0) pos2val = *pos2;
-	    //mtid = cMap[chr2Name];
-	  }
-	  int32_t score = rec[idx]->qual;
-	  
-	  // Is this a selected interval
-	  typename TIntervalScores::const_iterator iter = std::lower_bound(iSelected[tid].begin(), iSelected[tid].end(), IntervalScore(svStart, svEnd, score), SortIScores<IntervalScore>());
-	  bool foundInterval = false;
-	  for(; (iter != iSelected[tid].end()) && (iter->start == svStart); ++iter) {
-	    if ((iter->start == svStart) && (iter->end == svEnd) && (iter->score == score)) {
-	      // Duplicate?
-	      if (gis[tid].find(std::make_pair(svStart, svEnd)) == gis[tid].end()) {
-		foundInterval = true;
-		gis[tid].insert(std::make_pair(svStart, svEnd));
-	      }
-	      break;
-	    }
-	  }
-	  if (foundInterval) {
-	    // Fetch missing INFO fields
-	    unsigned int homlenVal = 0;
-	    if (bcf_get_info_int32(hdr[idx], rec[idx], "HOMLEN", &homlen, &nhomlen) > 0) homlenVal = *homlen;
-	    bcf_get_info_int32(hdr[idx], rec[idx], "CIPOS", &cipos, &ncipos);
-	    bcf_get_info_int32(hdr[idx], rec[idx], "CIEND", &ciend, &nciend);
-	    float srAlignQuality = 0;
-	    if (bcf_get_info_float(hdr[idx], rec[idx], "SRQ", &srq, &nsrq) > 0) srAlignQuality = *srq;
-
-	    std::string consensus;
-	    float ceVal = 0;
-	    if (precise) {
-	      if (bcf_get_info_float(hdr[idx], rec[idx], "CE", &ce, &nce) > 0) ceVal = *ce;
-	      if (bcf_get_info_string(hdr[idx], rec[idx], "CONSENSUS", &cons, &ncons) > 0) consensus = boost::to_upper_copy(std::string(cons));
-	    }
-	    
-	    // Create new record
-	    rout->rid = bcf_hdr_name2id(hdr_out, chrName.c_str());
-	    rout->pos = rec[idx]->pos;
-	    rout->qual = rec[idx]->qual;
-	    std::string id;
-	    if (c.files.size() == 1) id = std::string(rec[idx]->d.id); // Within one VCF file IDs are unique
-	    else {
-	      id += _addID(svtin);
-	      std::string padNumber = boost::lexical_cast<std::string>(c.svcounter++);
-	      padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
-	      id += padNumber;
-	    }
-	    bcf_update_id(hdr_out, rout, id.c_str());
-	    std::string refAllele = rec[idx]->d.allele[0];
-	    std::string altAllele = rec[idx]->d.allele[1];
-	    std::string alleles = refAllele + "," + altAllele;
-	    bcf_update_alleles_str(hdr_out, rout, alleles.c_str());
-	    int32_t tmppass = bcf_hdr_id2int(hdr_out, BCF_DT_ID, "PASS");
-	    bcf_update_filter(hdr_out, rout, &tmppass, 1);
-	    
-	    // Add INFO fields
-	    if (precise) bcf_update_info_flag(hdr_out, rout, "PRECISE", NULL, 1);
-	    else bcf_update_info_flag(hdr_out, rout, "IMPRECISE", NULL, 1);
-	    bcf_update_info_string(hdr_out, rout, "SVTYPE", _addID(svtin).c_str());
-	    std::string dellyVersion("EMBL.DELLYv");
-	    dellyVersion += dellyVersionNumber;
-	    bcf_update_info_string(hdr_out,rout, "SVMETHOD", dellyVersion.c_str());
-	    bcf_update_info_int32(hdr_out, rout, "END", &svEnd, 1);
-	    if (svtin >= DELLY_SVT_TRANS) {
-	      bcf_update_info_string(hdr_out,rout, "CHR2", chr2Name.c_str());
-	      bcf_update_info_int32(hdr_out, rout, "POS2", &pos2val, 1);
-	    }
-	    if (svtin == 4) {
-	      bcf_update_info_int32(hdr_out, rout, "SVLEN", &inslenVal, 1);
-	    }
-	    bcf_update_info_int32(hdr_out, rout, "PE", &peSupport, 1);
-	    int32_t tmpi = peMapQuality;
-	    bcf_update_info_int32(hdr_out, rout, "MAPQ", &tmpi, 1);
-	    bcf_update_info_string(hdr_out, rout, "CT", _addOrientation(svtin).c_str());
-	    bcf_update_info_int32(hdr_out, rout, "CIPOS", cipos, 2);
-	    bcf_update_info_int32(hdr_out, rout, "CIEND", ciend, 2);
-	    if (precise) {
-	      int32_t tmpi = srMapQuality;
-	      bcf_update_info_int32(hdr_out, rout, "SRMAPQ", &tmpi, 1);
-	      bcf_update_info_int32(hdr_out, rout, "INSLEN", &inslenVal, 1);
-	      bcf_update_info_int32(hdr_out, rout, "HOMLEN", &homlenVal, 1);
-	      bcf_update_info_int32(hdr_out, rout, "SR", &srSupport, 1);
-	      bcf_update_info_float(hdr_out, rout, "SRQ", &srAlignQuality, 1);
-	      if (consensus.size()) {
-		bcf_update_info_string(hdr_out, rout, "CONSENSUS", consensus.c_str());
-		bcf_update_info_float(hdr_out, rout, "CE", &ceVal, 1);
-	      }
-	    }
-	
-	    // Write record
-	    bcf_write1(fp, hdr_out, rout);
-	    bcf_clear1(rout);	  
-	    //std::cerr << bcf_hdr_id2name(hdr[idx], tid) << '\t' << svStart << '\t' << svEnd << std::endl;
-	  }
-	}
-      }
-    }
-
-    // Fetch next record
-    if (bcf_read(ifile[idx], hdr[idx], rec[idx]) == 0) bcf_unpack(rec[idx], BCF_UN_INFO);
-    else {
-      ++allEOF;
-      eof[idx] = true;
-    }
-  }
-  if (svend != NULL) free(svend);
-  if (pe != NULL) free(pe);
-  if (sr != NULL) free(sr);
-  if (homlen != NULL) free(homlen);
-  if (inslen != NULL) free(inslen);
-  if (pos2 != NULL) free(pos2);
-  if (mapq != NULL) free(mapq);
-  if (srmapq != NULL) free(srmapq);
-  if (ct != NULL) free(ct);
-  if (srq != NULL) free(srq);
-  if (svt != NULL) free(svt);
-  if (chr2 != NULL) free(chr2);
-  if (cipos != NULL) free(cipos);
-  if (ciend != NULL) free(ciend);
-  if (ce != NULL) free(ce);
-  if (cons != NULL) free(cons);
-
-  // Clean-up
-  for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-    bcf_hdr_destroy(hdr[file_c]);
-    bcf_close(ifile[file_c]);
-    bcf_destroy(rec[file_c]);
-  }
+  // Selected records
+  bool success = _writeSelectedIntervals(c, iSelected, cMap, svtin, fp, hdr_out);
 
   // Close VCF file
-  bcf_destroy(rout);
   bcf_hdr_destroy(hdr_out);
   hts_close(fp);
+  if (!success) {
+    boost::filesystem::remove(c.outfile);
+    boost::filesystem::remove(boost::filesystem::path(c.outfile.string() + ".csi"));
+    return false;
+  }
 
   // Build index
   bcf_index_build(c.outfile.string().c_str(), 14);
+  return true;
 }
 
 
 
   template<typename TGenomeIntervals, typename TContigMap>
-  void _outputSelectedIntervalsCNVs(MergeConfig& c, TGenomeIntervals const& iSelected, TContigMap& cMap) {
-    typedef typename TGenomeIntervals::value_type TIntervalScores;
-    typedef typename TIntervalScores::value_type IntervalScore;
-
+  bool _outputSelectedIntervalsCNVs(MergeConfig& c, TGenomeIntervals const& iSelected, TContigMap& cMap) {
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Filtering SVs" << std::endl;
 
@@ -597,172 +813,21 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
     bcf_hdr_add_sample(hdr_out, NULL);
     if (bcf_hdr_write(fp, hdr_out) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
 
-    // Duplicate filter (identical start, end, score values)
-    typedef std::pair<uint32_t, uint32_t> TStartEnd;
-    typedef std::set<TStartEnd> TIntervalSet;
-    typedef std::vector<TIntervalSet> TGenomicIntervalSet;
-    TGenomicIntervalSet gis(numseq);
-
-    // Parse input VCF files
-    bcf1_t *rout = bcf_init();
-    typedef std::vector<htsFile*> THtsFile;
-    typedef std::vector<bcf_hdr_t*> TBcfHeader;
-    typedef std::vector<bcf1_t*> TBcfRecord;
-    typedef std::vector<bool> TEof;
-    THtsFile ifile(c.files.size());
-    TBcfHeader hdr(c.files.size());
-    TBcfRecord rec(c.files.size());
-    TEof eof(c.files.size());
-    uint32_t allEOF = 0;
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      ifile[file_c] = bcf_open(c.files[file_c].string().c_str(), "r");
-      hdr[file_c] = bcf_hdr_read(ifile[file_c]);
-      if (bcf_hdr_set_samples(hdr[file_c], NULL, false) != 0) std::cerr << "Error: Failed to set sample information!" << std::endl;
-      rec[file_c] = bcf_init();
-      if (bcf_read(ifile[file_c], hdr[file_c], rec[file_c]) == 0) {
-	bcf_unpack(rec[file_c], BCF_UN_INFO);
-	eof[file_c] = false;
-      } else {
-	++allEOF;
-	eof[file_c] = true;
-      }
-    }
-
-    int32_t nsvend = 0;
-    int32_t* svend = NULL;
-    int32_t nmp = 0;
-    float* mp = NULL;
-    int32_t nsvt = 0;
-    char* svt = NULL;
-    int32_t ncipos = 0;
-    int32_t* cipos = NULL;
-    int32_t nciend = 0;
-    int32_t* ciend = NULL;
-    while (allEOF < c.files.size()) {
-      // Find next sorted record
-      int32_t idx = -1;
-      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-	if (!eof[file_c]) {
-	  if ((idx < 0) || (rec[idx]->rid > rec[file_c]->rid) || ((rec[idx]->rid == rec[file_c]->rid) && (rec[idx]->pos > rec[file_c]->pos))) idx = file_c;
-	}
-      }
-
-      // Correct SV type
-      int32_t recsvt = -1;
-      if (bcf_get_info_string(hdr[idx], rec[idx], "SVTYPE", &svt, &nsvt) > 0) recsvt = _decodeOrientation(std::string("NA"), std::string(svt));
-      // CNV ?
-      if (recsvt == 9) {
-	// Check PASS
-	bool pass = true;
-	if (c.filterForPass) pass = (bcf_has_filter(hdr[idx], rec[idx], const_cast<char*>("PASS"))==1);
-
-	// Check PRECISE
-	bool precise = false;
-	bool passPrecise = true;
-	if (bcf_get_info_flag(hdr[idx], rec[idx], "PRECISE", 0, 0) > 0) precise=true;
-	if ((c.filterForPrecise) && (!precise)) passPrecise = false;
-
-	// Check PASS and precise
-	if ((passPrecise) && (pass)) {
-	  // Correct size
-	  std::string chrName(bcf_hdr_id2name(hdr[idx], rec[idx]->rid));
-	  uint32_t tid = cMap[chrName];
-	  uint32_t svStart = rec[idx]->pos;
-	  uint32_t svEnd = svStart + 1;
-	  if (bcf_get_info_int32(hdr[idx], rec[idx], "END", &svend, &nsvend) > 0) svEnd = *svend;
-	  
-	  // Parse INFO fields
-	  if ((svEnd - svStart >= c.minsize) && (svEnd - svStart <= c.maxsize)) {
-	    int32_t score = rec[idx]->qual;
-	  
-	    // Is this a selected interval
-	    typename TIntervalScores::const_iterator iter = std::lower_bound(iSelected[tid].begin(), iSelected[tid].end(), IntervalScore(svStart, svEnd, score), SortIScores<IntervalScore>());
-	    bool foundInterval = false;
-	    for(; (iter != iSelected[tid].end()) && (iter->start == svStart); ++iter) {
-	      if ((iter->start == svStart) && (iter->end == svEnd) && (iter->score == score)) {
-		// Duplicate?
-		if (gis[tid].find(std::make_pair(svStart, svEnd)) == gis[tid].end()) {
-		  foundInterval = true;
-		  gis[tid].insert(std::make_pair(svStart, svEnd));
-		}
-		break;
-	      }
-	    }
-	    if (foundInterval) {
-	      // Fetch missing INFO fields
-	      bcf_get_info_int32(hdr[idx], rec[idx], "CIPOS", &cipos, &ncipos);
-	      bcf_get_info_int32(hdr[idx], rec[idx], "CIEND", &ciend, &nciend);
-	      float mpval = 0;
-	      if (bcf_get_info_float(hdr[idx], rec[idx], "MP", &mp, &nmp) > 0) mpval = *mp;
-	      
-	      // Create new record
-	      rout->rid = bcf_hdr_name2id(hdr_out, chrName.c_str());
-	      rout->pos = rec[idx]->pos;
-	      rout->qual = rec[idx]->qual;
-	      std::string id;
-	      if (c.files.size() == 1) id = std::string(rec[idx]->d.id); // Within one VCF file IDs are unique
-	      else {
-		id += _addID(recsvt);
-		std::string padNumber = boost::lexical_cast<std::string>(c.svcounter++);
-		padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
-		id += padNumber;
-	      }
-	      bcf_update_id(hdr_out, rout, id.c_str());
-	      std::string refAllele = rec[idx]->d.allele[0];
-	      std::string altAllele = rec[idx]->d.allele[1];
-	      std::string alleles = refAllele + "," + altAllele;
-	      bcf_update_alleles_str(hdr_out, rout, alleles.c_str());
-	      int32_t tmppass = bcf_hdr_id2int(hdr_out, BCF_DT_ID, "PASS");
-	      bcf_update_filter(hdr_out, rout, &tmppass, 1);
-	    
-	      // Add INFO fields
-	      if (precise) bcf_update_info_flag(hdr_out, rout, "PRECISE", NULL, 1);
-	      else bcf_update_info_flag(hdr_out, rout, "IMPRECISE", NULL, 1);
-	      bcf_update_info_string(hdr_out, rout, "SVTYPE", _addID(recsvt).c_str());
-	      std::string dellyVersion("EMBL.DELLYv");
-	      dellyVersion += dellyVersionNumber;
-	      bcf_update_info_string(hdr_out,rout, "SVMETHOD", dellyVersion.c_str());
-	      bcf_update_info_int32(hdr_out, rout, "END", &svEnd, 1);
-	      bcf_update_info_int32(hdr_out, rout, "CIPOS", cipos, 2);
-	      bcf_update_info_int32(hdr_out, rout, "CIEND", ciend, 2);
-	      bcf_update_info_float(hdr_out, rout, "MP", &mpval, 1);
-
-	      // Write record
-	      bcf_write1(fp, hdr_out, rout);
-	      bcf_clear1(rout);	  
-	      //std::cerr << bcf_hdr_id2name(hdr[idx], tid) << '\t' << svStart << '\t' << svEnd << std::endl;
-	    }
-	  }
-	}
-      }
-
-      // Fetch next record
-      if (bcf_read(ifile[idx], hdr[idx], rec[idx]) == 0) bcf_unpack(rec[idx], BCF_UN_INFO);
-      else {
-	++allEOF;
-	eof[idx] = true;
-      }
-    }
-    if (svend != NULL) free(svend);
-    if (mp != NULL) free(mp);
-    if (svt != NULL) free(svt);
-    if (cipos != NULL) free(cipos);
-    if (ciend != NULL) free(ciend);
-
-    // Clean-up
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      bcf_hdr_destroy(hdr[file_c]);
-      bcf_close(ifile[file_c]);
-      bcf_destroy(rec[file_c]);
-    }
+    // Selected records
+    bool success = _writeSelectedIntervals(c, iSelected, cMap, 9, fp, hdr_out);
 
     // Close VCF file
-    bcf_destroy(rout);
     bcf_hdr_destroy(hdr_out);
     hts_close(fp);
+    if (!success) {
+      boost::filesystem::remove(c.outfile);
+      boost::filesystem::remove(boost::filesystem::path(c.outfile.string() + ".csi"));
+      return false;
+    }
 
     // Build index
     bcf_index_build(c.outfile.string().c_str(), 14);
+    return true;
   }
 
 inline void
@@ -866,7 +931,7 @@ mergeRun(MergeConfig& c, int32_t const svt) {
   typedef std::vector<TIntervalScores> TGenomeIntervals;
   TGenomeIntervals iScore;
   iScore.resize(numseq, TIntervalScores());
-  _fillIntervalMap(c, iScore, contigMap, svt);
+  if (!_fillIntervalMap(c, iScore, contigMap, svt)) return 1;
   for(uint32_t i = 0; i<numseq; ++i) std::sort(iScore[i].begin(), iScore[i].end(), SortIScores<IntervalScore>());
 
   // Filter intervals
@@ -877,8 +942,9 @@ mergeRun(MergeConfig& c, int32_t const svt) {
   for(uint32_t i = 0; i<numseq; ++i) std::sort(iSelected[i].begin(), iSelected[i].end(), SortIScores<IntervalScore>());
 
   // Output best intervals
-  if (svt == 9) _outputSelectedIntervalsCNVs(c, iSelected, contigMap);
-  else _outputSelectedIntervals(c, iSelected, contigMap, svt);
+  if (svt == 9) {
+    if (!_outputSelectedIntervalsCNVs(c, iSelected, contigMap)) return 1;
+  } else if (!_outputSelectedIntervals(c, iSelected, contigMap, svt)) return 1;
 
   // End
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
@@ -1039,7 +1105,7 @@ int merge(int argc, char **argv) {
     if (c.files.size() <= c.chunksize) {
       // Merge in one go
       c.outfile = svtCollect[svt];
-      mergeRun(c, svt);
+      if (mergeRun(c, svt) != 0) return 1;
     } else {
       // Merge in chunks
       std::vector<boost::filesystem::path> fileRestore = c.files;
@@ -1052,7 +1118,7 @@ int merge(int argc, char **argv) {
 	c.files.clear();
 	for(uint32_t k = ic * c.chunksize; ((k < ((ic+1) * c.chunksize)) && (k < fileRestore.size())); ++k) c.files.push_back(fileRestore[k]);
 	c.outfile = chunkCollect[ic];
-	mergeRun(c, svt);
+	if (mergeRun(c, svt) != 0) return 1;
       }
       // Merge chunks
       c.files = chunkCollect;
@@ -1062,7 +1128,7 @@ int merge(int argc, char **argv) {
       uint32_t coverageStore = c.coverage;
       c.vaf = 0;
       c.coverage = 0;
-      mergeRun(c, svt);
+      if (mergeRun(c, svt) != 0) return 1;
       c.vaf = vafStore;
       c.coverage = coverageStore;
       // Clean-up
@@ -6,8 +6,16 @@
 #include <htslib/sam.h>
 #include <htslib/vcf.h>
 
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+#include "tags.h"
 #include "bolog.h"
 
+#define SAMPLE_OTHER 0
+#define SAMPLE_CONTROL 1
+#define SAMPLE_TUMOR 2
 
 
 namespace torali
@@ -100,6 +108,47 @@ _isKeyPresent(bcf_hdr_t const* hdr, std::string const& key) {
   return (bcf_hdr_id2int(hdr, BCF_DT_ID, key.c_str())>=0);
 }
 
+// Value k of sample i of an unpacked FORMAT field, decoded in place without copying the other samples
+inline int32_t
+_formatInt(bcf_fmt_t const* fmt, int32_t const i, int32_t const k) {
+  uint8_t const* p = fmt->p + (std::size_t) i * fmt->size;
+  if (fmt->type == BCF_BT_INT8) {
+    int8_t val = ((int8_t const*) p)[k];
+    if (val == bcf_int8_missing) return bcf_int32_missing;
+    if (val == bcf_int8_vector_end) return bcf_int32_vector_end;
+    return val;
+  } else if (fmt->type == BCF_BT_INT16) {
+    int16_t val;
+    memcpy(&val, p + k * sizeof(int16_t), sizeof(int16_t));
+    if (val == bcf_int16_missing) return bcf_int32_missing;
+    if (val == bcf_int16_vector_end) return bcf_int32_vector_end;
+    return val;
+  } else if (fmt->type == BCF_BT_INT32) {
+    int32_t val;
+    memcpy(&val, p + k * sizeof(int32_t), sizeof(int32_t));
+    return val;
+  }
+  return bcf_int32_missing;
+}
+
+inline float
+_formatFloat(bcf_fmt_t const* fmt, int32_t const i, int32_t const k) {
+  if (fmt->type != BCF_BT_FLOAT) return _formatInt(fmt, i, k);
+  float val;
+  memcpy(&val, fmt->p + (std::size_t) i * fmt->size + k * sizeof(float), sizeof(float));
+  return val;
+}
+
+// Role of each sample column, in germline mode all samples are controls
+inline void
+_sampleRoles(bcf_hdr_t const* hdr, bool const germline, std::set<std::string> const& controlSet, std::set<std::string> const& tumorSet, std::vector<uint8_t>& role) {
+  role.assign(bcf_hdr_nsamples(hdr), SAMPLE_OTHER);
+  for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
+    if ((germline) || (controlSet.find(hdr->samples[i]) != controlSet.end())) role[i] = SAMPLE_CONTROL;
+    else if (tumorSet.find(hdr->samples[i]) != tumorSet.end()) role[i] = SAMPLE_TUMOR;
+  }
+}
+
 inline bool
 _isDNA(std::string const& allele) {
   for(uint32_t i = 0; i<allele.size(); ++i) {
@@ -148,19 +197,43 @@ struct cstyle_str {
   }
 };
  
-// Parse Delly vcf file
+// Upper-case reference window [start, end)
+inline bool
+_fetchWindow(faidx_t* fai, std::string const& chrName, int32_t const start, int32_t const end, std::string& window) {
+  window.clear();
+  if (end <= start) return true;
+  int32_t seqlen = -1;
+  char* seq = faidx_fetch_seq(fai, chrName.c_str(), start, end - 1, &seqlen);
+  if (seq == NULL) return false;
+  if (seqlen > 0) window = boost::to_upper_copy(std::string(seq, seq + seqlen));
+  free(seq);
+  return true;
+}
+
+// Parse Delly vcf file, sites of an indexed BCF can be restricted to a region (chr, chr:start-end)
 template<typename TConfig, typename TStructuralVariantRecord>
 inline void
-vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>& svs) {
+vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>& svs, std::string const& region) {
   // Load bcf file
   htsFile* ifile = bcf_open(c.vcffile.string().c_str(), "r");
   bcf_hdr_t* hdr = bcf_hdr_read(ifile);
   bcf1_t* rec = bcf_init();
+  hts_idx_t* idx = NULL;
+  hts_itr_t* itr = NULL;
+  int regionBeg = 0;
+  int regionEnd = std::numeric_limits<int>::max();
+  if (!region.empty()) {
+    idx = bcf_index_load(c.vcffile.string().c_str());
+    if (idx != NULL) itr = bcf_itr_querys(idx, hdr, region.c_str());
+    if (itr == NULL) std::cerr << "Warning: No sites in region " << region << " of " << c.vcffile.string() << std::endl;
+    else if (hts_parse_reg(region.c_str(), &regionBeg, &regionEnd) == NULL) {
+      regionBeg = 0;
+      regionEnd = std::numeric_limits<int>::max();
+    }
+  }
 
-  // Parse genome if necessary
+  // Reference windows for consensus sequences
   faidx_t* fai = fai_load(c.genome.string().c_str());
-  char* seq = NULL;
-  int32_t lastRefIndex = -1;
   
   // Parse bcf
   int32_t nsvend = 0;
@@ -194,7 +267,9 @@ vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>&
   int32_t nchr2 = 0;
   char* chr2 = NULL;
   uint16_t wimethod = 0; 
-  while (bcf_read(ifile, hdr, rec) == 0) {
+  while ((region.empty()) ? (bcf_read(ifile, hdr, rec) == 0) : ((itr != NULL) && (bcf_itr_next(ifile, itr, rec) >= 0))) {
+    // The index query also returns sites starting before the region that overlap it
+    if ((rec->pos < regionBeg) || (rec->pos >= regionEnd)) continue;
     bcf_unpack(rec, BCF_UN_INFO);
 
     // Delly BCF file?
@@ -339,33 +414,25 @@ vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>&
 	svRec.ciendlow = -50;
 	svRec.ciendhigh = 50;
 
-	// Lazy loading of reference sequence
-	if ((seq == NULL) || (tid != lastRefIndex)) {
-	  if (seq != NULL) free(seq);
-	  int32_t seqlen = -1;
-	  seq = faidx_fetch_seq(fai, chrName.c_str(), 0, faidx_seq_len(fai, chrName.c_str()), &seqlen);
-	  lastRefIndex = tid;
-	}
-
-	// Build consensus sequence
-	if ((seq != NULL) && ((svRec.svStart + 15 < svRec.svEnd) || (svRec.insLen >= 15))) {
+	// Build consensus sequence from the flanking reference windows
+	if ((svRec.svStart + 15 < svRec.svEnd) || (svRec.insLen >= 15)) {
 	  int32_t buffer = 75;
+	  int32_t prefix = 0;
+	  if (buffer < rec->pos) prefix = rec->pos - buffer;
+	  int32_t suffix = svRec.svEnd + buffer;
+	  std::string pref;
+	  std::string suf;
 	  if (tagUse) {
-	    int32_t prefix = 0;
-	    if (buffer < rec->pos) prefix = rec->pos - buffer;
-	    std::string pref = boost::to_upper_copy(std::string(seq + prefix, seq + rec->pos + 1));
-	    int32_t suffix = svRec.svEnd + buffer;
-	    std::string suf = boost::to_upper_copy(std::string(seq + svRec.svEnd, seq + suffix));
-	    svRec.consensus = pref + suf;
+	    if ((_fetchWindow(fai, chrName, prefix, rec->pos + 1, pref)) && (_fetchWindow(fai, chrName, svRec.svEnd, suffix, suf))) {
+	      svRec.consensus = pref + suf;
+	      svs.push_back(svRec);
+	    }
 	  } else {
-	    int32_t prefix = 0;
-	    if (buffer < rec->pos) prefix = rec->pos - buffer;
-	    std::string pref = boost::to_upper_copy(std::string(seq + prefix, seq + rec->pos));
-	    int32_t suffix = svRec.svEnd + buffer;
-	    std::string suf = boost::to_upper_copy(std::string(seq + svRec.svEnd - 1, seq + suffix));
-	    svRec.consensus = pref + altAllele + suf;
+	    if ((_fetchWindow(fai, chrName, prefix, rec->pos, pref)) && (_fetchWindow(fai, chrName, svRec.svEnd - 1, suffix, suf))) {
+	      svRec.consensus = pref + altAllele + suf;
+	      svs.push_back(svRec);
+	    }
 	  }
-	  svs.push_back(svRec);
 	}
       }
     }
@@ -388,8 +455,9 @@ vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>&
   free(chr2);
 
   // Clean-up index
-  if (seq != NULL) free(seq);
   fai_destroy(fai);
+  if (itr != NULL) hts_itr_destroy(itr);
+  if (idx != NULL) hts_idx_destroy(idx);
   
   // Close VCF
   bcf_hdr_destroy(hdr);
@@ -397,6 +465,188 @@ vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>&
   bcf_destroy(rec);
 }
 
+template<typename TConfig, typename TStructuralVariantRecord>
+inline void
+vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>& svs) {
+  vcfParse(c, hd, svs, std::string());
+}
+
+
+// FORMAT columns of one genotyping output worker
+struct GenotypeBuffers {
+  std::vector<int32_t> gts;
+  std::vector<float> gls;
+  std::vector<int32_t> rcl;
+  std::vector<int32_t> rc;
+  std::vector<int32_t> rcr;
+  std::vector<int32_t> cnest;
+  std::vector<int32_t> drcount;
+  std::vector<int32_t> dvcount;
+  std::vector<int32_t> hp1drcount;
+  std::vector<int32_t> hp2drcount;
+  std::vector<int32_t> hp1dvcount;
+  std::vector<int32_t> hp2dvcount;
+  std::vector<int32_t> rrcount;
+  std::vector<int32_t> rvcount;
+  std::vector<int32_t> hp1rrcount;
+  std::vector<int32_t> hp2rrcount;
+  std::vector<int32_t> hp1rvcount;
+  std::vector<int32_t> hp2rvcount;
+  std::vector<int32_t> gqval;
+  std::vector<std::string> ftarr;
+  std::vector<const char*> strp;
+
+  explicit GenotypeBuffers(uint32_t const n) : gts(2 * n), gls(3 * n), rcl(n), rc(n), rcr(n), cnest(n), drcount(n), dvcount(n), hp1drcount(n), hp2drcount(n), hp1dvcount(n), hp2dvcount(n), rrcount(n), rvcount(n), hp1rrcount(n), hp2rrcount(n), hp1rvcount(n), hp2rvcount(n), gqval(n), ftarr(n), strp(n) {}
+};
+
+// Encode one structural variant, thread-safe for distinct records and buffers
+template<typename TConfig, typename TStructuralVariantRecord, typename TJunctionCountMap, typename TReadCountMap, typename TCountMap>
+inline void
+_vcfOutputRecord(TConfig const& c, bcf_hdr_t* hdr, bam_hdr_t* bamhd, BoLog<double> const& bl, TStructuralVariantRecord const& sv, TJunctionCountMap const& jctCountMap, TReadCountMap const& readCountMap, TCountMap const& spanCountMap, GenotypeBuffers& gb, bcf1_t* rec)
+{
+  // Output main vcf fields
+  int32_t tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "PASS");
+  if (sv.chr == sv.chr2) {
+    // Intra-chromosomal
+    if (((sv.peSupport < 3) || (sv.peMapQuality < 20)) && ((sv.srSupport < 3) || (sv.srMapQuality < 20))) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
+  } else {
+    // Inter-chromosomal
+    if (((sv.peSupport < 5) || (sv.peMapQuality < 20)) && ((sv.srSupport < 5) || (sv.srMapQuality < 20))) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
+  }
+  rec->rid = bcf_hdr_name2id(hdr, bamhd->target_name[sv.chr]);
+  int32_t svStartPos = sv.svStart - 1;
+  if (svStartPos < 1) svStartPos = 1;
+  int32_t svEndPos = sv.svEnd;
+  if (svEndPos < 1) svEndPos = 1;
+  if (svEndPos >= (int32_t) bamhd->target_len[sv.chr2]) svEndPos = bamhd->target_len[sv.chr2] - 1;
+  rec->pos = svStartPos;
+  std::string id(_addID(sv.svt));
+  std::string padNumber = boost::lexical_cast<std::string>(sv.id);
+  padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
+  id += padNumber;
+  bcf_update_id(hdr, rec, id.c_str());
+  std::string alleles = _replaceIUPAC(sv.alleles);
+  bcf_update_alleles_str(hdr, rec, alleles.c_str());
+  bcf_update_filter(hdr, rec, &tmpi, 1);
+
+  // Add INFO fields
+  if (sv.precise) bcf_update_info_flag(hdr, rec, "PRECISE", NULL, 1);
+  else bcf_update_info_flag(hdr, rec, "IMPRECISE", NULL, 1);
+  bcf_update_info_string(hdr, rec, "SVTYPE", _addID(sv.svt).c_str());
+  std::string dellyVersion("EMBL.DELLYv");
+  dellyVersion += dellyVersionNumber;
+  bcf_update_info_string(hdr,rec, "SVMETHOD", dellyVersion.c_str());
+  if (sv.svt < DELLY_SVT_TRANS) {
+    tmpi = svEndPos;
+    bcf_update_info_int32(hdr, rec, "END", &tmpi, 1);
+  } else {
+    tmpi = svStartPos + 2;
+    bcf_update_info_int32(hdr, rec, "END", &tmpi, 1);
+    bcf_update_info_string(hdr,rec, "CHR2", bamhd->target_name[sv.chr2]);
+    tmpi = svEndPos;
+    bcf_update_info_int32(hdr, rec, "POS2", &tmpi, 1);
+  }
+  if (sv.svt == 4) {
+    tmpi = sv.insLen;
+    bcf_update_info_int32(hdr, rec, "SVLEN", &tmpi, 1);
+  }
+  tmpi = sv.peSupport;
+  bcf_update_info_int32(hdr, rec, "PE", &tmpi, 1);
+  tmpi = sv.peMapQuality;
+  bcf_update_info_int32(hdr, rec, "MAPQ", &tmpi, 1);
+  bcf_update_info_string(hdr, rec, "CT", _addOrientation(sv.svt).c_str());
+  int32_t ciend[2];
+  ciend[0] = sv.ciendlow;
+  ciend[1] = sv.ciendhigh;
+  int32_t cipos[2];
+  cipos[0] = sv.ciposlow;
+  cipos[1] = sv.ciposhigh;
+  bcf_update_info_int32(hdr, rec, "CIPOS", cipos, 2);
+  bcf_update_info_int32(hdr, rec, "CIEND", ciend, 2);
+
+  if (sv.precise)  {
+    tmpi = sv.srMapQuality;
+    bcf_update_info_int32(hdr, rec, "SRMAPQ", &tmpi, 1);
+    tmpi = sv.insLen;
+    bcf_update_info_int32(hdr, rec, "INSLEN", &tmpi, 1);
+    tmpi = sv.homLen;
+    bcf_update_info_int32(hdr, rec, "HOMLEN", &tmpi, 1);
+    tmpi = sv.srSupport;
+    bcf_update_info_int32(hdr, rec, "SR", &tmpi, 1);
+    float tmpf = sv.srAlignQuality;
+    bcf_update_info_float(hdr, rec, "SRQ", &tmpf, 1);
+    if (sv.consensus.size()) {
+      bcf_update_info_string(hdr, rec, "CONSENSUS", sv.consensus.c_str());
+      tmpf = entropy(sv.consensus);
+      bcf_update_info_float(hdr, rec, "CE", &tmpf, 1);
+    }
+  }
+
+  // Add genotype columns
+  for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+    gb.drcount[file_c] = spanCountMap[file_c][sv.id].ref.size();
+    gb.dvcount[file_c] = spanCountMap[file_c][sv.id].alt.size();
+    if (c.isHaplotagged) {
+      gb.hp1drcount[file_c] = spanCountMap[file_c][sv.id].refh1;
+      gb.hp2drcount[file_c] = spanCountMap[file_c][sv.id].refh2;
+      gb.hp1dvcount[file_c] = spanCountMap[file_c][sv.id].alth1;
+      gb.hp2dvcount[file_c] = spanCountMap[file_c][sv.id].alth2;
+    }
+    gb.rrcount[file_c] = jctCountMap[file_c][sv.id].ref.size();
+    gb.rvcount[file_c] = jctCountMap[file_c][sv.id].alt.size();
+    if (c.isHaplotagged) {
+      gb.hp1rrcount[file_c] = jctCountMap[file_c][sv.id].refh1;
+      gb.hp2rrcount[file_c] = jctCountMap[file_c][sv.id].refh2;
+      gb.hp1rvcount[file_c] = jctCountMap[file_c][sv.id].alth1;
+      gb.hp2rvcount[file_c] = jctCountMap[file_c][sv.id].alth2;
+    }
+
+    // Compute GLs
+    if (sv.precise) _computeGLs(bl, jctCountMap[file_c][sv.id].ref, jctCountMap[file_c][sv.id].alt, &gb.gls[0], &gb.gqval[0], &gb.gts[0], file_c);
+    else _computeGLs(bl, spanCountMap[file_c][sv.id].ref, spanCountMap[file_c][sv.id].alt, &gb.gls[0], &gb.gqval[0], &gb.gts[0], file_c);
+
+    // Compute RCs
+    gb.rcl[file_c] = readCountMap[file_c][sv.id].leftRC;
+    gb.rc[file_c] = readCountMap[file_c][sv.id].rc;
+    gb.rcr[file_c] = readCountMap[file_c][sv.id].rightRC;
+    gb.cnest[file_c] = -1;
+    if ((gb.rcl[file_c] + gb.rcr[file_c]) > 0) gb.cnest[file_c] = boost::math::iround( 2.0 * (double) gb.rc[file_c] / (double) (gb.rcl[file_c] + gb.rcr[file_c]) );
+
+    // Genotype filter
+    if (gb.gqval[file_c] < 15) gb.ftarr[file_c] = "LowQual";
+    else gb.ftarr[file_c] = "PASS";
+  }
+  int32_t qvalout = sv.mapq;
+  if (qvalout < 0) qvalout = 0;
+  if (qvalout > 10000) qvalout = 10000;
+  rec->qual = qvalout;
+
+  bcf_update_genotypes(hdr, rec, &gb.gts[0], bcf_hdr_nsamples(hdr) * 2);
+  bcf_update_format_float(hdr, rec, "GL",  &gb.gls[0], bcf_hdr_nsamples(hdr) * 3);
+  bcf_update_format_int32(hdr, rec, "GQ", &gb.gqval[0], bcf_hdr_nsamples(hdr));
+  std::transform(gb.ftarr.begin(), gb.ftarr.end(), gb.strp.begin(), cstyle_str());
+  bcf_update_format_string(hdr, rec, "FT", &gb.strp[0], bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RCL", &gb.rcl[0], bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RC", &gb.rc[0], bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RCR", &gb.rcr[0], bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RDCN", &gb.cnest[0], bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "DR", &gb.drcount[0], bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "DV", &gb.dvcount[0], bcf_hdr_nsamples(hdr));
+  if (c.isHaplotagged) {
+    bcf_update_format_int32(hdr, rec, "HP1DR", &gb.hp1drcount[0], bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP2DR", &gb.hp2drcount[0], bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP1DV", &gb.hp1dvcount[0], bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP2DV", &gb.hp2dvcount[0], bcf_hdr_nsamples(hdr));
+  }
+  bcf_update_format_int32(hdr, rec, "RR", &gb.rrcount[0], bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RV", &gb.rvcount[0], bcf_hdr_nsamples(hdr));
+  if (c.isHaplotagged) {
+    bcf_update_format_int32(hdr, rec, "HP1RR", &gb.hp1rrcount[0], bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP2RR", &gb.hp2rrcount[0], bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP1RV", &gb.hp1rvcount[0], bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP2RV", &gb.hp2rvcount[0], bcf_hdr_nsamples(hdr));
+  }
+}
 
 template<typename TConfig, typename TStructuralVariantRecord, typename TJunctionCountMap, typename TReadCountMap, typename TCountMap>
 inline void
@@ -485,228 +735,43 @@ vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJ
   if (bcf_hdr_write(fp, hdr) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
 
   if (!svs.empty()) {
-    // Genotype arrays
-    int32_t *gts = (int*) malloc(bcf_hdr_nsamples(hdr) * 2 * sizeof(int));
-    float *gls = (float*) malloc(bcf_hdr_nsamples(hdr) * 3 * sizeof(float));
-    int32_t *rcl = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *rc = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *rcr = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *cnest = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *drcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *dvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp1drcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp2drcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp1dvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp2dvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *rrcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *rvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp1rrcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp2rrcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp1rvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp2rvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *gqval = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    std::vector<std::string> ftarr;
-    ftarr.resize(bcf_hdr_nsamples(hdr));
-    
-    // Iterate all structural variants
-    typedef std::vector<TStructuralVariantRecord> TSVs;
+    int32_t nthreads = 1;
+#ifdef OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    std::vector<GenotypeBuffers> gb(nthreads, GenotypeBuffers(bcf_hdr_nsamples(hdr)));
+
+    // Iterate all structural variants, blocks of records are encoded in parallel and written in order
     now = boost::posix_time::second_clock::local_time();
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Genotyping" << std::endl;
     boost::progress_display show_progress( svs.size() );
-    bcf1_t *rec = bcf_init();
-    for(typename TSVs::const_iterator svIter = svs.begin(); svIter!=svs.end(); ++svIter) {
-      ++show_progress;
-      if ((svIter->srSupport == 0) && (svIter->peSupport == 0)) continue;
-      
-      // Output main vcf fields
-      int32_t tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "PASS");
-      if (svIter->chr == svIter->chr2) {
-	// Intra-chromosomal
-	if (((svIter->peSupport < 3) || (svIter->peMapQuality < 20)) && ((svIter->srSupport < 3) || (svIter->srMapQuality < 20))) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
-      } else {
-	// Inter-chromosomal
-	if (((svIter->peSupport < 5) || (svIter->peMapQuality < 20)) && ((svIter->srSupport < 5) || (svIter->srMapQuality < 20))) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
-      }
-      rec->rid = bcf_hdr_name2id(hdr, bamhd->target_name[svIter->chr]);
-      int32_t svStartPos = svIter->svStart - 1;
-      if (svStartPos < 1) svStartPos = 1;
-      int32_t svEndPos = svIter->svEnd;
-      if (svEndPos < 1) svEndPos = 1;
-      if (svEndPos >= (int32_t) bamhd->target_len[svIter->chr2]) svEndPos = bamhd->target_len[svIter->chr2] - 1;
-      rec->pos = svStartPos;
-      std::string id(_addID(svIter->svt));
-      std::string padNumber = boost::lexical_cast<std::string>(svIter->id);
-      padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
-      id += padNumber;
-      bcf_update_id(hdr, rec, id.c_str());
-      std::string alleles = _replaceIUPAC(svIter->alleles);
-      bcf_update_alleles_str(hdr, rec, alleles.c_str());
-      bcf_update_filter(hdr, rec, &tmpi, 1);
-      
-      // Add INFO fields
-      if (svIter->precise) bcf_update_info_flag(hdr, rec, "PRECISE", NULL, 1);
-      else bcf_update_info_flag(hdr, rec, "IMPRECISE", NULL, 1);
-      bcf_update_info_string(hdr, rec, "SVTYPE", _addID(svIter->svt).c_str());
-      std::string dellyVersion("EMBL.DELLYv");
-      dellyVersion += dellyVersionNumber;
-      bcf_update_info_string(hdr,rec, "SVMETHOD", dellyVersion.c_str());
-      if (svIter->svt < DELLY_SVT_TRANS) {
-	tmpi = svEndPos;
-	bcf_update_info_int32(hdr, rec, "END", &tmpi, 1);
-      } else {
-	tmpi = svStartPos + 2;
-	bcf_update_info_int32(hdr, rec, "END", &tmpi, 1);
-	bcf_update_info_string(hdr,rec, "CHR2", bamhd->target_name[svIter->chr2]);
-	tmpi = svEndPos;
-	bcf_update_info_int32(hdr, rec, "POS2", &tmpi, 1);
-      }
-      if (svIter->svt == 4) {
-	tmpi = svIter->insLen;
-	bcf_update_info_int32(hdr, rec, "SVLEN", &tmpi, 1);
-      }
-      tmpi = svIter->peSupport;
-      bcf_update_info_int32(hdr, rec, "PE", &tmpi, 1);
-      tmpi = svIter->peMapQuality;
-      bcf_update_info_int32(hdr, rec, "MAPQ", &tmpi, 1);
-      bcf_update_info_string(hdr, rec, "CT", _addOrientation(svIter->svt).c_str());
-      int32_t ciend[2];
-      ciend[0] = svIter->ciendlow;
-      ciend[1] = svIter->ciendhigh;
-      int32_t cipos[2];
-      cipos[0] = svIter->ciposlow;
-      cipos[1] = svIter->ciposhigh;
-      bcf_update_info_int32(hdr, rec, "CIPOS", cipos, 2);
-      bcf_update_info_int32(hdr, rec, "CIEND", ciend, 2);
-      
-      if (svIter->precise)  {
-	tmpi = svIter->srMapQuality;
-	bcf_update_info_int32(hdr, rec, "SRMAPQ", &tmpi, 1);
-	tmpi = svIter->insLen;
-	bcf_update_info_int32(hdr, rec, "INSLEN", &tmpi, 1);
-	tmpi = svIter->homLen;
-	bcf_update_info_int32(hdr, rec, "HOMLEN", &tmpi, 1);
-	tmpi = svIter->srSupport;
-	bcf_update_info_int32(hdr, rec, "SR", &tmpi, 1);
-	float tmpf = svIter->srAlignQuality;
-	bcf_update_info_float(hdr, rec, "SRQ", &tmpf, 1);
-	if (svIter->consensus.size()) {
-	  bcf_update_info_string(hdr, rec, "CONSENSUS", svIter->consensus.c_str());
-	  tmpf = entropy(svIter->consensus);
-	  bcf_update_info_float(hdr, rec, "CE", &tmpf, 1);
-	}
+    std::vector<bcf1_t*> batch(DELLY_BCF_BATCH * nthreads);
+    for(uint32_t k = 0; k < batch.size(); ++k) batch[k] = bcf_init();
+    std::vector<uint8_t> encoded(batch.size(), 0);
+    for(uint32_t first = 0; first < svs.size(); first += batch.size()) {
+      int32_t nrec = std::min((uint32_t) batch.size(), (uint32_t) (svs.size() - first));
+#pragma omp parallel for default(shared) schedule(dynamic)
+      for(int32_t k = 0; k < nrec; ++k) {
+	int32_t t = 0;
+#ifdef OPENMP
+	t = omp_get_thread_num();
+#endif
+	encoded[k] = 0;
+	if ((svs[first + k].srSupport == 0) && (svs[first + k].peSupport == 0)) continue;
+	_vcfOutputRecord(c, hdr, bamhd, bl, svs[first + k], jctCountMap, readCountMap, spanCountMap, gb[t], batch[k]);
+	encoded[k] = 1;
       }
-      
-      // Add genotype columns
-      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-	// Counters
-	rcl[file_c] = 0;
-	rc[file_c] = 0;
-	rcr[file_c] = 0;
-	cnest[file_c] = 0;
-	drcount[file_c] = 0;
-	dvcount[file_c] = 0;
-	if (c.isHaplotagged) {
-	  hp1drcount[file_c] = 0;
-	  hp2drcount[file_c] = 0;
-	  hp1dvcount[file_c] = 0;
-	  hp2dvcount[file_c] = 0;
-	}
-	rrcount[file_c] = 0;
-	rvcount[file_c] = 0;
-	if (c.isHaplotagged) {
-	  hp1rrcount[file_c] = 0;
-	  hp2rrcount[file_c] = 0;
-	  hp1rvcount[file_c] = 0;
-	  hp2rvcount[file_c] = 0;
-	}
-	drcount[file_c] = spanCountMap[file_c][svIter->id].ref.size();
-	dvcount[file_c] = spanCountMap[file_c][svIter->id].alt.size();
-	if (c.isHaplotagged) {
-	  hp1drcount[file_c] = spanCountMap[file_c][svIter->id].refh1;
-	  hp2drcount[file_c] = spanCountMap[file_c][svIter->id].refh2;
-	  hp1dvcount[file_c] = spanCountMap[file_c][svIter->id].alth1;
-	  hp2dvcount[file_c] = spanCountMap[file_c][svIter->id].alth2;
-	}
-	rrcount[file_c] = jctCountMap[file_c][svIter->id].ref.size();
-	rvcount[file_c] = jctCountMap[file_c][svIter->id].alt.size();
-	if (c.isHaplotagged) {
-	  hp1rrcount[file_c] = jctCountMap[file_c][svIter->id].refh1;
-	  hp2rrcount[file_c] = jctCountMap[file_c][svIter->id].refh2;
-	  hp1rvcount[file_c] = jctCountMap[file_c][svIter->id].alth1;
-	  hp2rvcount[file_c] = jctCountMap[file_c][svIter->id].alth2;
+
+      // Write in input order
+      for(int32_t k = 0; k < nrec; ++k) {
+	++show_progress;
+	if (encoded[k]) {
+	  bcf_write1(fp, hdr, batch[k]);
+	  bcf_clear1(batch[k]);
 	}
-	
-	// Compute GLs
-	if (svIter->precise) _computeGLs(bl, jctCountMap[file_c][svIter->id].ref, jctCountMap[file_c][svIter->id].alt, gls, gqval, gts, file_c);
-	else _computeGLs(bl, spanCountMap[file_c][svIter->id].ref, spanCountMap[file_c][svIter->id].alt, gls, gqval, gts, file_c);
-	
-	// Compute RCs
-	rcl[file_c] = readCountMap[file_c][svIter->id].leftRC;
-	rc[file_c] = readCountMap[file_c][svIter->id].rc;
-	rcr[file_c] = readCountMap[file_c][svIter->id].rightRC;
-	cnest[file_c] = -1;
-	if ((rcl[file_c] + rcr[file_c]) > 0) cnest[file_c] = boost::math::iround( 2.0 * (double) rc[file_c] / (double) (rcl[file_c] + rcr[file_c]) );
-      
-	// Genotype filter
-	if (gqval[file_c] < 15) ftarr[file_c] = "LowQual";
-	else ftarr[file_c] = "PASS";
       }
-      int32_t qvalout = svIter->mapq;
-      if (qvalout < 0) qvalout = 0;
-      if (qvalout > 10000) qvalout = 10000;
-      rec->qual = qvalout;
-      
-      bcf_update_genotypes(hdr, rec, gts, bcf_hdr_nsamples(hdr) * 2);
-      bcf_update_format_float(hdr, rec, "GL",  gls, bcf_hdr_nsamples(hdr) * 3);
-      bcf_update_format_int32(hdr, rec, "GQ", gqval, bcf_hdr_nsamples(hdr));
-      std::vector<const char*> strp(bcf_hdr_nsamples(hdr));
-      std::transform(ftarr.begin(), ftarr.end(), strp.begin(), cstyle_str());
-      bcf_update_format_string(hdr, rec, "FT", &strp[0], bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RCL", rcl, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RC", rc, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RCR", rcr, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RDCN", cnest, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "DR", drcount, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "DV", dvcount, bcf_hdr_nsamples(hdr));
-      if (c.isHaplotagged) {
-	bcf_update_format_int32(hdr, rec, "HP1DR", hp1drcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP2DR", hp2drcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP1DV", hp1dvcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP2DV", hp2dvcount, bcf_hdr_nsamples(hdr));
-      }
-      bcf_update_format_int32(hdr, rec, "RR", rrcount, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RV", rvcount, bcf_hdr_nsamples(hdr));
-      if (c.isHaplotagged) {
-	bcf_update_format_int32(hdr, rec, "HP1RR", hp1rrcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP2RR", hp2rrcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP1RV", hp1rvcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP2RV", hp2rvcount, bcf_hdr_nsamples(hdr));
-      }
-      bcf_write1(fp, hdr, rec);
-      bcf_clear1(rec);
     }
-    bcf_destroy1(rec);
-    
-    // Clean-up
-    free(gts);
-    free(gls);
-    free(rcl);
-    free(rc);
-    free(rcr);
-    free(cnest);
-    free(drcount);
-    free(dvcount);
-    free(hp1drcount);
-    free(hp2drcount);
-    free(hp1dvcount);
-    free(hp2dvcount);
-    free(rrcount);
-    free(rvcount);
-    free(hp1rrcount);
-    free(hp2rrcount);
-    free(hp1rvcount);
-    free(hp2rvcount);
-    free(gqval);
+    for(uint32_t k = 0; k < batch.size(); ++k) bcf_destroy1(batch[k]);
   }
 
   // Close BAM file
@@ -42,6 +42,57 @@ namespace torali
   }
 
 
+  template<typename TAlignConfig, typename TScoreObject, typename TScoreValue>
+  inline void
+  _longNeedleRow(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc, std::size_t const row, TScoreValue const* prev, TScoreValue* cur)
+  {
+    std::size_t m = s1.size();
+    std::size_t n = s2.size();
+    if (row == 0) {
+      cur[0] = 0;
+      for(std::size_t col = 1; col <= n; ++col) cur[col] = cur[col-1] + _horizontalGap(ac, 0, m, sc.ge);
+    } else {
+      cur[0] = prev[0] + _verticalGap(ac, 0, n, sc.ge);
+      for(std::size_t col = 1; col <= n; ++col)
+	cur[col] = std::max(std::max(prev[col-1] + (s1[row-1] == s2[col-1] ? sc.match : sc.mismatch), prev[col] + _verticalGap(ac, col, n, sc.ge)), cur[col-1] + _horizontalGap(ac, row, m, sc.ge));
+    }
+  }
+
+  template<typename TAlignConfig, typename TScoreObject, typename TScoreValue>
+  inline TScoreValue
+  _longNeedleCheckpoints(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc, std::size_t const blockRows, std::size_t const numBlocks, std::vector<TScoreValue>& checkpoints)
+  {
+    std::size_t m = s1.size();
+    std::size_t mf = s2.size() + 1;
+    checkpoints.resize(numBlocks * mf);
+    std::vector<TScoreValue> prev(mf, 0);
+    std::vector<TScoreValue> cur(mf, 0);
+    for(std::size_t row = 0; row <= m; ++row) {
+      _longNeedleRow(s1, s2, ac, sc, row, &prev[0], &cur[0]);
+      if ((row % blockRows == 0) && (row / blockRows < numBlocks)) std::copy(cur.begin(), cur.end(), checkpoints.begin() + (row / blockRows) * mf);
+      prev.swap(cur);
+    }
+    return prev[mf - 1];
+  }
+
+  template<typename TAlignConfig, typename TScoreObject, typename TScoreValue>
+  inline void
+  _longNeedleBlock(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc, std::vector<TScoreValue> const& checkpoints, std::size_t const blockRows, std::size_t const block, std::vector<TScoreValue>& mat, std::size_t& loaded)
+  {
+    if (block == loaded) return;
+    loaded = block;
+
+    // Block holds rows [rowStart, rowEnd], row rowStart is a checkpoint
+    std::size_t m = s1.size();
+    std::size_t mf = s2.size() + 1;
+    std::size_t rowStart = block * blockRows;
+    std::size_t rowEnd = std::min(rowStart + blockRows, m);
+    mat.resize((rowEnd - rowStart + 1) * mf);
+    if (rowStart == 0) _longNeedleRow(s1, s2, ac, sc, 0, &mat[0], &mat[0]);
+    else std::copy(checkpoints.begin() + block * mf, checkpoints.begin() + (block + 1) * mf, mat.begin());
+    for(std::size_t row = rowStart + 1; row <= rowEnd; ++row) _longNeedleRow(s1, s2, ac, sc, row, &mat[(row - rowStart - 1) * mf], &mat[(row - rowStart) * mf]);
+  }
+
   template<typename TAlign, typename TAlignConfig, typename TScoreObject>
   inline bool
   longNeedle(std::string const& s1, std::string const& s2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
@@ -49,21 +100,19 @@ namespace torali
     typedef typename TScoreObject::TValue TScoreValue;
     typedef typename TAlign::index TAIndex;
 
-    // DP Matrix
-    typedef boost::multi_array<TScoreValue, 2> TMatrix;
+    // DP Matrix, large alignments keep only row checkpoints and recompute row blocks on demand
+    typedef std::vector<TScoreValue> TMatrix;
     std::size_t m = s1.size();
     std::size_t n = s2.size();
-    TMatrix mat(boost::extents[m+1][n+1]);
-
-    // Initialization
-    mat[0][0] = 0;
-    for(std::size_t col = 1; col <= n; ++col) mat[0][col] = mat[0][col-1] + _horizontalGap(ac, 0, m, sc.ge);
-    for(std::size_t row = 1; row <= m; ++row) mat[row][0] = mat[row-1][0] + _verticalGap(ac, 0, n, sc.ge);
-
-    // Forward alignment
-    for(std::size_t row = 1; row <= m; ++row)
-      for(std::size_t col = 1; col <= n; ++col)
-	mat[row][col] = std::max(std::max(mat[row-1][col-1] + (s1[row-1] == s2[col-1] ? sc.match : sc.mismatch), mat[row-1][col] + _verticalGap(ac, col, n, sc.ge)), mat[row][col-1] + _horizontalGap(ac, row, m, sc.ge));
+    std::size_t mf = n + 1;
+    std::size_t blockRows = std::max(_traceBlockRows(m, n), (std::size_t) 1);
+    std::size_t numBlocks = std::max((m + blockRows - 1) / blockRows, (std::size_t) 1);
+    TMatrix mat;
+    TMatrix rev;
+    TMatrix matCheck;
+    TMatrix revCheck;
+    std::size_t matBlock = numBlocks;
+    std::size_t revBlock = numBlocks;
 
     // Reverse input sequences
     std::string sRev1 = s1;
@@ -71,96 +120,79 @@ namespace torali
     std::string sRev2 = s2;
     reverseComplement(sRev2);
 
-    // Reverse alignment
-    TMatrix rev(boost::extents[m+1][n+1]);
-    rev[0][0] = 0;
-    for(std::size_t col = 1; col <= n; ++col) rev[0][col] = rev[0][col-1] + _horizontalGap(ac, 0, m, sc.ge);
-    for(std::size_t row = 1; row <= m; ++row) rev[row][0] = rev[row-1][0] + _verticalGap(ac, 0, n, sc.ge);
-    for(std::size_t row = 1; row <= m; ++row)
-      for(std::size_t col = 1; col <= n; ++col)
-	rev[row][col] = std::max(std::max(rev[row-1][col-1] + (sRev1[row-1] == sRev2[col-1] ? sc.match : sc.mismatch), rev[row-1][col] + _verticalGap(ac, col, n, sc.ge)), rev[row][col-1] + _horizontalGap(ac, row, m, sc.ge));
+    // Forward and reverse alignment
+    TScoreValue fwdScore = 0;
+    TScoreValue revScore = 0;
+    if (numBlocks > 1) {
+      fwdScore = _longNeedleCheckpoints(s1, s2, ac, sc, blockRows, numBlocks, matCheck);
+      revScore = _longNeedleCheckpoints(sRev1, sRev2, ac, sc, blockRows, numBlocks, revCheck);
+    } else {
+      _longNeedleBlock(s1, s2, ac, sc, matCheck, blockRows, 0, mat, matBlock);
+      _longNeedleBlock(sRev1, sRev2, ac, sc, revCheck, blockRows, 0, rev, revBlock);
+      fwdScore = mat[m * mf + n];
+      revScore = rev[m * mf + n];
+    }
 
-    if (mat[m][n] != rev[m][n]) {
+    if (fwdScore != revScore) {
       //std::cerr << "Warning: Alignment scores disagree!" << std::endl;
       return false;
     } else {
-      // Find best join
-      TMatrix bestMat(boost::extents[m+1][n+1]);
-      for(std::size_t row = 0; row <= m; ++row) {
-	bestMat[row][0] = mat[row][0];
-	for(std::size_t col = 1; col <= n; ++col) {
-	  if (mat[row][col] > bestMat[row][col-1]) bestMat[row][col] = mat[row][col];
-	  else bestMat[row][col] = bestMat[row][col-1];
-	}
-      }
-      TMatrix bestRev(boost::extents[m+1][n+1]);
-      for(std::size_t row = 0; row <= m; ++row) {
-	bestRev[row][0] = rev[row][0];
-	for(std::size_t col = 1; col <= n; ++col) {
-	  if (rev[row][col] > bestRev[row][col-1]) bestRev[row][col] = rev[row][col];
-	  else bestRev[row][col] = bestRev[row][col-1];
-	}
-      }
-      TScoreValue bestScore = mat[m][n];
+      // Find best join, forward rows ascending and reverse rows descending
+      TMatrix bestMat(mf);
+      TMatrix bestRev(mf);
+      TScoreValue bestScore = fwdScore;
+      TScoreValue bestFwd = 0;
       std::size_t consLeft = 0;
       std::size_t refLeft = 0;
       for(std::size_t row = 0; row<=m; ++row) {
+	_longNeedleBlock(s1, s2, ac, sc, matCheck, blockRows, std::min(row / blockRows, numBlocks - 1), mat, matBlock);
+	_longNeedleBlock(sRev1, sRev2, ac, sc, revCheck, blockRows, std::min((m - row) / blockRows, numBlocks - 1), rev, revBlock);
+	TScoreValue const* matRow = &mat[(row - matBlock * blockRows) * mf];
+	TScoreValue const* revRow = &rev[((m - row) - revBlock * blockRows) * mf];
+	bestMat[0] = matRow[0];
+	bestRev[0] = revRow[0];
+	for(std::size_t col = 1; col <= n; ++col) {
+	  if (matRow[col] > bestMat[col-1]) bestMat[col] = matRow[col];
+	  else bestMat[col] = bestMat[col-1];
+	  if (revRow[col] > bestRev[col-1]) bestRev[col] = revRow[col];
+	  else bestRev[col] = bestRev[col-1];
+	}
 	for(std::size_t col = 0; col<=n; ++col) {
-	  if (bestMat[row][col]+bestRev[m-row][n-col] > bestScore) {
-	    bestScore=bestMat[row][col]+bestRev[m-row][n-col];
+	  if (bestMat[col]+bestRev[n-col] > bestScore) {
+	    bestScore=bestMat[col]+bestRev[n-col];
+	    bestFwd = matRow[col];
 	    consLeft = row;
 	    refLeft = col;
 	  }
 	}
       }
+
+      // Better split found?
+      if (bestScore == fwdScore) return false; // No split found
+
+      // Find right bound
       std::size_t consRight = m - consLeft;
       std::size_t refRight = 0;
-      // Find right bound
+      _longNeedleBlock(sRev1, sRev2, ac, sc, revCheck, blockRows, std::min(consRight / blockRows, numBlocks - 1), rev, revBlock);
+      TScoreValue const* revRight = &rev[(consRight - revBlock * blockRows) * mf];
       for(std::size_t right = 0; right<=(n-refLeft); ++right) {
-	if (mat[consLeft][refLeft] + rev[consRight][right] == bestScore) {
+	if (bestFwd + revRight[right] == bestScore) {
 	  refRight = right;
 	}
       }
 
-      // Debug best join
-      /*
-      TScoreValue bScore = mat[m][n];
-      std::size_t cLeft = 0;
-      std::size_t cRight = 0;
-      std::size_t rLeft = 0;
-      std::size_t rRight = 0;
-      for(std::size_t fwdcut = 0; fwdcut<=m; ++fwdcut) {
-	std::size_t revcut = m - fwdcut;
-	// Iterate all valid collinear alignments on the reference
-	for(std::size_t left = 0; left<=n; ++left) {
-	  for(std::size_t right = 0; right<=(n-left); ++right) {
-	    if (mat[fwdcut][left] + rev[revcut][right] > bScore) {
-	      bScore = mat[fwdcut][left] + rev[revcut][right];
-	      cLeft = fwdcut;
-	      cRight = revcut;
-	      rLeft = left;
-	      rRight = right;
-	    }
-	  }
-	}
-      }
-      std::cerr << mat[m][n] << ',' << bScore << ';' << s1.size() << ',' << s2.size() << ';' << cLeft << ',' << (m-cRight) << ',' << rLeft << ',' << (n-rRight) << std::endl;
-      std::cerr << mat[m][n] << ',' << bestScore << ';' << s1.size() << ',' << s2.size() << ';' << consLeft << ',' << (m-consRight) << ',' << refLeft << ',' << (n-refRight) << std::endl;
-      */
-
-      // Better split found?
-      if (bestScore == mat[m][n]) return false; // No split found
-
       // Trace-back fwd
       std::size_t rr = consLeft;
       std::size_t cc = refLeft;
       typedef std::vector<char> TTrace;
       TTrace trace;
       while ((rr>0) || (cc>0)) {
-	if ((rr>0) && (mat[rr][cc] == mat[rr-1][cc] + _verticalGap(ac, cc, n, sc.ge))) {
+	_longNeedleBlock(s1, s2, ac, sc, matCheck, blockRows, (rr > 0) ? std::min((rr - 1) / blockRows, numBlocks - 1) : 0, mat, matBlock);
+	std::size_t idx = (rr - matBlock * blockRows) * mf + cc;
+	if ((rr>0) && (mat[idx] == mat[idx - mf] + _verticalGap(ac, cc, n, sc.ge))) {
 	  --rr;
 	  trace.push_back('v');
-	} else if ((cc>0) && (mat[rr][cc] == mat[rr][cc-1] + _horizontalGap(ac, rr, m, sc.ge))) {
+	} else if ((cc>0) && (mat[idx] == mat[idx - 1] + _horizontalGap(ac, rr, m, sc.ge))) {
 	  --cc;
 	  trace.push_back('h');
 	} else {
@@ -178,10 +210,12 @@ namespace torali
       typedef std::vector<char> TTrace;
       TTrace rtrace;
       while ((rr>0) || (cc>0)) {
-	if ((rr>0) && (rev[rr][cc] == rev[rr-1][cc] + _verticalGap(ac, cc, n, sc.ge))) {
+	_longNeedleBlock(sRev1, sRev2, ac, sc, revCheck, blockRows, (rr > 0) ? std::min((rr - 1) / blockRows, numBlocks - 1) : 0, rev, revBlock);
+	std::size_t idx = (rr - revBlock * blockRows) * mf + cc;
+	if ((rr>0) && (rev[idx] == rev[idx - mf] + _verticalGap(ac, cc, n, sc.ge))) {
 	  --rr;
 	  rtrace.push_back('v');
-	} else if ((cc>0) && (rev[rr][cc] == rev[rr][cc-1] + _horizontalGap(ac, rr, m, sc.ge))) {
+	} else if ((cc>0) && (rev[idx] == rev[idx - 1] + _horizontalGap(ac, rr, m, sc.ge))) {
 	  --cc;
 	  rtrace.push_back('h');
 	} else {
@@ -228,41 +262,38 @@ namespace torali
   {
     typedef typename TScoreObject::TValue TScoreValue;
 
-    // DP Matrix
+    // DP Matrix, previous and current row
     std::size_t m = _size(a1, 1);
     std::size_t n = _size(a2, 1);
     std::vector<TScoreValue> s(n+1, 0);
-    TScoreValue prevsub = 0;
+    std::vector<TScoreValue> sNew(n+1, 0);
+    std::vector<TScoreValue> sub(n+1, 0);
 
-    // Create profile
-    typedef boost::multi_array<double, 2> TProfile;
-    TProfile p1;
-    TProfile p2;
+    // Create integer profile
+    CountProfile p1;
+    CountProfile p2;
     if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
-      _createProfile(a1, p1);
-      _createProfile(a2, p2);
+      _createProfile(a1, sc, p1);
+      _createProfile(a2, sc, p2);
     }
 
+    // Initialization
+    s[0] = 0;
+    for(std::size_t col = 1; col <= n; ++col) s[col] = _horizontalGap(ac, 0, m, col * sc.ge);
+
     // DP
-    for(std::size_t row = 0; row <= m; ++row) {
-      for(std::size_t col = 0; col <= n; ++col) {
-	// Initialization
-	if ((row == 0) && (col == 0)) {
-	  s[0] = 0;
-	  prevsub = 0;
-	} else if (row == 0) {
-	  s[col] = _horizontalGap(ac, 0, m, col * sc.ge);
-	} else if (col == 0) {
-	  s[0] = _verticalGap(ac, 0, n, row * sc.ge);
-	  if (row - 1 == 0) prevsub = 0;
-	  else prevsub = _verticalGap(ac, 0, n, (row - 1) * sc.ge);
-	} else {
-	  // Recursion
-	  TScoreValue prevprevsub = prevsub;
-	  prevsub = s[col];
-	  s[col] = std::max(std::max(prevprevsub + _score(a1, a2, p1, p2, row-1, col-1, sc), prevsub + _verticalGap(ac, col, n, sc.ge)), s[col-1] + _horizontalGap(ac, row, m, sc.ge));
-	}
-      }
+    for(std::size_t row = 1; row <= m; ++row) {
+      // Substitution scores of this row
+      for(std::size_t col = 1; col <= n; ++col) sub[col] = _score(a1, a2, p1, p2, row-1, col-1, sc);
+
+      // Diagonal and vertical moves only depend on the previous row
+      sNew[0] = _verticalGap(ac, 0, n, row * sc.ge);
+      for(std::size_t col = 1; col <= n; ++col) sNew[col] = std::max(s[col-1] + sub[col], s[col] + _verticalGap(ac, col, n, sc.ge));
+
+      // Horizontal moves
+      TScoreValue hozExt = _horizontalGap(ac, row, m, sc.ge);
+      for(std::size_t col = 1; col <= n; ++col) sNew[col] = std::max(sNew[col], sNew[col-1] + hozExt);
+      s.swap(sNew);
     }
 
     // Score
@@ -270,13 +301,13 @@ namespace torali
   }
 
 
-  template<typename TAlignConfig, typename TScoreObject>
+  template<typename TSequence, typename TAlignConfig, typename TScoreObject>
   inline int32_t
-  needleBanded(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc)
+  needleBanded(std::string const& s1, TSequence const& s2, TAlignConfig const& ac, TScoreObject const& sc)
   {
     typedef typename TScoreObject::TValue TScoreValue;
 
-    // DP Matrix
+    // DP Matrix, previous and current row
     int32_t m = s1.size();
     int32_t n = s2.size();
     int32_t band = 100;
@@ -285,71 +316,53 @@ namespace torali
     if (m < n) highBand += n - m;
     else lowBand += m - n;
     std::vector<TScoreValue> s(n+1, 0);
-    TScoreValue prevsub = 0;
-    TScoreValue prevprevsub = 0;
+    std::vector<TScoreValue> sNew(n+1, 0);
+
+    // Initialization
+    s[0] = 0;
+    for(int32_t col = 1; col <= std::min(n, highBand); ++col) s[col] = _horizontalGap(ac, 0, m, col * sc.ge);
 
     // DP
-    for(int32_t row = 0; row <= m; ++row) {
-      for(int32_t col = std::max(0, row - lowBand); col <= std::min(n, row + highBand); ++col) {
-	// Initialization
-	if ((row == 0) && (col == 0)) {
-	  s[0] = 0;
-	  prevsub = 0;
-	} else if (row == 0) {
-	  s[col] = _horizontalGap(ac, 0, m, col * sc.ge);
-	} else if (col == 0) {
-	  s[0] = _verticalGap(ac, 0, n, row * sc.ge);
-	  if (row - 1 == 0) prevsub = 0;
-	  else prevsub = _verticalGap(ac, 0, n, (row - 1) * sc.ge);
-	} else {
-	  // Recursion
-	  prevprevsub = prevsub;
-	  prevsub = s[col];
-	  if (col == row - lowBand) {
-	    prevprevsub = s[col-1];
-	    s[col - 1] = DELLY_OUTOFBAND;
-	  } else if (col == row + highBand) prevsub = DELLY_OUTOFBAND;
-	  s[col] = std::max(std::max(prevprevsub + (s1[row-1] == s2[col-1] ? sc.match : sc.mismatch), prevsub + _verticalGap(ac, col, n, sc.ge)), s[col-1] + _horizontalGap(ac, row, m, sc.ge));
-	}
+    for(int32_t row = 1; row <= m; ++row) {
+      int32_t colStart = std::max(0, row - lowBand);
+      int32_t colEnd = std::min(n, row + highBand);
+      int32_t prevEnd = std::min(n, row - 1 + highBand);
+      char c1 = s1[row-1];
+      if (colStart == 0) {
+	sNew[0] = _verticalGap(ac, 0, n, row * sc.ge);
+	colStart = 1;
       }
+
+      // Diagonal and vertical moves, the previous row ends at prevEnd
+      int32_t colMid = std::min(colEnd, prevEnd);
+      for(int32_t col = colStart; col <= colMid; ++col) sNew[col] = std::max(s[col-1] + (c1 == s2[col-1] ? sc.match : sc.mismatch), s[col] + _verticalGap(ac, col, n, sc.ge));
+      for(int32_t col = colMid + 1; col <= colEnd; ++col) sNew[col] = std::max(s[col-1] + (c1 == s2[col-1] ? sc.match : sc.mismatch), (TScoreValue) DELLY_OUTOFBAND + _verticalGap(ac, col, n, sc.ge));
+
+      // Horizontal moves, the first cell of a band starting after column 0 has no left neighbour
+      TScoreValue hozExt = _horizontalGap(ac, row, m, sc.ge);
+      if ((colStart <= colEnd) && (colStart == row - lowBand)) sNew[colStart] = std::max(sNew[colStart], (TScoreValue) DELLY_OUTOFBAND + hozExt);
+      else if (colStart <= colEnd) sNew[colStart] = std::max(sNew[colStart], sNew[colStart-1] + hozExt);
+      for(int32_t col = colStart + 1; col <= colEnd; ++col) sNew[col] = std::max(sNew[col], sNew[col-1] + hozExt);
+      s.swap(sNew);
     }
 	
     // Score
     return s[n];
   }
 
-
-
-  
-  template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig, typename TScoreObject>
-  inline int
-  needle(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
+  template<typename TAlign1, typename TAlign2, typename TAlignConfig, typename TScoreObject, typename TProfile, typename TScoreValue, typename TBitSet>
+  inline void
+  _needleRows(TAlign1 const& a1, TAlign2 const& a2, TAlignConfig const& ac, TScoreObject const& sc, TProfile const& p1, TProfile const& p2, std::size_t const rowStart, std::size_t const rowEnd, std::vector<TScoreValue>& s, bool const trace, TBitSet& bit3, TBitSet& bit4)
   {
-    typedef typename TScoreObject::TValue TScoreValue;
-
-    // DP Matrix
+    // DP variables
     std::size_t m = _size(a1, 1);
     std::size_t n = _size(a2, 1);
-    std::vector<TScoreValue> s(n+1, 0);
-    TScoreValue prevsub = 0;
-
-    // Trace Matrix
     std::size_t mf = n+1;
-    typedef boost::dynamic_bitset<> TBitSet;
-    TBitSet bit3( (m+1) * (n+1), false);
-    TBitSet bit4( (m+1) * (n+1), false);
-    
-    // Create profile
-    typedef boost::multi_array<double, 2> TProfile;
-    TProfile p1;
-    TProfile p2;
-    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
-      _createProfile(a1, p1);
-      _createProfile(a2, p2);
-    }
+    TScoreValue prevsub = 0;
 
-    // DP
-    for(std::size_t row = 0; row <= m; ++row) {
+    // DP of rows [rowStart, rowEnd), trace bits are relative to rowStart
+    for(std::size_t row = rowStart; row < rowEnd; ++row) {
+      std::size_t off = (row - rowStart) * mf;
       for(std::size_t col = 0; col <= n; ++col) {
 	// Initialization
 	if ((row == 0) && (col == 0)) {
@@ -357,12 +370,12 @@ namespace torali
 	  prevsub = 0;
 	} else if (row == 0) {
 	  s[col] = _horizontalGap(ac, 0, m, col * sc.ge);
-	  bit3[col] = true;
+	  if (trace) bit3[off + col] = true;
 	} else if (col == 0) {
 	  s[0] = _verticalGap(ac, 0, n, row * sc.ge);
 	  if (row - 1 == 0) prevsub = 0;
 	  else prevsub = _verticalGap(ac, 0, n, (row - 1) * sc.ge);
-	  bit4[row * mf] = true;
+	  if (trace) bit4[off] = true;
 	} else {
 	  // Recursion
 	  TScoreValue prevprevsub = prevsub;
@@ -370,28 +383,78 @@ namespace torali
 	  s[col] = std::max(std::max(prevprevsub + _score(a1, a2, p1, p2, row-1, col-1, sc), prevsub + _verticalGap(ac, col, n, sc.ge)), s[col-1] + _horizontalGap(ac, row, m, sc.ge));
 
 	  // Trace
-	  if (s[col] ==  s[col-1] + _horizontalGap(ac, row, m, sc.ge)) bit3[row * mf + col] = true;
-	  else if (s[col] == prevsub + _verticalGap(ac, col, n, sc.ge)) bit4[row * mf + col] = true;
+	  if (trace) {
+	    if (s[col] ==  s[col-1] + _horizontalGap(ac, row, m, sc.ge)) bit3[off + col] = true;
+	    else if (s[col] == prevsub + _verticalGap(ac, col, n, sc.ge)) bit4[off + col] = true;
+	  }
 	}
       }
     }
+  }
+  
+  template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig, typename TScoreObject>
+  inline int
+  needle(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+    typedef typename TScoreObject::TValue TScoreValue;
+
+    // DP Matrix
+    std::size_t m = _size(a1, 1);
+    std::size_t n = _size(a2, 1);
+    typedef std::vector<TScoreValue> TScoreRow;
+    TScoreRow s(n+1, 0);
+
+    // Create integer profile
+    CountProfile p1;
+    CountProfile p2;
+    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
+      _createProfile(a1, sc, p1);
+      _createProfile(a2, sc, p2);
+    }
+
+    // Trace blocks, large alignments keep only row checkpoints and recompute the trace per block
+    std::size_t mf = n+1;
+    std::size_t blockRows = _traceBlockRows(m, n);
+    std::size_t numBlocks = (m + blockRows) / blockRows;
+    typedef boost::dynamic_bitset<> TBitSet;
+    TBitSet bit3;
+    TBitSet bit4;
+    std::vector<TScoreRow> checkS(numBlocks);
+    if (numBlocks > 1) {
+      for(std::size_t b = 0; b < numBlocks; ++b) {
+	if (b) checkS[b] = s;
+	_needleRows(a1, a2, ac, sc, p1, p2, b * blockRows, std::min((b + 1) * blockRows, m + 1), s, false, bit3, bit4);
+      }
+    }
 	
     // Trace-back using pointers
+    TScoreValue score = 0;
     std::size_t row = m;
     std::size_t col = n;
     typedef std::vector<char> TTrace;
     TTrace trace;
-    while ((row>0) || (col>0)) {
-      if (bit3[row * mf + col]) {
-	--col;
-	trace.push_back('h');
-      } else if (bit4[row * mf + col]) {
-	--row;
-	trace.push_back('v');
-      } else {
-	--row;
-	--col;
-	trace.push_back('s');
+    for(std::size_t b = numBlocks; b > 0; --b) {
+      std::size_t rowStart = (b - 1) * blockRows;
+      bit3.clear();
+      bit3.resize(blockRows * mf, false);
+      bit4.clear();
+      bit4.resize(blockRows * mf, false);
+      if (b > 1) s = checkS[b - 1];
+      _needleRows(a1, a2, ac, sc, p1, p2, rowStart, std::min(rowStart + blockRows, m + 1), s, true, bit3, bit4);
+      if (b == numBlocks) score = s[n];
+      while (((row>0) || (col>0)) && (row >= rowStart)) {
+	std::size_t idx = (row - rowStart) * mf + col;
+	if (bit3[idx]) {
+	  --col;
+	  trace.push_back('h');
+	} else if (bit4[idx]) {
+	  --row;
+	  trace.push_back('v');
+	} else {
+	  --row;
+	  --col;
+	  trace.push_back('s');
+	}
       }
     }
 
@@ -399,7 +462,7 @@ namespace torali
     _createAlignment(trace, a1, a2, align);
 
     // Score
-    return s[n];
+    return score;
   }
 
   template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig>
@@ -194,28 +194,12 @@ namespace torali
 
 	int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
 	if (rec->core.flag & BAM_FPAIRED) {
-	  // Clean-up the read store for identical alignment positions
-	  if (rec->core.pos > lastAlignedPos) {
-	    lastAlignedPosReads.clear();
-	    lastAlignedPos = rec->core.pos;
-	  }
-	
-	  if ((rec->core.pos < rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (lastAlignedPosReads.find(hash_string(bam_get_qname(rec))) == lastAlignedPosReads.end()))) {
-	    // First read
-	    lastAlignedPosReads.insert(hash_string(bam_get_qname(rec)));
-	    std::size_t hv = hash_pair(rec);
-	    mateMap[hv] = true;
-	    continue;
-	  } else {
-	    // Second read
-	    std::size_t hv = hash_pair_mate(rec);
-	    if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv])) continue; // Mate discarded
-	    mateMap[hv] = false;
-	  }
+	  int32_t fragStart = 0;
+	  int32_t isize = 0;
+	  if (!_pairedFragment(rec, c.mateFree, c.minQual, mateMap, lastAlignedPos, lastAlignedPosReads, fragStart, isize)) continue;
 
 	  // Insert size filter
-	  int32_t isize = (rec->core.pos + alignmentLength(rec)) - rec->core.mpos;
-	  if ((li.minNormalISize < isize) && (isize < li.maxNormalISize)) midPoint = rec->core.mpos + (int32_t) (isize/2);
+	  if ((li.minNormalISize < isize) && (isize < li.maxNormalISize)) midPoint = fragStart + (int32_t) (isize/2);
 	  else continue;
 	}
 
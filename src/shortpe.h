@@ -74,12 +74,30 @@ namespace torali
     typedef std::vector<TQualities> TQualVectors;
     TQualVectors traQualStore(svs.size(), TQualities());
     
+    // Assembly plan, intra-chromosomal SVs by chromosome and translocations by chromosome pair
+    typedef std::vector<std::vector<uint32_t> > TChrPlan;
+    TChrPlan chrPlan(hdr->n_targets);
+    typedef std::pair<int32_t, int32_t> TChrPair;
+    typedef std::map<TChrPair, std::vector<uint32_t> > TTraPlan;
+    TTraPlan traPlan;
+    for(uint32_t svid = 0; svid < svs.size(); ++svid) {
+      if (!_translocation(svs[svid].svt)) {
+	chrPlan[svs[svid].chr].push_back(svid);
+	continue;
+      }
+      if (svs[svid].chr2 >= svs[svid].chr) continue;
+      if ((validRegions[svs[svid].chr].empty()) || (validRegions[svs[svid].chr2].empty())) continue;
+      traPlan[std::make_pair(svs[svid].chr2, svs[svid].chr)].push_back(svid);
+    }
+    
     // Parse BAM
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Split-read assembly" << std::endl;
-    boost::progress_display show_progress( 2 * hdr->n_targets );
+    boost::progress_display show_progress( hdr->n_targets + traPlan.size() );
 
     faidx_t* fai = fai_load(c.genome.string().c_str());
+    TSVSequences seqStore(svs.size(), TSequences());
+    TQualVectors qualStore(svs.size(), TQualities());
     for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
       ++show_progress;
       if (validRegions[refIndex].empty()) continue;
@@ -95,10 +113,6 @@ namespace torali
       TBitSet hits(hdr->target_len[refIndex]);
       for(typename TPosReadSV::const_iterator it = srStore[refIndex].begin(); it != srStore[refIndex].end(); ++it) hits[it->first.first] = 1;
 
-      // Sequences
-      TSVSequences seqStore(svs.size(), TSequences());
-      TQualVectors qualStore(svs.size(), TQualities());
-      
       // Collect reads from all samples
       for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
 	// Read alignments
@@ -143,7 +157,7 @@ namespace torali
 		if (seqStore[svid].size() < maxReadPerSV) {
 		  bool insertSuccess = false;
 		  if (_translocation(svs[svid].svt)) insertSuccess = traStore[svid].insert(sequence).second;
-		  else insertSuccess = seqStore[svid].insert(sequence).second;
+		  else if (svs[svid].chr == refIndex) insertSuccess = seqStore[svid].insert(sequence).second;
 		  // Store qualities
 		  if (insertSuccess) {
 		    if (_translocation(svs[svid].svt)) traQualStore[svid].push_back(rec->core.qual);
@@ -159,9 +173,8 @@ namespace torali
       }
 
       // Process all SVs on this chromosome
-      for(uint32_t svid = 0; svid < seqStore.size(); ++svid) {
-	if (_translocation(svs[svid].svt)) continue;
-	if (svs[svid].chr != refIndex) continue;
+      for(uint32_t k = 0; k < chrPlan[refIndex].size(); ++k) {
+	uint32_t svid = chrPlan[refIndex][k];
 
 	// MSA
 	bool msaSuccess = false;
@@ -181,57 +194,37 @@ namespace torali
 	  svs[svid].srSupport = seqStore[svid].size();
 	  svs[svid].srMapQuality = qualStore[svid][qualStore[svid].size()/2];
 	}
+	TSequences().swap(seqStore[svid]);
+	TQualities().swap(qualStore[svid]);
       }
       // Clean-up
       if (seq != NULL) free(seq);
     }
 
-    // Process translocations
-    for(int32_t refIndex2 = 0; refIndex2 < hdr->n_targets; ++refIndex2) {
+    // Process translocations, reference regions are fetched on demand
+    ReferenceWindows rw(fai, hdr);
+    for(typename TTraPlan::const_iterator itP = traPlan.begin(); itP != traPlan.end(); ++itP) {
       ++show_progress;
-      if (validRegions[refIndex2].empty()) continue;
-      char* sndSeq = NULL;
-      for(int32_t refIndex = refIndex2 + 1; refIndex < hdr->n_targets; ++refIndex) {
-	if (validRegions[refIndex].empty()) continue;
-	char* seq = NULL;
-
-	// Iterate SVs
-	for(uint32_t svid = 0; svid < traStore.size(); ++svid) {
-	  if (!_translocation(svs[svid].svt)) continue;
-	  if ((svs[svid].chr != refIndex) || (svs[svid].chr2 != refIndex2)) continue;
-
-	  bool msaSuccess = false;
-	  if (traStore[svid].size() > 1) {
-	    // Lazy loading of references
-	    if (seq == NULL) {
-	      int32_t seqlen = -1;
-	      std::string tname(hdr->target_name[refIndex]);
-	      seq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex], &seqlen);
-	    }
-	    if (sndSeq == NULL) {
-	      int32_t seqlen = -1;
-	      std::string tname(hdr->target_name[refIndex2]);
-	      sndSeq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex2], &seqlen);
-	    }
-	    msa(c, traStore[svid], svs[svid].consensus);
-	    if (alignConsensus(c, hdr, seq, sndSeq, svs[svid])) msaSuccess = true;
-	  }
-	  if (!msaSuccess) {
-	    svs[svid].consensus = "";
-	    svs[svid].srSupport = 0;
-	    svs[svid].srAlignQuality = 0;
-	  } else {
-	    // SR support and qualities
-	    std::sort(traQualStore[svid].begin(), traQualStore[svid].end());
-	    svs[svid].mapq = 0;
-	    for(uint32_t i = 0; i < traQualStore[svid].size(); ++i) svs[svid].mapq += traQualStore[svid][i];
-	    svs[svid].srSupport = traStore[svid].size();
-	    svs[svid].srMapQuality = traQualStore[svid][traQualStore[svid].size()/2];
-	  }
+      for(uint32_t k = 0; k < itP->second.size(); ++k) {
+	uint32_t svid = itP->second[k];
+	bool msaSuccess = false;
+	if (traStore[svid].size() > 1) {
+	  msa(c, traStore[svid], svs[svid].consensus);
+	  if (alignConsensus(c, hdr, rw, svs[svid])) msaSuccess = true;
+	}
+	if (!msaSuccess) {
+	  svs[svid].consensus = "";
+	  svs[svid].srSupport = 0;
+	  svs[svid].srAlignQuality = 0;
+	} else {
+	  // SR support and qualities
+	  std::sort(traQualStore[svid].begin(), traQualStore[svid].end());
+	  svs[svid].mapq = 0;
+	  for(uint32_t i = 0; i < traQualStore[svid].size(); ++i) svs[svid].mapq += traQualStore[svid][i];
+	  svs[svid].srSupport = traStore[svid].size();
+	  svs[svid].srMapQuality = traQualStore[svid][traQualStore[svid].size()/2];
 	}
-	if (seq != NULL) free(seq);
       }
-      if (sndSeq != NULL) free(sndSeq);
     }
 
     // Clean-up
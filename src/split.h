@@ -2,6 +2,8 @@
 #define SPLIT_H
 
 #include <iostream>
+#include <list>
+#include <htslib/faidx.h>
 #include "gotoh.h"
 #include "needle.h"
 
@@ -21,18 +23,22 @@ namespace torali
   };
 
   template<typename TBPoint>
-  inline void
-  _adjustOrientation(std::string& sequence, TBPoint bpPoint, int32_t const svt) {
+  inline bool
+  _reverseOrientation(TBPoint bpPoint, int32_t const svt) {
     if (_translocation(svt)) {
       uint8_t ct = _getSpanOrientation(svt);
-      if (((ct==0) && (bpPoint)) || ((ct==1) && (!bpPoint))) reverseComplement(sequence);
+      return (((ct==0) && (bpPoint)) || ((ct==1) && (!bpPoint)));
     } else {
-      if (svt == 0) {
-	if (bpPoint) reverseComplement(sequence);
-      } else if (svt == 1) {
-	if (!bpPoint) reverseComplement(sequence);
-      }
+      if (svt == 0) return bpPoint;
+      else if (svt == 1) return !bpPoint;
     }
+    return false;
+  }
+
+  template<typename TBPoint>
+  inline void
+  _adjustOrientation(std::string& sequence, TBPoint bpPoint, int32_t const svt) {
+    if (_reverseOrientation(bpPoint, svt)) reverseComplement(sequence);
   }
 
   inline bool
@@ -121,16 +127,69 @@ namespace torali
     return false;
   }
 
+  struct RefWindow {
+    int32_t tid;
+    int32_t beg;
+    std::string seq;
+
+    RefWindow(int32_t const t, int32_t const b) : tid(t), beg(b) {}
+  };
+
+  // Small LRU cache of reference regions, avoids loading whole chromosomes
+  struct ReferenceWindows {
+    faidx_t* fai;
+    bam_hdr_t* hdr;
+    uint32_t maxWindows;
+    int32_t context;
+    std::list<RefWindow> windows;
+
+    ReferenceWindows(faidx_t* f, bam_hdr_t* h) : fai(f), hdr(h), maxWindows(16), context(5000) {}
+  };
+
+  inline std::string
+  _refSlice(char const* ref, int32_t const, int32_t const beg, int32_t const end) {
+    return std::string(ref + beg, ref + end);
+  }
+
+  inline std::string
+  _refSlice(ReferenceWindows& rw, int32_t const refIndex, int32_t const beg, int32_t const end) {
+    if (end <= beg) return "";
+
+    // Cached window?
+    for(std::list<RefWindow>::iterator it = rw.windows.begin(); it != rw.windows.end(); ++it) {
+      if ((it->tid == refIndex) && (it->beg <= beg) && (end <= it->beg + (int32_t) it->seq.size())) {
+	rw.windows.splice(rw.windows.begin(), rw.windows, it);
+	return rw.windows.front().seq.substr(beg - rw.windows.front().beg, end - beg);
+      }
+    }
+
+    // Fetch region with flanking context
+    int32_t wBeg = std::max(0, beg - rw.context);
+    int32_t wEnd = std::min((int32_t) rw.hdr->target_len[refIndex], end + rw.context);
+    rw.windows.push_front(RefWindow(refIndex, wBeg));
+    int32_t seqlen = -1;
+    std::string tname(rw.hdr->target_name[refIndex]);
+    char* seq = faidx_fetch_seq(rw.fai, tname.c_str(), wBeg, wEnd - 1, &seqlen);
+    if (seq != NULL) {
+      if (seqlen > 0) rw.windows.front().seq = std::string(seq, seq + seqlen);
+      free(seq);
+    }
+    if (rw.windows.size() > rw.maxWindows) rw.windows.pop_back();
+    std::string const& wseq = rw.windows.front().seq;
+    if (beg - wBeg >= (int32_t) wseq.size()) return "";
+    return wseq.substr(beg - wBeg, end - beg);
+  }
+
   // Deletions
-  template<typename TSeq, typename TSVRecord, typename TRef>
+  template<typename TRefSeq, typename TSVRecord, typename TRef>
   inline std::string
-  _getSVRef(TSeq const* const ref, TSVRecord const& svRec, TRef const refIndex, int32_t const svt) {
+  _getSVRef(TRefSeq& ref, TSVRecord const& svRec, TRef const refIndex, int32_t const svt) {
     if (_translocation(svt)) {
       uint8_t ct = _getSpanOrientation(svt);
       if (svRec.chr==refIndex) {
-	if ((ct==0) || (ct == 2)) return boost::to_upper_copy(std::string(ref + svRec.svStartBeg, ref + svRec.svStartEnd)) + svRec.part1;
+	if ((ct==0) || (ct == 2)) return boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svStartBeg, svRec.svStartEnd)) + svRec.part1;
 	else if (ct == 1) {
-	  std::string strEnd=boost::to_upper_copy(std::string(ref + svRec.svStartBeg, ref + svRec.svStartEnd));
+	  std::string strEnd=boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svStartBeg, svRec.svStartEnd));
 	  std::string refPart=strEnd;
 	  std::string::reverse_iterator itR = strEnd.rbegin();
 	  std::string::reverse_iterator itREnd = strEnd.rend();
@@ -145,11 +204,11 @@ namespace torali
 	    }
 	  }
 	  return refPart + svRec.part1;
-	} else return svRec.part1 + boost::to_upper_copy(std::string(ref + svRec.svStartBeg, ref + svRec.svStartEnd));
+	} else return svRec.part1 + boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svStartBeg, svRec.svStartEnd));
       } else {
 	// chr2
 	if (ct==0) {
-	  std::string strEnd=boost::to_upper_copy(std::string(ref + svRec.svEndBeg, ref + svRec.svEndEnd));
+	  std::string strEnd=boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svEndBeg, svRec.svEndEnd));
 	  std::string refPart=strEnd;
 	  std::string::reverse_iterator itR = strEnd.rbegin();
 	  std::string::reverse_iterator itREnd = strEnd.rend();
@@ -164,18 +223,18 @@ namespace torali
 	    }
 	  }
 	  return refPart;
-	} else return boost::to_upper_copy(std::string(ref + svRec.svEndBeg, ref + svRec.svEndEnd));
+	} else return boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svEndBeg, svRec.svEndEnd));
       }
     } else {
       if (svt == 2) {
-	if (svRec.svEnd - svRec.svStart <= DELLY_CHOP_REFSIZE) return boost::to_upper_copy(std::string(ref + svRec.svStartBeg, ref + svRec.svEndEnd));
-	else return boost::to_upper_copy(std::string(ref + svRec.svStartBeg, ref + svRec.svStartEnd)) + boost::to_upper_copy(std::string(ref + svRec.svEndBeg, ref + svRec.svEndEnd));
+	if (svRec.svEnd - svRec.svStart <= DELLY_CHOP_REFSIZE) return boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svStartBeg, svRec.svEndEnd));
+	else return boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svStartBeg, svRec.svStartEnd)) + boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svEndBeg, svRec.svEndEnd));
       } else if (svt == 4) {
-	return boost::to_upper_copy(std::string(ref + svRec.svStartBeg, ref + svRec.svEndEnd));
+	return boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svStartBeg, svRec.svEndEnd));
       } else if (svt == 3) {
-	return boost::to_upper_copy(std::string(ref + svRec.svEndBeg, ref + svRec.svEndEnd)) + boost::to_upper_copy(std::string(ref + svRec.svStartBeg, ref + svRec.svStartEnd));
+	return boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svEndBeg, svRec.svEndEnd)) + boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svStartBeg, svRec.svStartEnd));
       } else if (svt == 0) {
-	std::string strEnd=boost::to_upper_copy(std::string(ref + svRec.svEndBeg, ref + svRec.svEndEnd));
+	std::string strEnd=boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svEndBeg, svRec.svEndEnd));
 	std::string strRevComp=strEnd;
 	std::string::reverse_iterator itR = strEnd.rbegin();
 	std::string::reverse_iterator itREnd = strEnd.rend();
@@ -189,9 +248,9 @@ namespace torali
 	  default: break;
 	  }
 	}
-	return boost::to_upper_copy(std::string(ref + svRec.svStartBeg, ref + svRec.svStartEnd)) + strRevComp;
+	return boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svStartBeg, svRec.svStartEnd)) + strRevComp;
       } else if (svt == 1) {
-	std::string strStart=boost::to_upper_copy(std::string(ref + svRec.svStartBeg, ref + svRec.svStartEnd));
+	std::string strStart=boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svStartBeg, svRec.svStartEnd));
 	std::string strRevComp=strStart;
 	std::string::reverse_iterator itR = strStart.rbegin();
 	std::string::reverse_iterator itREnd = strStart.rend();
@@ -205,7 +264,7 @@ namespace torali
 	  default: break;
 	  }
 	}
-	return strRevComp + boost::to_upper_copy(std::string(ref + svRec.svEndBeg, ref + svRec.svEndEnd));
+	return strRevComp + boost::to_upper_copy(_refSlice(ref, refIndex, svRec.svEndBeg, svRec.svEndEnd));
       }
     }
     return "";
@@ -427,9 +486,9 @@ namespace torali
     return reNeedle;
   }
 
-  template<typename TConfig>
+  template<typename TConfig, typename TRefSeq>
   inline bool
-  alignConsensus(TConfig const& c, bam_hdr_t* hdr, char const* seq, char const* sndSeq, StructuralVariantRecord& sv) {
+  _alignConsensus(TConfig const& c, bam_hdr_t* hdr, TRefSeq& seq, TRefSeq& sndSeq, StructuralVariantRecord& sv) {
     if ( (int32_t) sv.consensus.size() < (2 * c.minimumFlankSize + sv.insLen)) return false;
     
     // Get reference slice
@@ -478,7 +537,7 @@ namespace torali
 
     if (c.islr) {
       // Set alleles
-      sv.alleles = _addAlleles(boost::to_upper_copy(std::string(seq + sv.svStart - 1, seq + sv.svStart)), std::string(hdr->target_name[sv.chr2]), sv, sv.svt);
+      sv.alleles = _addAlleles(boost::to_upper_copy(_refSlice(seq, sv.chr, sv.svStart - 1, sv.svStart)), std::string(hdr->target_name[sv.chr2]), sv, sv.svt);
     
       // Get exact alleles for INS and DEL                                                                         
       if ((sv.svt == 2) || (sv.svt == 4)) {
@@ -504,7 +563,17 @@ namespace torali
     return true;
   }
 
+  template<typename TConfig>
+  inline bool
+  alignConsensus(TConfig const& c, bam_hdr_t* hdr, char const* seq, char const* sndSeq, StructuralVariantRecord& sv) {
+    return _alignConsensus(c, hdr, seq, sndSeq, sv);
+  }
 
+  template<typename TConfig>
+  inline bool
+  alignConsensus(TConfig const& c, bam_hdr_t* hdr, ReferenceWindows& rw, StructuralVariantRecord& sv) {
+    return _alignConsensus(c, hdr, rw, rw, sv);
+  }
 
 }
 
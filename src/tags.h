@@ -15,6 +15,11 @@ namespace torali {
   #define DELLY_OUTOFBAND -99999999
   #endif
 
+  // BCF records per thread and batch in filter, classify and genotype output
+  #ifndef DELLY_BCF_BATCH
+  #define DELLY_BCF_BATCH 64
+  #endif
+
   inline bool
   _translocation(int32_t const svt) {
     return (DELLY_SVT_TRANS <= svt) && (svt < 9);
@@ -4,11 +4,16 @@
 #include <boost/multi_array.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <htslib/sam.h>
 #include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <climits>
 #include <math.h>
 #include "tags.h"
 
@@ -79,10 +84,8 @@ namespace torali
 
   inline bool
   nContent(std::string const& s) {
-    for(uint32_t i = 0; i < s.size(); ++i) {
-      if ((s[i] == 'N') || (s[i] == 'n')) return true;
-    }
-    return false;
+    if (s.empty()) return false;
+    return ((std::memchr(s.data(), 'N', s.size()) != NULL) || (std::memchr(s.data(), 'n', s.size()) != NULL));
   }
   
   // Decode Orientation
@@ -192,6 +195,36 @@ namespace torali
     return true;
   }
 
+  // Size and modification time of a file, keys side-car caches to the file content
+  inline std::string
+  _fileStamp(boost::filesystem::path const& f) {
+    struct stat st;
+    if (stat(f.string().c_str(), &st) != 0) return "NA";
+#if defined(__APPLE__)
+    int64_t nsec = st.st_mtimespec.tv_nsec;
+#else
+    int64_t nsec = st.st_mtim.tv_nsec;
+#endif
+    std::ostringstream stamp;
+    stamp << (int64_t) st.st_size << '\t' << (int64_t) st.st_mtime << '.' << nsec;
+    return stamp.str();
+  }
+
+  // Side-car files are written to a unique temporary file and renamed into place when complete
+  inline std::string
+  _sideCarTmpFile(std::string const& filename) {
+    return filename + ".tmp." + boost::filesystem::unique_path().string();
+  }
+
+  inline bool
+  _commitSideCar(std::string const& tmpfile, std::string const& filename) {
+    if (std::rename(tmpfile.c_str(), filename.c_str()) != 0) {
+      std::remove(tmpfile.c_str());
+      return false;
+    }
+    return true;
+  }
+
   template<typename TConfig>
   inline void
     _svTypesToCompute(TConfig& c, std::string const& svtype, bool const specified) {
@@ -290,19 +323,72 @@ namespace torali
     return seed;
   }
 
+  // Same-chromosome pair: true at the read that counts the fragment, sets fragment start and insert size
+  template<typename TMateMap>
+  inline bool
+  _pairedFragment(bam1_t* rec, bool const mateFree, uint16_t const minQual, TMateMap& mateMap, int32_t& lastAlignedPos, std::set<std::size_t>& lastAlignedPosReads, int32_t& fragStart, int32_t& isize) {
+    // Clean-up the read store for identical alignment positions
+    if (rec->core.pos > lastAlignedPos) {
+      lastAlignedPosReads.clear();
+      lastAlignedPos = rec->core.pos;
+    }
+
+    // Proper pairs are counted at the leftmost mate using the template length
+    if ((mateFree) && (rec->core.flag & BAM_FPROPER_PAIR)) {
+      if ((rec->core.pos > rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (!(rec->core.flag & BAM_FREAD1)))) return false;
+      uint8_t* mq = bam_aux_get(rec, "MQ");
+      if ((mq != NULL) && (bam_aux2i(mq) < minQual)) return false;
+      fragStart = rec->core.pos;
+      isize = std::abs(rec->core.isize);
+      return true;
+    }
+
+    // Discordant pairs use the mate map
+    if ((rec->core.pos < rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (lastAlignedPosReads.find(hash_string(bam_get_qname(rec))) == lastAlignedPosReads.end()))) {
+      // First read
+      lastAlignedPosReads.insert(hash_string(bam_get_qname(rec)));
+      std::size_t hv = hash_pair(rec);
+      mateMap[hv] = true;
+      return false;
+    } else {
+      // Second read
+      std::size_t hv = hash_pair_mate(rec);
+      if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv])) return false; // Mate discarded
+      mateMap[hv] = false;
+    }
+    fragStart = rec->core.mpos;
+    isize = (rec->core.pos + alignmentLength(rec)) - rec->core.mpos;
+    return true;
+  }
+
+  // Upper-case complement, 0 for characters other than ACGTN
+  inline char
+  _complement(char const c) {
+    switch (c) {
+    case 'A': case 'a': return 'T';
+    case 'C': case 'c': return 'G';
+    case 'G': case 'g': return 'C';
+    case 'T': case 't': return 'A';
+    case 'N': case 'n': return 'N';
+    default: return 0;
+    }
+  }
+
+  // In-place, characters other than ACGTN keep the value of their target position
   inline void
   reverseComplement(std::string& sequence) {
-    std::string rev = boost::to_upper_copy(std::string(sequence.rbegin(), sequence.rend()));
-    std::size_t i = 0;
-    for(std::string::iterator revIt = rev.begin(); revIt != rev.end(); ++revIt, ++i) {
-      switch (*revIt) {
-      case 'A': sequence[i]='T'; break;
-      case 'C': sequence[i]='G'; break;
-      case 'G': sequence[i]='C'; break;
-      case 'T': sequence[i]='A'; break;
-      case 'N': sequence[i]='N'; break;
-      default: break;
-      }
+    std::size_t n = sequence.size();
+    for(std::size_t i = 0; i < n / 2; ++i) {
+      char front = sequence[i];
+      char back = sequence[n - 1 - i];
+      char compFront = _complement(front);
+      char compBack = _complement(back);
+      sequence[i] = compBack ? compBack : front;
+      sequence[n - 1 - i] = compFront ? compFront : back;
+    }
+    if (n % 2) {
+      char compMid = _complement(sequence[n / 2]);
+      if (compMid) sequence[n / 2] = compMid;
     }
   }
 
@@ -331,14 +417,13 @@ namespace torali
   inline double
   entropy(std::string const& st) {
     typedef double TPrecision;
-    std::vector<char> stvec(st.begin(), st.end());
-    std::set<char> alphabet(stvec.begin(), stvec.end());
+    // Character composition in one pass
+    uint32_t ctr[256] = {0};
+    for(std::size_t i = 0; i < st.size(); ++i) ++ctr[(unsigned char) st[i]];
     TPrecision ent = 0;
-    for(std::set<char>::const_iterator c = alphabet.begin(); c != alphabet.end(); ++c) {
-      int ctr = 0;
-      for (std::vector<char>::const_iterator s = stvec.begin(); s != stvec.end(); ++s)
-	if (*s == *c) ++ctr;
-      TPrecision freq = (TPrecision) ctr / (TPrecision) stvec.size();
+    for(int c = CHAR_MIN; c <= CHAR_MAX; ++c) {
+      if (!ctr[(unsigned char) c]) continue;
+      TPrecision freq = (TPrecision) ctr[(unsigned char) c] / (TPrecision) st.size();
       ent += (freq) * log(freq)/log(2);
     }
     return -ent;
@@ -0,0 +1,303 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/tokenizer.hpp>
+
+#include <htslib/sam.h>
+
+#include "../src/tags.h"
+#include "../src/util.h"
+#include "../src/needle.h"
+#include "../src/gotoh.h"
+
+using namespace torali;
+
+// Reference kernels, cell-by-cell recursion as in delly v1.1
+namespace baseline
+{
+
+  template<typename TAlign1, typename TAlign2, typename TAlignConfig, typename TScoreObject>
+  inline int
+  needleScore(TAlign1 const& a1, TAlign2 const& a2, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+    typedef typename TScoreObject::TValue TScoreValue;
+
+    // DP Matrix
+    std::size_t m = _size(a1, 1);
+    std::size_t n = _size(a2, 1);
+    std::vector<TScoreValue> s(n+1, 0);
+    TScoreValue prevsub = 0;
+
+    // Create profile
+    typedef boost::multi_array<double, 2> TProfile;
+    TProfile p1;
+    TProfile p2;
+    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
+      _createProfile(a1, p1);
+      _createProfile(a2, p2);
+    }
+
+    // DP
+    for(std::size_t row = 0; row <= m; ++row) {
+      for(std::size_t col = 0; col <= n; ++col) {
+	// Initialization
+	if ((row == 0) && (col == 0)) {
+	  s[0] = 0;
+	  prevsub = 0;
+	} else if (row == 0) {
+	  s[col] = _horizontalGap(ac, 0, m, col * sc.ge);
+	} else if (col == 0) {
+	  s[0] = _verticalGap(ac, 0, n, row * sc.ge);
+	  if (row - 1 == 0) prevsub = 0;
+	  else prevsub = _verticalGap(ac, 0, n, (row - 1) * sc.ge);
+	} else {
+	  // Recursion
+	  TScoreValue prevprevsub = prevsub;
+	  prevsub = s[col];
+	  s[col] = std::max(std::max(prevprevsub + _score(a1, a2, p1, p2, row-1, col-1, sc), prevsub + _verticalGap(ac, col, n, sc.ge)), s[col-1] + _horizontalGap(ac, row, m, sc.ge));
+	}
+      }
+    }
+
+    // Score
+    return s[n];
+  }
+
+  template<typename TAlignConfig, typename TScoreObject>
+  inline int32_t
+  needleBanded(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+    typedef typename TScoreObject::TValue TScoreValue;
+
+    // DP Matrix
+    int32_t m = s1.size();
+    int32_t n = s2.size();
+    int32_t band = 100;
+    int32_t lowBand = band;
+    int32_t highBand = band;
+    if (m < n) highBand += n - m;
+    else lowBand += m - n;
+    std::vector<TScoreValue> s(n+1, 0);
+    TScoreValue prevsub = 0;
+    TScoreValue prevprevsub = 0;
+
+    // DP
+    for(int32_t row = 0; row <= m; ++row) {
+      for(int32_t col = std::max(0, row - lowBand); col <= std::min(n, row + highBand); ++col) {
+	// Initialization
+	if ((row == 0) && (col == 0)) {
+	  s[0] = 0;
+	  prevsub = 0;
+	} else if (row == 0) {
+	  s[col] = _horizontalGap(ac, 0, m, col * sc.ge);
+	} else if (col == 0) {
+	  s[0] = _verticalGap(ac, 0, n, row * sc.ge);
+	  if (row - 1 == 0) prevsub = 0;
+	  else prevsub = _verticalGap(ac, 0, n, (row - 1) * sc.ge);
+	} else {
+	  // Recursion
+	  prevprevsub = prevsub;
+	  prevsub = s[col];
+	  if (col == row - lowBand) {
+	    prevprevsub = s[col-1];
+	    s[col - 1] = DELLY_OUTOFBAND;
+	  } else if (col == row + highBand) prevsub = DELLY_OUTOFBAND;
+	  s[col] = std::max(std::max(prevprevsub + (s1[row-1] == s2[col-1] ? sc.match : sc.mismatch), prevsub + _verticalGap(ac, col, n, sc.ge)), s[col-1] + _horizontalGap(ac, row, m, sc.ge));
+	}
+      }
+    }
+
+    // Score
+    return s[n];
+  }
+
+  template<typename TAlign1, typename TAlign2, typename TAlignConfig, typename TScoreObject>
+  inline int
+  gotohScore(TAlign1 const& a1, TAlign2 const& a2, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+    typedef typename TScoreObject::TValue TScoreValue;
+
+    // DP variables
+    std::size_t m = _size(a1, 1);
+    std::size_t n = _size(a2, 1);
+    std::vector<TScoreValue> s(n+1, 0);
+    std::vector<TScoreValue> v(n+1, 0);
+    TScoreValue newhoz = 0;
+    TScoreValue prevsub = 0;
+
+    // Create profile
+    typedef boost::multi_array<float, 2> TProfile;
+    TProfile p1;
+    TProfile p2;
+    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
+      _createProfile(a1, p1);
+      _createProfile(a2, p2);
+    }
+
+    // DP
+    for(std::size_t row = 0; row <= m; ++row) {
+      for(std::size_t col = 0; col <= n; ++col) {
+	// Initialization
+	if ((row == 0) && (col == 0)) {
+	  s[0] = 0;
+	  v[0] = -sc.inf;
+	  newhoz = -sc.inf;
+	} else if (row == 0) {
+	  v[col] = -sc.inf;
+	  s[col] = _horizontalGap(ac, 0, m, sc.go + col * sc.ge);
+	  newhoz = _horizontalGap(ac, 0, m, sc.go + col * sc.ge);
+	} else if (col == 0) {
+	  newhoz = -sc.inf;
+	  s[0] = _verticalGap(ac, 0, n, sc.go + row * sc.ge);
+	  if (row - 1 == 0) prevsub = 0;
+	  else prevsub = _verticalGap(ac, 0, n, sc.go + (row - 1) * sc.ge);
+	  v[0] = _verticalGap(ac, 0, n, sc.go + row * sc.ge);
+	} else {
+	  // Recursion
+	  TScoreValue prevhoz = newhoz;
+	  TScoreValue prevver = v[col];
+	  TScoreValue prevprevsub = prevsub;
+	  prevsub = s[col];
+	  newhoz = std::max(s[col-1] + _horizontalGap(ac, row, m, sc.go + sc.ge), prevhoz + _horizontalGap(ac, row, m, sc.ge));
+	  v[col] = std::max(prevsub + _verticalGap(ac, col, n, sc.go + sc.ge), prevver + _verticalGap(ac, col, n, sc.ge));
+	  s[col] = std::max(std::max(prevprevsub + _score(a1, a2, p1, p2, row-1, col-1, sc), newhoz), v[col]);
+	}
+      }
+    }
+
+    // Score
+    return s[n];
+  }
+
+}
+
+// Read-like sequence derived from s with substitutions and indels
+template<typename TRng>
+inline std::string
+mutate(TRng& rng, std::string const& s, double const rate) {
+  boost::random::uniform_real_distribution<double> unif(0, 1);
+  boost::random::uniform_int_distribution<int32_t> base(0, 3);
+  boost::random::uniform_int_distribution<int32_t> edit(0, 2);
+  std::string out;
+  for(uint32_t i = 0; i < s.size(); ++i) {
+    if (unif(rng) < rate) {
+      int32_t e = edit(rng);
+      if (e == 0) out += "ACGT"[base(rng)];
+      else if (e == 1) out += std::string(1, "ACGT"[base(rng)]) + s[i];
+    } else out += s[i];
+  }
+  return out;
+}
+
+typedef std::vector<std::pair<std::string, std::string> > TPairs;
+
+// Kernels under test, before (baseline copy) and after (src/), with the scoring of their delly call sites
+template<typename TAlignConfig, typename TScore>
+struct NeedleScoreKernel {
+  bool before;
+  TAlignConfig ac;
+  TScore sc;
+
+  NeedleScoreKernel(bool const b, TScore const& s) : before(b), sc(s) {}
+
+  int operator()(std::string const& a, std::string const& b) const {
+    if (before) return baseline::needleScore(a, b, ac, sc);
+    return needleScore(a, b, ac, sc);
+  }
+};
+
+template<typename TAlignConfig, typename TScore>
+struct NeedleBandedKernel {
+  bool before;
+  TAlignConfig ac;
+  TScore sc;
+
+  NeedleBandedKernel(bool const b, TScore const& s) : before(b), sc(s) {}
+
+  int operator()(std::string const& a, std::string const& b) const {
+    if (before) return baseline::needleBanded(a, b, ac, sc);
+    return needleBanded(a, b, ac, sc);
+  }
+};
+
+template<typename TAlignConfig, typename TScore>
+struct GotohScoreKernel {
+  bool before;
+  TAlignConfig ac;
+  TScore sc;
+
+  GotohScoreKernel(bool const b, TScore const& s) : before(b), sc(s) {}
+
+  int operator()(std::string const& a, std::string const& b) const {
+    if (before) return baseline::gotohScore(a, b, ac, sc);
+    return gotohScore(a, b, ac, sc);
+  }
+};
+
+// Fastest of several passes over all pairs in ms, checksum of the scores
+template<typename TKernel>
+inline double
+timeKernel(TPairs const& pairs, uint32_t const trials, TKernel const& kernel, int64_t& checksum) {
+  double best = 0;
+  for(uint32_t t = 0; t < trials; ++t) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    checksum = 0;
+    for(uint32_t i = 0; i < pairs.size(); ++i) checksum += kernel(pairs[i].first, pairs[i].second);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if ((t == 0) || (ms < best)) best = ms;
+  }
+  return best;
+}
+
+template<typename TBefore, typename TAfter>
+inline bool
+compareKernels(std::string const& name, TPairs const& pairs, uint32_t const trials, TBefore const& kBefore, TAfter const& kAfter) {
+  int64_t csBefore = 0;
+  int64_t csAfter = 0;
+  double before = timeKernel(pairs, trials, kBefore, csBefore);
+  double after = timeKernel(pairs, trials, kAfter, csAfter);
+  std::cout << name << "\t" << std::fixed << std::setprecision(1) << before << "\t" << after << "\t" << std::setprecision(2) << before / after << std::endl;
+  if (csBefore != csAfter) {
+    std::cerr << "Error: " << name << " scores differ, " << csBefore << " vs. " << csAfter << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint32_t trials = 5;
+  if (argc > 1) trials = std::atoi(argv[1]);
+
+  // Probe/read and consensus/reference sized pairs
+  boost::random::mt19937 rng(1);
+  boost::random::uniform_int_distribution<int32_t> base(0, 3);
+  boost::random::uniform_int_distribution<int32_t> len(100, 1000);
+  TPairs pairs;
+  for(uint32_t i = 0; i < 200; ++i) {
+    std::string s;
+    int32_t l = len(rng);
+    for(int32_t k = 0; k < l; ++k) s += "ACGT"[base(rng)];
+    pairs.push_back(std::make_pair(s, mutate(rng, s, 0.1)));
+  }
+
+  // Timings of the fastest pass
+  uint32_t errors = 0;
+  std::cout << "Kernel\tBeforeMs\tAfterMs\tSpeedup" << std::endl;
+  DnaScore<int> simple(5, -4, -4, -4);
+  DnaScore<int> affine(5, -4, -10, -1);
+  typedef NeedleScoreKernel<AlignConfig<true, false>, DnaScore<int> > TNeedleScore;
+  typedef NeedleBandedKernel<AlignConfig<true, false>, DnaScore<int> > TNeedleBanded;
+  typedef GotohScoreKernel<AlignConfig<false, false>, DnaScore<int> > TGotohScore;
+  if (!compareKernels("needleScore", pairs, trials, TNeedleScore(true, simple), TNeedleScore(false, simple))) ++errors;
+  if (!compareKernels("needleBanded", pairs, trials, TNeedleBanded(true, simple), TNeedleBanded(false, simple))) ++errors;
+  if (!compareKernels("gotohScore", pairs, trials, TGotohScore(true, affine), TGotohScore(false, affine))) ++errors;
+  if (errors) return 1;
+  return 0;
+}
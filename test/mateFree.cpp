@@ -0,0 +1,148 @@
+#include <iostream>
+#include <string>
+#include <set>
+#include <map>
+#include <cstdlib>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/tokenizer.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <htslib/sam.h>
+
+#include "../src/util.h"
+
+using namespace torali;
+
+// Fragments counted by the read-depth passes, qname -> (fragment start, insert size)
+typedef std::map<std::string, std::pair<int32_t, int32_t> > TFragments;
+
+// Fixture expectations from the XM (modes: 1 mate-map, 2 mate-free), XS (fragment start) and XI (insert size) tags
+struct FragmentExpectation {
+  int32_t modes;
+  int32_t start;
+  int32_t isize;
+
+  FragmentExpectation() : modes(0), start(0), isize(0) {}
+  FragmentExpectation(int32_t m, int32_t s, int32_t i) : modes(m), start(s), isize(i) {}
+};
+typedef std::map<std::string, FragmentExpectation> TExpectations;
+
+// Same read filters as the scan pass, returns false on a read error
+inline bool
+countFragments(std::string const& bam, bool const mateFree, uint16_t const minQual, TFragments& frag, std::set<std::string>& filtered, TExpectations& expect) {
+  samFile* samfile = sam_open(bam.c_str(), "r");
+  if (samfile == NULL) return false;
+  bam_hdr_t* hdr = sam_hdr_read(samfile);
+  typedef boost::unordered_map<std::size_t, bool> TMateMap;
+  TMateMap mateMap;
+  int32_t lastAlignedPos = 0;
+  std::set<std::size_t> lastAlignedPosReads;
+  int32_t refIndex = -1;
+  bam1_t* rec = bam_init1();
+  while (sam_read1(samfile, hdr, rec) >= 0) {
+    if (!(rec->core.flag & BAM_FPAIRED)) continue;
+    uint8_t* xm = bam_aux_get(rec, "XM");
+    uint8_t* xs = bam_aux_get(rec, "XS");
+    uint8_t* xi = bam_aux_get(rec, "XI");
+    if ((xm != NULL) && (xs != NULL) && (xi != NULL)) expect[bam_get_qname(rec)] = FragmentExpectation(bam_aux2i(xm), bam_aux2i(xs), bam_aux2i(xi));
+    if (rec->core.tid != refIndex) {
+      refIndex = rec->core.tid;
+      mateMap.clear();
+      lastAlignedPos = 0;
+      lastAlignedPosReads.clear();
+    }
+    if ((rec->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP | BAM_FSUPPLEMENTARY | BAM_FUNMAP)) || (rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid) || (rec->core.qual < minQual) || (getSVType(rec->core) != 2)) {
+      filtered.insert(bam_get_qname(rec));
+      continue;
+    }
+    int32_t fragStart = 0;
+    int32_t isize = 0;
+    if (!_pairedFragment(rec, mateFree, minQual, mateMap, lastAlignedPos, lastAlignedPosReads, fragStart, isize)) continue;
+    frag[bam_get_qname(rec)] = std::make_pair(fragStart, isize);
+  }
+  bam_destroy1(rec);
+  bam_hdr_destroy(hdr);
+  sam_close(samfile);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <input.bam|input.sam> [min. mapping quality]" << std::endl;
+    return 1;
+  }
+  std::string bam(argv[1]);
+  uint16_t minQual = 10;
+  if (argc > 2) minQual = std::atoi(argv[2]);
+
+  // Mate-map and mate-free counting
+  TFragments mateMapFrag;
+  TFragments mateFreeFrag;
+  std::set<std::string> filtered;
+  TExpectations expect;
+  if ((!countFragments(bam, false, minQual, mateMapFrag, filtered, expect)) || (!countFragments(bam, true, minQual, mateFreeFrag, filtered, expect))) {
+    std::cerr << "Error: Fail to read " << bam << std::endl;
+    return 1;
+  }
+
+  // Every mate-map fragment has the same start and insert size in mate-free mode
+  uint32_t errors = 0;
+  for(TFragments::const_iterator it = mateMapFrag.begin(); it != mateMapFrag.end(); ++it) {
+    TFragments::const_iterator itFree = mateFreeFrag.find(it->first);
+    if (itFree == mateFreeFrag.end()) {
+      std::cerr << "Error: Fragment " << it->first << " missing in mate-free mode" << std::endl;
+      ++errors;
+    } else if (itFree->second != it->second) {
+      std::cerr << "Error: Fragment " << it->first << " differs, mate-map " << it->second.first << "," << it->second.second << " mate-free " << itFree->second.first << "," << itFree->second.second << std::endl;
+      ++errors;
+    }
+  }
+
+  // Additional mate-free fragments are proper pairs whose mate failed a read filter other than its MQ tag
+  uint32_t extra = 0;
+  for(TFragments::const_iterator it = mateFreeFrag.begin(); it != mateFreeFrag.end(); ++it) {
+    if (mateMapFrag.find(it->first) != mateMapFrag.end()) continue;
+    if (filtered.find(it->first) == filtered.end()) {
+      std::cerr << "Error: Fragment " << it->first << " only counted in mate-free mode" << std::endl;
+      ++errors;
+    } else {
+      std::cout << "Mate filtered\t" << it->first << "\t" << it->second.first << "\t" << it->second.second << std::endl;
+      ++extra;
+    }
+  }
+
+  // Fixture expectations
+  for(TExpectations::const_iterator it = expect.begin(); it != expect.end(); ++it) {
+    for(int32_t mode = 1; mode <= 2; ++mode) {
+      TFragments const& frag = (mode == 1) ? mateMapFrag : mateFreeFrag;
+      std::string modeName = (mode == 1) ? "mate-map" : "mate-free";
+      TFragments::const_iterator itF = frag.find(it->first);
+      if (it->second.modes & mode) {
+	if (itF == frag.end()) {
+	  std::cerr << "Error: Fragment " << it->first << " not counted in " << modeName << " mode" << std::endl;
+	  ++errors;
+	} else if ((itF->second.first != it->second.start) || (itF->second.second != it->second.isize)) {
+	  std::cerr << "Error: Fragment " << it->first << " in " << modeName << " mode is " << itF->second.first << "," << itF->second.second << ", expected " << it->second.start << "," << it->second.isize << std::endl;
+	  ++errors;
+	}
+      } else if (itF != frag.end()) {
+	std::cerr << "Error: Fragment " << it->first << " unexpectedly counted in " << modeName << " mode" << std::endl;
+	++errors;
+      }
+    }
+  }
+
+  // Summary
+  uint64_t mateMapISize = 0;
+  for(TFragments::const_iterator it = mateMapFrag.begin(); it != mateMapFrag.end(); ++it) mateMapISize += it->second.second;
+  uint64_t mateFreeISize = 0;
+  for(TFragments::const_iterator it = mateFreeFrag.begin(); it != mateFreeFrag.end(); ++it) mateFreeISize += it->second.second;
+  std::cout << "Mode\tFragments\tISizeSum" << std::endl;
+  std::cout << "mate-map\t" << mateMapFrag.size() << "\t" << mateMapISize << std::endl;
+  std::cout << "mate-free\t" << mateFreeFrag.size() << "\t" << mateFreeISize << std::endl;
+  std::cout << "mate-filtered\t" << extra << std::endl;
+  std::cout << "expectations\t" << expect.size() << std::endl;
+  if (errors) return 1;
+  return 0;
+}
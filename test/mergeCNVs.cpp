@@ -0,0 +1,122 @@
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+#include "../src/version.h"
+#include "../src/cnv.h"
+
+using namespace torali;
+
+struct MergeConfig {
+  double cn_offset;
+};
+
+// Reference implementation, all-pairs run detection as in delly v1.1
+template<typename TConfig>
+inline void
+mergeCNVsAllPairs(TConfig const& c, std::vector<CNV>& chrcnv, std::vector<CNV>& cnvs) {
+  bool merged = true;
+  std::vector<CNV> newcnv;
+  while(merged) {
+    int32_t k = -1;
+    for(int32_t i = 0; i < (int32_t) chrcnv.size(); ++i) {
+      if (i <= k) continue;
+      k = i;
+      for(int32_t j = i + 1; j < (int32_t) chrcnv.size(); ++j) {
+	bool allValid = true;
+	for(int32_t pre = i; pre < j; ++pre) {
+	  double diff = std::abs(chrcnv[pre].cn - chrcnv[j].cn);
+	  if (diff >= c.cn_offset) {
+	    allValid = false;
+	    break;
+	  }
+	}
+	if (allValid) k = j;
+	else break;
+      }
+      if (k > i) {
+	double cn = (chrcnv[i].cn + chrcnv[k].cn) / 2.0;
+	double mp = (chrcnv[i].mappable + chrcnv[k].mappable) / 2.0;
+	newcnv.push_back(CNV(chrcnv[i].chr, chrcnv[i].start, chrcnv[k].end, chrcnv[i].ciposlow, chrcnv[i].ciposhigh, chrcnv[k].ciendlow, chrcnv[k].ciendhigh, cn, mp));
+      } else {
+	newcnv.push_back(chrcnv[i]);
+      }
+    }
+    if (newcnv.size() == chrcnv.size()) merged = false;
+    else {
+      chrcnv = newcnv;
+      newcnv.clear();
+    }
+  }
+  for(uint32_t i = 0; i < chrcnv.size(); ++i) cnvs.push_back(chrcnv[i]);
+}
+
+inline bool
+sameValue(double const a, double const b) {
+  if ((std::isnan(a)) && (std::isnan(b))) return true;
+  return (a == b);
+}
+
+inline bool
+sameCNV(CNV const& a, CNV const& b) {
+  return ((a.chr == b.chr) && (a.start == b.start) && (a.end == b.end) && (a.ciposlow == b.ciposlow) && (a.ciposhigh == b.ciposhigh) && (a.ciendlow == b.ciendlow) && (a.ciendhigh == b.ciendhigh) && (sameValue(a.cn, b.cn)) && (sameValue(a.mappable, b.mappable)));
+}
+
+int main() {
+  boost::random::mt19937 rng(1);
+  uint32_t nsets = 20000;
+  uint32_t errors = 0;
+  for(uint32_t s = 0; s < nsets; ++s) {
+    // Synthetic tiling of a chromosome with noisy, discrete or plateau copy-numbers
+    boost::random::uniform_int_distribution<int32_t> nseg(0, 200);
+    boost::random::uniform_int_distribution<int32_t> seglen(100, 10000);
+    boost::random::uniform_int_distribution<int32_t> mode(0, 3);
+    boost::random::uniform_int_distribution<int32_t> discrete(0, 8);
+    boost::random::uniform_real_distribution<double> noise(0, 4);
+    boost::random::uniform_real_distribution<double> offset(0.05, 1.5);
+    MergeConfig c;
+    c.cn_offset = offset(rng);
+    int32_t n = nseg(rng);
+    int32_t m = mode(rng);
+    std::vector<CNV> segs;
+    int32_t pos = 0;
+    double plateau = noise(rng);
+    for(int32_t i = 0; i < n; ++i) {
+      int32_t len = seglen(rng);
+      double cn = noise(rng);
+      if (m == 1) cn = discrete(rng) / 2.0;
+      else if (m == 2) {
+	if (discrete(rng) == 0) plateau = noise(rng);
+	cn = plateau + noise(rng) / 10.0;
+      } else if (m == 3) {
+	int32_t d = discrete(rng);
+	if (d == 0) cn = std::numeric_limits<double>::quiet_NaN();
+	else if (d == 1) cn = std::numeric_limits<double>::infinity();
+      }
+      segs.push_back(CNV(0, pos, pos + len, pos - 50, pos + 50, pos + len - 50, pos + len + 50, cn, noise(rng) / 4.0));
+      pos += len;
+    }
+
+    // Compare against the reference merge
+    std::vector<CNV> ref = segs;
+    std::vector<CNV> refOut;
+    mergeCNVsAllPairs(c, ref, refOut);
+    std::vector<CNV> cur = segs;
+    std::vector<CNV> curOut;
+    mergeCNVs(c, cur, curOut);
+    bool same = (refOut.size() == curOut.size());
+    for(uint32_t i = 0; ((same) && (i < refOut.size())); ++i) same = sameCNV(refOut[i], curOut[i]);
+    if (!same) {
+      std::cerr << "Error: Merged CNVs differ for segment set " << s << " (" << n << " segments, offset " << c.cn_offset << ")" << std::endl;
+      ++errors;
+    }
+  }
+  std::cout << "Segment sets\t" << nsets << std::endl;
+  std::cout << "Mismatches\t" << errors << std::endl;
+  if (errors) return 1;
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/tokenizer.hpp>
+
+#include "../src/version.h"
+#include "../src/coverage.h"
+
+using namespace torali;
+
+struct ProbeConfig {
+  float flankQuality;
+};
+
+template<typename TRng>
+inline std::string
+randomSequence(TRng& rng, int32_t const len, std::string const& alphabet) {
+  boost::random::uniform_int_distribution<int32_t> base(0, alphabet.size() - 1);
+  std::string s;
+  for(int32_t i = 0; i < len; ++i) s += alphabet[base(rng)];
+  return s;
+}
+
+// Probe segment with substitutions, insertions and deletions at the given rate, embedded in random flanks
+template<typename TRng>
+inline std::string
+mutatedRead(TRng& rng, std::string const& probe, double const rate) {
+  boost::random::uniform_real_distribution<double> unif(0, 1);
+  boost::random::uniform_int_distribution<int32_t> edit(0, 2);
+  boost::random::uniform_int_distribution<int32_t> flank(0, 30);
+  boost::random::uniform_int_distribution<int32_t> trim(0, probe.size() / 20);
+  std::string read = randomSequence(rng, flank(rng), "ACGT");
+  int32_t first = trim(rng);
+  int32_t last = probe.size() - trim(rng);
+  for(int32_t i = first; i < last; ++i) {
+    if (unif(rng) < rate) {
+      int32_t e = edit(rng);
+      if (e == 0) read += randomSequence(rng, 1, "ACGTN");
+      else if (e == 1) read += randomSequence(rng, 1, "ACGT") + probe[i];
+    } else read += probe[i];
+  }
+  read += randomSequence(rng, flank(rng), "ACGT");
+  return read;
+}
+
+// Worst case for the seed filter, one edit every step bases breaks all probe k-mers with k > step
+template<typename TRng>
+inline std::string
+spacedEditRead(TRng& rng, std::string const& probe, int32_t const step) {
+  boost::random::uniform_int_distribution<int32_t> edit(0, 2);
+  boost::random::uniform_int_distribution<int32_t> offset(0, step - 1);
+  std::string read;
+  int32_t next = offset(rng);
+  for(int32_t i = 0; i < (int32_t) probe.size(); ++i) {
+    if (i == next) {
+      int32_t e = edit(rng);
+      if (e == 0) read += (probe[i] == 'A') ? 'C' : 'A';
+      else if (e == 1) read += std::string(1, (probe[i] == 'A') ? 'C' : 'A') + probe[i];
+      next += step;
+    } else read += probe[i];
+  }
+  return read;
+}
+
+int main() {
+  boost::random::mt19937 rng(1);
+  DnaScore<int> simple(5, -4, -4, -4);
+  AlignConfig<true, false> semiglobal;
+  float flankQualities[] = {0.8, 0.9, 0.95};
+  uint32_t nprobes = 3000;
+  uint32_t nreads = 20;
+  uint64_t filtered = 0;
+  uint64_t nearThreshold = 0;
+  uint32_t errors = 0;
+  for(uint32_t p = 0; p < nprobes; ++p) {
+    // Random or low-complexity probes
+    ProbeConfig c;
+    c.flankQuality = flankQualities[p % 3];
+    boost::random::uniform_int_distribution<int32_t> plen(30, 250);
+    int32_t len = plen(rng);
+    std::string probe;
+    if (p % 4 == 3) {
+      std::string unit = randomSequence(rng, 1 + p % 5, "ACGT");
+      while ((int32_t) probe.size() < len) probe += unit;
+    } else probe = randomSequence(rng, len, "ACGT");
+    int32_t threshold = _probeThreshold(c, probe, simple);
+    ProbeSeeds ps;
+    _probeSeeds(probe, threshold, simple, ps);
+
+    // Mutated probe copies around the threshold and unrelated reads
+    boost::random::uniform_real_distribution<double> rate(0, 0.12);
+    boost::random::uniform_int_distribution<int32_t> rlen(30, 150);
+    for(uint32_t r = 0; r < nreads; ++r) {
+      std::string read;
+      if (r % 5 == 4) read = randomSequence(rng, rlen(rng), "ACGT");
+      else if ((r % 5 == 3) && (ps.k)) read = spacedEditRead(rng, probe, std::max(1, (int32_t) ps.k - (int32_t) (r % 2)));
+      else read = mutatedRead(rng, probe, rate(rng));
+      if (_sharesSeed(read, ps)) continue;
+      ++filtered;
+      typedef boost::multi_array<char, 2> TAlign;
+      TAlign align;
+      int32_t score = needle(probe, read, align, semiglobal, simple);
+      if (score > threshold) {
+	std::cerr << "Error: Read without a shared " << ps.k << "-mer scores " << score << " above threshold " << threshold << std::endl;
+	std::cerr << "Probe\t" << probe << std::endl;
+	std::cerr << "Read\t" << read << std::endl;
+	++errors;
+      } else if (score > 0.9 * threshold) ++nearThreshold;
+    }
+  }
+  std::cout << "Probes\t" << nprobes << std::endl;
+  std::cout << "Filtered reads\t" << filtered << std::endl;
+  std::cout << "Filtered near threshold\t" << nearThreshold << std::endl;
+  std::cout << "Filtered above threshold\t" << errors << std::endl;
+  if (errors) return 1;
+  return 0;
+}